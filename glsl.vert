@@ -1,12 +1,23 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 // https://www.khronos.org/opengl/wiki/Layout_Qualifier_(GLSL)
+// glslangValidator -V glsl.vert -o vert.spv
+// glslangValidator -V -DPUSH_CONSTANTS glsl.vert -o vert_push.spv
 
+// Transform in main.cpp, pushed with every draw or read from uniform ring
+#ifdef PUSH_CONSTANTS
+layout(push_constant) uniform PushConstants {
+    float scale;
+    float x;
+	float y;
+} ubo;
+#else
 layout(binding = 0) uniform UniformBufferObject {
     float scale;
     float x;
 	float y;
 } ubo;
+#endif
 
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
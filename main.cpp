@@ -6,21 +6,53 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cstddef>
 #include <vector>
 #include <cassert>
 #include <cmath>
 #include <ctime>
+#include <climits>
+#include <chrono>
 #include <functional>
-
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+// vertex packing uses SSE2 when compiler targets it (always on x64)
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HAS_SSE2
+#endif
+
+#ifdef _WIN32
 #include <windows.h>
 #define VK_USE_PLATFORM_WIN32_KHR
 #include "c:/VulkanSDK/1.1.108.0/Include/vulkan/vulkan.h"
 //#pragma comment(linker, "/subsystem:windows")
 #pragma comment(lib, "C:/VulkanSDK/1.1.108.0/Lib/vulkan-1.lib")
+#else
+// there is no window system on linux build, only headless mode (renders to offscreen image)
+// g++ main.cpp -o vk1 -lvulkan -pthread
+#include <vulkan/vulkan.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 typedef unsigned char byte;
 
-void readFile(const char* filename, std::vector<byte>& v)
+/**************************************************************************
+File I/O
+Purpose: load assets without copying them byte by byte
+files are memory mapped (os loads pages on first access, nothing is copied) or read in one call
+into 4 byte aligned memory which is what VkShaderModuleCreateInfo::pCode needs
+*/
+// old version, one call per byte, only kept to compare with in --io-bench
+void readFileSlow(const char* filename, std::vector<byte>& v)
 {
     FILE* file = fopen(filename, "rb");
     assert(file);
@@ -38,1009 +70,8570 @@ void readFile(const char* filename, std::vector<byte>& v)
     fclose(file);
 }
 
-LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+// whole file in one fread, uint32_t vector so data is aligned for pCode
+bool readFileAligned(const char* filename, std::vector<uint32_t>& v, size_t* size)
 {
-    switch (uMsg)
-    {
-    case WM_CLOSE:
+    FILE* file = fopen(filename, "rb");
+    if (!file)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    if (fileSize < 0)
     {
-        PostQuitMessage(0);
-        break;
-    }
-    default:
-        return DefWindowProc(hwnd, uMsg, wParam, lParam);
+        fclose(file);
+        return false;
     }
 
-    return 0;
+    v.resize(((size_t)fileSize + 3) / 4);
+    // last word is partially filled, rest of it is zero
+    if (!v.empty())
+        v.back() = 0;
+
+    bool ok = fread(v.data(), 1, (size_t)fileSize, file) == (size_t)fileSize;
+    fclose(file);
+
+    *size = (size_t)fileSize;
+    return ok;
 }
 
-void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkDevice device, VkBuffer* buffer, 
-    VkMemoryPropertyFlags memoryFlags, VkPhysicalDeviceMemoryProperties memProperties, VkDeviceMemory* bufferMemory)
+// read only view of whole file, page aligned
+struct MappedFile
+{
+    const byte* data;
+    size_t size;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+};
+
+bool mapFile(const char* filename, MappedFile* file)
 {
-    VkBufferCreateInfo stagingBufferInfo = {};
-    stagingBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    stagingBufferInfo.size = size;
-    stagingBufferInfo.usage = usage;
-    stagingBufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    file->data = nullptr;
+    file->size = 0;
 
-    assert(vkCreateBuffer(device, &stagingBufferInfo, nullptr, buffer) == VK_SUCCESS);
+#ifdef _WIN32
+    file->mapping = nullptr;
+    file->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
 
-    // memoryTypeBits is a bitmask and contains one bit set for every supported memory type for the resource. 
-    // Bit i is set if and only if the memory type i in the VkPhysicalDeviceMemoryProperties structure for the physical device is supported for the resource
-    VkMemoryRequirements memRequirementsForStagingBuffer;
-    vkGetBufferMemoryRequirements(device, *buffer, &memRequirementsForStagingBuffer);
+    if (file->file == INVALID_HANDLE_VALUE)
+        return false;
 
-    uint32_t stagingBufferMemoryTypeIndex = -1;
+    LARGE_INTEGER size;
+    GetFileSizeEx(file->file, &size);
+    file->size = (size_t)size.QuadPart;
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+    // empty file cant be mapped
+    if (file->size == 0)
+        return true;
+
+    file->mapping = CreateFileMappingA(file->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (file->mapping)
+        file->data = (const byte*)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (!file->data)
     {
-        // expression (A & B) == B
-        // means that A must have at least all bits of B set (can have more)
-        if ((memRequirementsForStagingBuffer.memoryTypeBits & (1 << i)) &&
-            (memProperties.memoryTypes[i].propertyFlags & memoryFlags) == memoryFlags)
+        if (file->mapping)
+            CloseHandle(file->mapping);
+        CloseHandle(file->file);
+        return false;
+    }
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    file->size = (size_t)info.st_size;
+
+    if (file->size > 0)
+    {
+        void* data = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
         {
-            stagingBufferMemoryTypeIndex = i;
-            break;
+            close(fd);
+            return false;
         }
+
+        file->data = (const byte*)data;
     }
 
-    assert(stagingBufferMemoryTypeIndex != -1);
+    // mapping stays valid after file is closed
+    close(fd);
+#endif
 
-    VkMemoryAllocateInfo stagingBufferMemoryAllocInfo = {};
-    stagingBufferMemoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    stagingBufferMemoryAllocInfo.allocationSize = memRequirementsForStagingBuffer.size;
-    stagingBufferMemoryAllocInfo.memoryTypeIndex = stagingBufferMemoryTypeIndex;
+    return true;
+}
 
-    // WARNING: this call should be keept to minimum, allocate a bunch of memory at once and then use offset to use one chunk for multiple buffers
-    assert(vkAllocateMemory(device, &stagingBufferMemoryAllocInfo, nullptr, bufferMemory) == VK_SUCCESS);
-    vkBindBufferMemory(device, *buffer, *bufferMemory, 0);
+void unmapFile(MappedFile* file)
+{
+#ifdef _WIN32
+    if (file->data)
+        UnmapViewOfFile(file->data);
+    if (file->mapping)
+        CloseHandle(file->mapping);
+    CloseHandle(file->file);
+#else
+    if (file->data)
+        munmap((void*)file->data, file->size);
+#endif
+
+    file->data = nullptr;
+    file->size = 0;
 }
 
-int main()
+// asset package: many files in one, loaded by mapping it once
+// [header][file data, every file 16 byte aligned][table of contents sorted by name]
+struct AssetPackageHeader
 {
-    /**************************************************************************
-    Window
-    Purpose: to have a window
-    */
-    const char* wndClassName = "mywindow";
-    HINSTANCE hinstance = GetModuleHandle(0);
-    HBRUSH bg = CreateSolidBrush(RGB(255, 0, 0));
-    uint32_t width = 800;
-    uint32_t height = 600;
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+    uint64_t tocOffset;
+};
+
+struct AssetPackageEntry
+{
+    char name[64];
+    uint64_t offset;
+    uint64_t size;
+};
 
-    WNDCLASS wc = { };
-    ZeroMemory(&wc, sizeof(WNDCLASS));
-    wc.lpfnWndProc = WindowProc;
-    wc.hInstance = hinstance;
-    wc.lpszClassName = wndClassName;
-    wc.hbrBackground = bg;
-    RegisterClass(&wc);
-
-    DWORD wndStyle = WS_SYSMENU | WS_CAPTION | WS_MINIMIZEBOX;
-    RECT r = { 0, 0, (LONG)width, (LONG)height };
-    // this tells you what should be the window size if r is rect for client
-    // IMPORTANT. window client, swap chain and VkImages (render target) dimensions must match
-    AdjustWindowRect(&r, wndStyle, false);
-    HWND hwnd = CreateWindowEx(0, wndClassName, "Vulkan", wndStyle, 100, 100, 
-        r.right - r.left, r.bottom - r.top, 0, 0, hinstance, 0);
-    assert(hwnd != 0);
-    ShowWindow(hwnd, SW_SHOW);
+struct AssetPackage
+{
+    MappedFile file;
+    const AssetPackageEntry* entries;
+    uint32_t entryCount;
+};
 
-    /**************************************************************************
-    VkInstance
-    Purpose: check if vulkan driver is present and to query for physical devices
-    it also creates win32 surface
-    */
-    VkApplicationInfo appInfo = {};
-    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+const char assetPackageMagic[4] = { 'V', 'P', 'A', 'K' };
+const uint32_t assetPackageVersion = 1;
 
-    // all optional
-    appInfo.pApplicationName = "Vk1";
-    appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.pEngineName = "No Engine";
-    appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+// packs files into one package, names in package are the paths as given
+bool writeAssetPackage(const char* packageName, const std::vector<const char*>& files)
+{
+    std::vector<const char*> sorted = files;
+    std::sort(sorted.begin(), sorted.end(), [](const char* a, const char* b) { return strcmp(a, b) < 0; });
+
+    FILE* package = fopen(packageName, "wb");
+    if (!package)
+        return false;
+
+    AssetPackageHeader header = {};
+    memcpy(header.magic, assetPackageMagic, 4);
+    header.version = assetPackageVersion;
+    header.entryCount = (uint32_t)sorted.size();
+    fwrite(&header, sizeof(header), 1, package);
+
+    std::vector<AssetPackageEntry> toc(sorted.size());
+    std::vector<uint32_t> data;
+    uint64_t offset = sizeof(header);
+    const byte zeros[16] = {};
+    bool ok = true;
+
+    for (size_t i = 0; i < sorted.size() && ok; i++)
+    {
+        size_t size = 0;
 
-    const char* ext[] = { "VK_KHR_surface", "VK_KHR_win32_surface" };
-    const char* layers[] = { "VK_LAYER_KHRONOS_validation" };
+        if (strlen(sorted[i]) >= sizeof(toc[i].name) || !readFileAligned(sorted[i], data, &size))
+        {
+            printf("cant pack %s\n", sorted[i]);
+            ok = false;
+            break;
+        }
 
-    VkInstanceCreateInfo vkInstanceArgs = {};
-    vkInstanceArgs.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    vkInstanceArgs.pApplicationInfo = &appInfo;
-    vkInstanceArgs.enabledExtensionCount = 2;
-    vkInstanceArgs.ppEnabledExtensionNames = ext;
+        // data starts 16 byte aligned, enough for anything that is read from it directly
+        uint64_t padding = (16 - offset % 16) % 16;
+        fwrite(zeros, 1, (size_t)padding, package);
+        offset += padding;
 
-    // enable this to see some diagnostic
-    // requires vulkan 1.1.106 or higher, prints to stdout by default
-    vkInstanceArgs.enabledLayerCount = 1;
-    vkInstanceArgs.ppEnabledLayerNames = layers;
+        strcpy(toc[i].name, sorted[i]);
+        toc[i].offset = offset;
+        toc[i].size = size;
 
-    VkInstance vkInstance;
-    assert(vkCreateInstance(&vkInstanceArgs, nullptr, &vkInstance) == VK_SUCCESS);
+        ok = fwrite(data.data(), 1, size, package) == size;
+        offset += size;
+    }
 
-    /**************************************************************************
-    Physical device and queue index
-    Purpose: needed to create logical device and queue
-    */
-    uint32_t queueIndex = -1;
-    uint32_t gpuCount = 0;
-    uint32_t queueFamilyCount = 0;
-    VkPhysicalDeviceProperties gpuProperties;
-    VkPhysicalDeviceFeatures gpuFeatures;
-    std::vector<VkPhysicalDevice> gpus;
-    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-    std::vector<VkQueueFamilyProperties> queueFamilies;
+    uint64_t padding = (16 - offset % 16) % 16;
+    fwrite(zeros, 1, (size_t)padding, package);
+    header.tocOffset = offset + padding;
 
-    vkEnumeratePhysicalDevices(vkInstance, &gpuCount, nullptr);
-    gpus.resize(gpuCount);
-    vkEnumeratePhysicalDevices(vkInstance, &gpuCount, gpus.data());
+    if (ok && !toc.empty())
+        ok = fwrite(toc.data(), sizeof(AssetPackageEntry), toc.size(), package) == toc.size();
 
-    for (uint32_t i = 0; i < gpuCount; i++)
+    // header again now that toc offset is known
+    fseek(package, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, package);
+    ok = fclose(package) == 0 && ok;
+
+    if (!ok)
+        remove(packageName);
+
+    return ok;
+}
+
+bool openAssetPackage(const char* packageName, AssetPackage* package)
+{
+    if (!mapFile(packageName, &package->file))
+        return false;
+
+    const MappedFile& file = package->file;
+    AssetPackageHeader header;
+    bool valid = file.size >= sizeof(header);
+
+    if (valid)
     {
-        vkGetPhysicalDeviceProperties(gpus[i], &gpuProperties);
-        vkGetPhysicalDeviceFeatures(gpus[i], &gpuFeatures);
-        vkGetPhysicalDeviceQueueFamilyProperties(gpus[i], &queueFamilyCount, nullptr);
-        queueFamilies.resize(queueFamilyCount);
-        vkGetPhysicalDeviceQueueFamilyProperties(gpus[i], &queueFamilyCount, queueFamilies.data());
+        memcpy(&header, file.data, sizeof(header));
+        valid = memcmp(header.magic, assetPackageMagic, 4) == 0 && header.version == assetPackageVersion &&
+            header.tocOffset % 16 == 0 && header.tocOffset <= file.size &&
+            (file.size - header.tocOffset) / sizeof(AssetPackageEntry) >= header.entryCount;
+    }
 
-        // check if VK_KHR_SWAPCHAIN_EXTENSION_NAME is supported
-        uint32_t extensionCount;
-        vkEnumerateDeviceExtensionProperties(gpus[i], nullptr, &extensionCount, nullptr);
-        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-        vkEnumerateDeviceExtensionProperties(gpus[i], nullptr, &extensionCount, availableExtensions.data());
+    if (valid)
+    {
+        package->entries = (const AssetPackageEntry*)(file.data + header.tocOffset);
+        package->entryCount = header.entryCount;
 
-        bool swapChainSupported = false;
-        for (int i = 0; i < availableExtensions.size(); i++)
+        for (uint32_t i = 0; i < package->entryCount && valid; i++)
         {
-            if (strcmp(availableExtensions[i].extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) != 0)
-            {
-                swapChainSupported = true;
-                break;
-            }
+            const AssetPackageEntry& entry = package->entries[i];
+            valid = memchr(entry.name, 0, sizeof(entry.name)) != nullptr &&
+                entry.offset <= header.tocOffset && entry.size <= header.tocOffset - entry.offset;
         }
+    }
 
-        if (!swapChainSupported)
-            continue;
+    if (!valid)
+    {
+        printf("%s is not a valid asset package\n", packageName);
+        unmapFile(&package->file);
+        return false;
+    }
 
-        for (uint32_t j = 0; j < queueFamilyCount; j++)
+    return true;
+}
+
+// pointer into mapped package, no copy, valid until package is closed
+bool findAsset(const AssetPackage* package, const char* name, const byte** data, size_t* size)
+{
+    // toc is sorted by name
+    uint32_t first = 0;
+    uint32_t last = package->entryCount;
+
+    while (first < last)
+    {
+        uint32_t middle = (first + last) / 2;
+        int order = strcmp(package->entries[middle].name, name);
+
+        if (order == 0)
         {
-            // lets limit this to discrete GPU
-            // queue must have graphics VK_QUEUE_GRAPHICS_BIT and present bit and 
-            // VK_QUEUE_TRANSFER_BIT (its guaranteed that if graphics is supported then transfer is supported)
-            if (gpuProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU && 
-                queueFamilies[j].queueFlags & VK_QUEUE_GRAPHICS_BIT)
-            {
-                queueIndex = j;
-                // physical device doesnt have to be created
-                physicalDevice = gpus[i];
-                break;
-            }
+            *data = package->file.data + package->entries[middle].offset;
+            *size = (size_t)package->entries[middle].size;
+            return true;
         }
 
-        if (physicalDevice != VK_NULL_HANDLE)
-            break;
+        if (order < 0)
+            first = middle + 1;
+        else
+            last = middle;
     }
 
-    assert(queueIndex != -1);
-    assert(physicalDevice != VK_NULL_HANDLE);
+    return false;
+}
 
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+void closeAssetPackage(AssetPackage* package)
+{
+    unmapFile(&package->file);
+    package->entries = nullptr;
+    package->entryCount = 0;
+}
 
-    /**************************************************************************
-    Logical device and command queue
-    Purpose: device needed for nearly everything in vulkan, queue needed to execute commands
-    */
-    float queuePriority = 1.0f;
+// asset from package if there is one and it has it, otherwise file is mapped
+struct Asset
+{
+    const byte* data;
+    size_t size;
+    MappedFile file;
+    bool ownsFile;
+};
 
-    // its possible that more than one queue is needed so its would require multiple VkDeviceQueueCreateInfo
-    VkDeviceQueueCreateInfo queueArgs = {};
-    queueArgs.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueArgs.queueFamilyIndex = queueIndex;
-    queueArgs.queueCount = 1;
-    queueArgs.pQueuePriorities = &queuePriority;
+bool loadAsset(const AssetPackage* package, const char* name, Asset* asset)
+{
+    asset->ownsFile = false;
 
-    VkPhysicalDeviceFeatures deviceFeatures = {};
+    if (package && findAsset(package, name, &asset->data, &asset->size))
+        return true;
 
-    const char* extensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
-    VkDeviceCreateInfo deviceArgs = {};
-    deviceArgs.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceArgs.pQueueCreateInfos = &queueArgs;
-    deviceArgs.queueCreateInfoCount = 1;
-    deviceArgs.pEnabledFeatures = &deviceFeatures;
-    deviceArgs.enabledExtensionCount = 1;
-    deviceArgs.ppEnabledExtensionNames = extensions;
+    if (!mapFile(name, &asset->file))
+        return false;
 
-    // create device creates logical device and all the queues
-    VkDevice device;
-    assert(vkCreateDevice(physicalDevice, &deviceArgs, nullptr, &device) == VK_SUCCESS);
-    // queues are created, query for one found before (queueIndex)
-    VkQueue queue;
-    vkGetDeviceQueue(device, queueIndex, 0, &queue);
+    asset->data = asset->file.data;
+    asset->size = asset->file.size;
+    asset->ownsFile = true;
 
-    /**************************************************************************
-    Surface
-    Purpose: to connect vulkan (more specifically swapchain) with window
-    */
-    VkWin32SurfaceCreateInfoKHR surfaceArgs = {};
-    surfaceArgs.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
-    surfaceArgs.hinstance = hinstance;
-    surfaceArgs.hwnd = hwnd;
+    return true;
+}
+
+void releaseAsset(Asset* asset)
+{
+    if (asset->ownsFile)
+        unmapFile(&asset->file);
 
-    VkSurfaceKHR surface;
-    assert(vkCreateWin32SurfaceKHR(vkInstance, &surfaceArgs, nullptr, &surface) == VK_SUCCESS);
+    asset->data = nullptr;
+    asset->size = 0;
+}
 
-    // check if the queue support presentation, its possbile that there is a different queue for this
-    // for now, lets hope that selected queue supports it
-    VkBool32 physicalDeviceSupportSurface = VK_FALSE;
-    vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, queueIndex, surface, &physicalDeviceSupportSurface);
+// every loader has to touch all bytes, mapping alone doesnt read anything
+// plain sum so it vectorizes and doesnt hide the difference between loaders
+uint32_t checksumBytes(const byte* data, size_t size)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < size; i++)
+        sum += data[i];
+    return sum;
+}
 
-    assert(physicalDeviceSupportSurface == VK_TRUE);
-    
-    VkSurfaceCapabilitiesKHR surfaceCapabilities;
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
+// loads the same file with every method, cold cache is not measured (first iteration warms it up for all)
+void runIoBenchmark(const char* filename, uint32_t iterations)
+{
+    std::vector<const char*> files(1, filename);
+    const char* packageName = "io_bench.pak";
+    assert(writeAssetPackage(packageName, files));
 
-    uint32_t formatCount;
-    std::vector<VkSurfaceFormatKHR> surfaceFormats;
-    vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, nullptr);
-    surfaceFormats.resize(formatCount);
-    vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, surfaceFormats.data());
+    double ms[4] = {};
+    uint32_t sums[4] = {};
+    size_t fileSize = 0;
 
-    // see if format available
-    VkSurfaceFormatKHR surfaceFormat = {};
-    for (uint32_t i = 0; i < formatCount; i++)
+    for (uint32_t i = 0; i <= iterations; i++)
     {
-        // this is the most optimal combination
-        if (surfaceFormats[i].format == VK_FORMAT_B8G8R8A8_UNORM && surfaceFormats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+        auto start = std::chrono::steady_clock::now();
+        std::vector<byte> slow;
+        readFileSlow(filename, slow);
+        sums[0] = checksumBytes(slow.data(), slow.size());
+        fileSize = slow.size();
+        double slowMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        std::vector<uint32_t> bulk;
+        size_t bulkSize = 0;
+        assert(readFileAligned(filename, bulk, &bulkSize));
+        sums[1] = checksumBytes((const byte*)bulk.data(), bulkSize);
+        double bulkMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        MappedFile mapped;
+        assert(mapFile(filename, &mapped));
+        sums[2] = checksumBytes(mapped.data, mapped.size);
+        unmapFile(&mapped);
+        double mapMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        AssetPackage package;
+        assert(openAssetPackage(packageName, &package));
+        const byte* data = nullptr;
+        size_t size = 0;
+        assert(findAsset(&package, filename, &data, &size));
+        sums[3] = checksumBytes(data, size);
+        closeAssetPackage(&package);
+        double packageMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // first run only warms up os file cache
+        if (i > 0)
         {
-            surfaceFormat = surfaceFormats[i];
-            break;
+            ms[0] += slowMs;
+            ms[1] += bulkMs;
+            ms[2] += mapMs;
+            ms[3] += packageMs;
         }
     }
 
-    assert(surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM);
+    remove(packageName);
 
-    // can be used to enumerate present modes
-    // commented out because VK_PRESENT_MODE_FIFO_KHR used ant it's always present
-    //uint32_t presentModeCount;
-    //std::vector<VkPresentModeKHR> surfacePresentationModes;
-    //vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, nullptr);
-    //assert(presentModeCount != 0);
-    //surfacePresentationModes.resize(presentModeCount);
-    //vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, 
-    //    &presentModeCount, surfacePresentationModes.data());
+    const char* names[4] = { "readFile (fgetc)", "bulk aligned read", "mmap", "package (mmap)" };
+    printf("io bench: %s, %zu bytes, %u iterations\n", filename, fileSize, iterations);
 
-    // VK_PRESENT_MODE_FIFO_KHR always exists
-    VkPresentModeKHR surfacePresentationMode = VK_PRESENT_MODE_FIFO_KHR; // vsync;
-    //VkPresentModeKHR surfacePresentationMode = VK_PRESENT_MODE_IMMEDIATE_KHR; // no vsync;
+    for (int i = 0; i < 4; i++)
+    {
+        double perLoad = iterations ? ms[i] / iterations : 0;
+        printf("  %-20s %9.3f ms/load %9.1f MB/s %5.1fx%s\n", names[i], perLoad,
+            perLoad > 0 ? fileSize / (perLoad * 1000.0) : 0.0, perLoad > 0 && ms[0] > 0 ? ms[0] / ms[i] : 0.0,
+            sums[i] == sums[0] ? "" : " CHECKSUM MISMATCH");
+    }
+}
 
-    /**************************************************************************
-    Swap Chain
-    Purpose: actually surface doesnt connect to the vulkan, swap chain does and
-    surface connects to swap chain.
-    Creating swapchain with vulkan creates VkImage as well which is actual vulkan object
-    where vulkan renders pixels to
-    */
-    VkExtent2D swapChainExtent = { width,height };
-    // recommendation is minimum + 1
-    uint32_t frameBufferCount = surfaceCapabilities.minImageCount + 1;
+#ifdef _WIN32
+// what window procedure tells the program loop, pointer is stored in GWLP_USERDATA
+struct WindowState
+{
+    // swapchain no longer matches client size
+    bool resized;
+    // client size is 0x0, nothing can be drawn
+    bool minimized;
+};
 
-    // check if max is not exceeded
-    if (surfaceCapabilities.maxImageCount > 0 && frameBufferCount > surfaceCapabilities.maxImageCount)
-        frameBufferCount = surfaceCapabilities.maxImageCount;
+LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+    WindowState* state = (WindowState*)GetWindowLongPtr(hwnd, GWLP_USERDATA);
 
-    VkSwapchainCreateInfoKHR swapChainArgs = {};
-    swapChainArgs.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-    swapChainArgs.surface = surface;
-    swapChainArgs.minImageCount = frameBufferCount;
-    swapChainArgs.imageFormat = surfaceFormat.format;
-    swapChainArgs.imageColorSpace = surfaceFormat.colorSpace;
-    swapChainArgs.imageExtent = swapChainExtent;
-    // this is 1 unless your render is more than 2D
-    swapChainArgs.imageArrayLayers = 1;
-    // idk what that is
-    swapChainArgs.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    // this flag has best performance if there is only one queue
-    swapChainArgs.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    // this needs to be set if there is more than one queue, e.g. one for graphics and one for present
-    //swapChainArgs.queueFamilyIndexCount = 2;
-    //swapChainArgs.pQueueFamilyIndices = queueFamilyIndices;
-    // idk what that is
-    swapChainArgs.preTransform = surfaceCapabilities.currentTransform;
-    // idk what that is
-    swapChainArgs.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-    swapChainArgs.presentMode = surfacePresentationMode;
-    // idk what that is
-    swapChainArgs.clipped = VK_TRUE;
+    switch (uMsg)
+    {
+    case WM_CLOSE:
+    {
+        PostQuitMessage(0);
+        break;
+    }
+    case WM_SIZE:
+    {
+        // first WM_SIZE comes from CreateWindowEx before state is set, swapchain doesnt exist then anyway
+        if (state)
+        {
+            state->resized = true;
+            state->minimized = wParam == SIZE_MINIMIZED || LOWORD(lParam) == 0 || HIWORD(lParam) == 0;
+        }
+        break;
+    }
+    default:
+        return DefWindowProc(hwnd, uMsg, wParam, lParam);
+    }
 
-    VkSwapchainKHR swapChain;
-    assert(vkCreateSwapchainKHR(device, &swapChainArgs, nullptr, &swapChain) == VK_SUCCESS);
+    return 0;
+}
+#endif
 
-    // images were created with swapchain
-    // count was specified above but vulkan might have created more images than that
-    vkGetSwapchainImagesKHR(device, swapChain, &frameBufferCount, nullptr);
-    std::vector<VkImage> swapChainImages;
-    swapChainImages.resize(frameBufferCount);
-    vkGetSwapchainImagesKHR(device, swapChain, &frameBufferCount, swapChainImages.data());
+VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
 
-    /**************************************************************************
-    VkImageView
-    Purpose: some helper object for VkImage (used here as render target)
-    */
-    std::vector<VkImageView> swapChainImageViews;
-    swapChainImageViews.resize(frameBufferCount);
+/**************************************************************************
+Device memory sub-allocator
+vkAllocateMemory is slow and number of allocations is limited (maxMemoryAllocationCount, can be as low as 4096)
+so memory is allocated in big blocks and resources are placed inside them at offsets
+*/
+struct MemoryRange
+{
+    VkDeviceSize offset;
+    VkDeviceSize size;
+};
 
-    for (size_t i = 0; i < frameBufferCount; i++)
-    {
-        VkImageViewCreateInfo imageViewArgs = {};
-        imageViewArgs.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        imageViewArgs.image = swapChainImages[i];
-        imageViewArgs.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        imageViewArgs.format = surfaceFormat.format;
-        imageViewArgs.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewArgs.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewArgs.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewArgs.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewArgs.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageViewArgs.subresourceRange.baseMipLevel = 0;
-        imageViewArgs.subresourceRange.levelCount = 1;
-        imageViewArgs.subresourceRange.baseArrayLayer = 0;
-        imageViewArgs.subresourceRange.layerCount = 1;
+struct MemoryBlock
+{
+    // VK_NULL_HANDLE if block was released and slot can be reused
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memoryTypeIndex;
+    // buffers and linear images (true) and optimal images (false) never share block
+    // this way bufferImageGranularity never has to be checked between neighbours
+    bool linear;
+    // block bigger than allocator->blockSize made for one big resource, released when it's freed
+    bool dedicated;
+    // host visible blocks are mapped once for whole lifetime, vkMapMemory cant be called twice on same memory
+    byte* mapped;
+    // sorted by offset, neighbours are merged when freeing
+    std::vector<MemoryRange> freeRanges;
+    uint32_t allocationCount;
+};
+
+struct MemoryAllocation
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint32_t blockIndex;
+    // nullptr if memory is not host visible
+    byte* mapped;
+};
+
+struct DeviceAllocator
+{
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memProperties;
+    VkDeviceSize bufferImageGranularity;
+    VkDeviceSize blockSize;
+    std::vector<MemoryBlock> blocks;
+    uint32_t vkAllocateMemoryCount;
+};
 
-        assert(vkCreateImageView(device, &imageViewArgs, nullptr, &swapChainImageViews[i]) == VK_SUCCESS);
-    }
+struct DeviceAllocatorStats
+{
+    uint32_t blockCount;
+    uint32_t allocationCount;
+    // all memory allocated with vkAllocateMemory
+    VkDeviceSize bytesReserved;
+    VkDeviceSize bytesInUse;
+    VkDeviceSize bytesFree;
+    VkDeviceSize largestFreeRange;
+    // 0 - free memory of every block is in one range, close to 1 - free memory is split into many small ranges
+    float fragmentation;
+};
+
+void createDeviceAllocator(VkDevice device, VkPhysicalDeviceMemoryProperties memProperties,
+    VkDeviceSize bufferImageGranularity, VkDeviceSize blockSize, DeviceAllocator* allocator)
+{
+    allocator->device = device;
+    allocator->memProperties = memProperties;
+    allocator->bufferImageGranularity = bufferImageGranularity;
+    allocator->blockSize = blockSize;
+    allocator->blocks.clear();
+    allocator->vkAllocateMemoryCount = 0;
+}
 
-    /************************************************************************************
+// takes range from block free list, best fit (smallest range that fits) to keep big ranges for big resources
+bool allocateFromBlock(MemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize* offset)
+{
+    size_t best = block->freeRanges.size();
+    VkDeviceSize bestSize = 0;
+
+    for (size_t i = 0; i < block->freeRanges.size(); i++)
+    {
+        MemoryRange range = block->freeRanges[i];
+        VkDeviceSize start = alignUp(range.offset, alignment);
+
+        if (start + size <= range.offset + range.size && (best == block->freeRanges.size() || range.size < bestSize))
+        {
+            best = i;
+            bestSize = range.size;
+        }
+    }
+
+    if (best == block->freeRanges.size())
+        return false;
+
+    MemoryRange range = block->freeRanges[best];
+    VkDeviceSize start = alignUp(range.offset, alignment);
+    VkDeviceSize end = start + size;
+    block->freeRanges.erase(block->freeRanges.begin() + best);
+
+    // whats left before (alignment padding) and after goes back to free list, order is kept
+    if (end < range.offset + range.size)
+        block->freeRanges.insert(block->freeRanges.begin() + best, { end, range.offset + range.size - end });
+    if (start > range.offset)
+        block->freeRanges.insert(block->freeRanges.begin() + best, { range.offset, start - range.offset });
+
+    block->allocationCount++;
+    *offset = start;
+
+    return true;
+}
+
+// linear is true for buffers and VK_IMAGE_TILING_LINEAR images, false for VK_IMAGE_TILING_OPTIMAL images
+bool allocateDeviceMemory(DeviceAllocator* allocator, VkMemoryRequirements memRequirements,
+    VkMemoryPropertyFlags memoryFlags, bool linear, MemoryAllocation* allocation)
+{
+    // if granularity is 1 there is no conflict between buffers and images and they can share blocks
+    bool separateByKind = allocator->bufferImageGranularity > 1;
+
+    // memoryTypeBits is a bitmask and contains one bit set for every supported memory type for the resource. 
+    // Bit i is set if and only if the memory type i in the VkPhysicalDeviceMemoryProperties structure for the physical device is supported for the resource
+    for (uint32_t type = 0; type < allocator->memProperties.memoryTypeCount; type++)
+    {
+        // expression (A & B) == B
+        // means that A must have at least all bits of B set (can have more)
+        if (!(memRequirements.memoryTypeBits & (1 << type)) ||
+            (allocator->memProperties.memoryTypes[type].propertyFlags & memoryFlags) != memoryFlags)
+            continue;
+
+        // try existing blocks first
+        for (uint32_t i = 0; i < allocator->blocks.size(); i++)
+        {
+            MemoryBlock* block = &allocator->blocks[i];
+
+            if (block->memory == VK_NULL_HANDLE || block->dedicated || block->memoryTypeIndex != type ||
+                (separateByKind && block->linear != linear))
+                continue;
+
+            VkDeviceSize offset;
+            if (allocateFromBlock(block, memRequirements.size, memRequirements.alignment, &offset))
+            {
+                allocation->memory = block->memory;
+                allocation->offset = offset;
+                allocation->size = memRequirements.size;
+                allocation->blockIndex = i;
+                allocation->mapped = block->mapped ? block->mapped + offset : nullptr;
+                return true;
+            }
+        }
+
+        // new block, dont use more than 1/8 of the heap for one block
+        VkDeviceSize heapSize = allocator->memProperties.memoryHeaps[allocator->memProperties.memoryTypes[type].heapIndex].size;
+        VkDeviceSize blockSize = allocator->blockSize;
+        if (blockSize > heapSize / 8)
+            blockSize = heapSize / 8;
+
+        bool dedicated = memRequirements.size > blockSize;
+        if (dedicated)
+            blockSize = memRequirements.size;
+
+        VkMemoryAllocateInfo memoryAllocInfo = {};
+        memoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        memoryAllocInfo.allocationSize = blockSize;
+        memoryAllocInfo.memoryTypeIndex = type;
+
+        MemoryBlock block = {};
+        // heap can be full, then try next memory type that matches
+        if (vkAllocateMemory(allocator->device, &memoryAllocInfo, nullptr, &block.memory) != VK_SUCCESS)
+            continue;
+
+        allocator->vkAllocateMemoryCount++;
+
+        block.size = blockSize;
+        block.memoryTypeIndex = type;
+        block.linear = linear;
+        block.dedicated = dedicated;
+        block.mapped = nullptr;
+        block.freeRanges.push_back({ 0, blockSize });
+        block.allocationCount = 0;
+
+        if (allocator->memProperties.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        {
+            void* mapped = nullptr;
+            assert(vkMapMemory(allocator->device, block.memory, 0, VK_WHOLE_SIZE, 0, &mapped) == VK_SUCCESS);
+            block.mapped = (byte*)mapped;
+        }
+
+        // reuse slot of released block so indices in existing allocations stay valid
+        uint32_t blockIndex = (uint32_t)allocator->blocks.size();
+        for (uint32_t i = 0; i < allocator->blocks.size(); i++)
+        {
+            if (allocator->blocks[i].memory == VK_NULL_HANDLE)
+            {
+                blockIndex = i;
+                break;
+            }
+        }
+
+        if (blockIndex == allocator->blocks.size())
+            allocator->blocks.push_back(block);
+        else
+            allocator->blocks[blockIndex] = block;
+
+        VkDeviceSize offset;
+        assert(allocateFromBlock(&allocator->blocks[blockIndex], memRequirements.size, memRequirements.alignment, &offset));
+
+        allocation->memory = block.memory;
+        allocation->offset = offset;
+        allocation->size = memRequirements.size;
+        allocation->blockIndex = blockIndex;
+        allocation->mapped = block.mapped ? block.mapped + offset : nullptr;
+        return true;
+    }
+
+    return false;
+}
+
+void freeDeviceMemory(DeviceAllocator* allocator, MemoryAllocation* allocation)
+{
+    MemoryBlock* block = &allocator->blocks[allocation->blockIndex];
+    assert(block->memory == allocation->memory);
+
+    block->allocationCount--;
+
+    if (block->dedicated && block->allocationCount == 0)
+    {
+        if (block->mapped)
+            vkUnmapMemory(allocator->device, block->memory);
+
+        vkFreeMemory(allocator->device, block->memory, nullptr);
+        block->memory = VK_NULL_HANDLE;
+        block->freeRanges.clear();
+        *allocation = {};
+        return;
+    }
+
+    // insert range at its place and merge with neighbours
+    MemoryRange range = { allocation->offset, allocation->size };
+    size_t i = 0;
+    while (i < block->freeRanges.size() && block->freeRanges[i].offset < range.offset)
+        i++;
+
+    block->freeRanges.insert(block->freeRanges.begin() + i, range);
+
+    if (i + 1 < block->freeRanges.size() &&
+        block->freeRanges[i].offset + block->freeRanges[i].size == block->freeRanges[i + 1].offset)
+    {
+        block->freeRanges[i].size += block->freeRanges[i + 1].size;
+        block->freeRanges.erase(block->freeRanges.begin() + i + 1);
+    }
+
+    if (i > 0 && block->freeRanges[i - 1].offset + block->freeRanges[i - 1].size == block->freeRanges[i].offset)
+    {
+        block->freeRanges[i - 1].size += block->freeRanges[i].size;
+        block->freeRanges.erase(block->freeRanges.begin() + i);
+    }
+
+    *allocation = {};
+}
+
+DeviceAllocatorStats getDeviceAllocatorStats(const DeviceAllocator* allocator)
+{
+    DeviceAllocatorStats stats = {};
+    // free bytes that are not in the biggest free range of their block
+    VkDeviceSize bytesFragmented = 0;
+
+    for (size_t i = 0; i < allocator->blocks.size(); i++)
+    {
+        const MemoryBlock& block = allocator->blocks[i];
+
+        if (block.memory == VK_NULL_HANDLE)
+            continue;
+
+        stats.blockCount++;
+        stats.allocationCount += block.allocationCount;
+        stats.bytesReserved += block.size;
+
+        VkDeviceSize blockFree = 0;
+        VkDeviceSize blockLargestFree = 0;
+
+        for (size_t j = 0; j < block.freeRanges.size(); j++)
+        {
+            blockFree += block.freeRanges[j].size;
+            if (block.freeRanges[j].size > blockLargestFree)
+                blockLargestFree = block.freeRanges[j].size;
+        }
+
+        stats.bytesFree += blockFree;
+        bytesFragmented += blockFree - blockLargestFree;
+        if (blockLargestFree > stats.largestFreeRange)
+            stats.largestFreeRange = blockLargestFree;
+    }
+
+    // alignment padding is counted as in use
+    stats.bytesInUse = stats.bytesReserved - stats.bytesFree;
+    stats.fragmentation = stats.bytesFree > 0 ? (float)bytesFragmented / (float)stats.bytesFree : 0.0f;
+
+    return stats;
+}
+
+void printDeviceAllocatorStats(const DeviceAllocator* allocator)
+{
+    DeviceAllocatorStats stats = getDeviceAllocatorStats(allocator);
+
+    printf("device memory: %u blocks, %u allocations, %.2f MB in use of %.2f MB reserved, "
+        "largest free range %.2f MB, fragmentation %.2f, %u vkAllocateMemory calls\n",
+        stats.blockCount, stats.allocationCount, stats.bytesInUse / (1024.0 * 1024.0), stats.bytesReserved / (1024.0 * 1024.0),
+        stats.largestFreeRange / (1024.0 * 1024.0), stats.fragmentation, allocator->vkAllocateMemoryCount);
+}
+
+void destroyDeviceAllocator(DeviceAllocator* allocator)
+{
+    for (size_t i = 0; i < allocator->blocks.size(); i++)
+    {
+        MemoryBlock& block = allocator->blocks[i];
+
+        if (block.memory == VK_NULL_HANDLE)
+            continue;
+
+        if (block.mapped)
+            vkUnmapMemory(allocator->device, block.memory);
+
+        vkFreeMemory(allocator->device, block.memory, nullptr);
+    }
+
+    allocator->blocks.clear();
+}
+
+void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, DeviceAllocator* allocator, VkBuffer* buffer,
+    VkMemoryPropertyFlags memoryFlags, MemoryAllocation* bufferMemory)
+{
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    assert(vkCreateBuffer(allocator->device, &bufferInfo, nullptr, buffer) == VK_SUCCESS);
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(allocator->device, *buffer, &memRequirements);
+
+    // buffer gets part of a bigger block, not its own VkDeviceMemory
+    assert(allocateDeviceMemory(allocator, memRequirements, memoryFlags, true, bufferMemory));
+    vkBindBufferMemory(allocator->device, *buffer, bufferMemory->memory, bufferMemory->offset);
+}
+
+void destroyBuffer(DeviceAllocator* allocator, VkBuffer buffer, MemoryAllocation* bufferMemory)
+{
+    vkDestroyBuffer(allocator->device, buffer, nullptr);
+    freeDeviceMemory(allocator, bufferMemory);
+}
+
+void createImage(const VkImageCreateInfo* imageCreateInfo, DeviceAllocator* allocator, VkImage* image,
+    VkMemoryPropertyFlags memoryFlags, MemoryAllocation* imageMemory)
+{
+    assert(vkCreateImage(allocator->device, imageCreateInfo, nullptr, image) == VK_SUCCESS);
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(allocator->device, *image, &memRequirements);
+
+    bool linear = imageCreateInfo->tiling == VK_IMAGE_TILING_LINEAR;
+    assert(allocateDeviceMemory(allocator, memRequirements, memoryFlags, linear, imageMemory));
+    vkBindImageMemory(allocator->device, *image, imageMemory->memory, imageMemory->offset);
+}
+
+void destroyImage(DeviceAllocator* allocator, VkImage image, MemoryAllocation* imageMemory)
+{
+    vkDestroyImage(allocator->device, image, nullptr);
+    freeDeviceMemory(allocator, imageMemory);
+}
+
+// full chain down to 1x1
+uint32_t mipLevelCount(uint32_t width, uint32_t height)
+{
+    uint32_t levels = 1;
+    uint32_t size = width > height ? width : height;
+
+    while (size > 1)
+    {
+        size /= 2;
+        levels++;
+    }
+
+    return levels;
+}
+
+// mips can be made with vkCmdBlitImage only if format can be blitted and filtered
+bool formatSupportsLinearBlit(VkPhysicalDevice gpu, VkFormat format)
+{
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(gpu, format, &properties);
+
+    VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    return (properties.optimalTilingFeatures & needed) == needed;
+}
+
+// cpu fallback when format cant be blitted, 2x2 box filter (odd edge is clamped)
+// appends all levels of RGBA8 image to data and one copy region per level
+void buildMipChainRgba8(const byte* pixels, uint32_t width, uint32_t height, uint32_t levels,
+    std::vector<byte>& data, std::vector<VkBufferImageCopy>& regions)
+{
+    size_t levelOffset = data.size();
+    data.insert(data.end(), pixels, pixels + width * height * 4);
+
+    for (uint32_t level = 0; level < levels; level++)
+    {
+        VkBufferImageCopy region = {};
+        region.bufferOffset = levelOffset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = level;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { width, height, 1 };
+        regions.push_back(region);
+
+        if (level + 1 == levels)
+            break;
+
+        uint32_t nextWidth = width > 1 ? width / 2 : 1;
+        uint32_t nextHeight = height > 1 ? height / 2 : 1;
+        size_t nextOffset = data.size();
+        data.resize(nextOffset + nextWidth * nextHeight * 4);
+
+        // data can move in resize, pointers are taken after it
+        const byte* src = &data[levelOffset];
+        byte* dst = &data[nextOffset];
+
+        for (uint32_t y = 0; y < nextHeight; y++)
+        {
+            uint32_t y0 = y * 2 < height ? y * 2 : height - 1;
+            uint32_t y1 = y * 2 + 1 < height ? y * 2 + 1 : height - 1;
+
+            for (uint32_t x = 0; x < nextWidth; x++)
+            {
+                uint32_t x0 = x * 2 < width ? x * 2 : width - 1;
+                uint32_t x1 = x * 2 + 1 < width ? x * 2 + 1 : width - 1;
+
+                for (uint32_t c = 0; c < 4; c++)
+                {
+                    uint32_t sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c] +
+                        src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+                    dst[(y * nextWidth + x) * 4 + c] = (byte)((sum + 2) / 4);
+                }
+            }
+        }
+
+        levelOffset = nextOffset;
+        width = nextWidth;
+        height = nextHeight;
+    }
+}
+
+// one persistently mapped host coherent buffer for data that changes every frame (uniforms etc.)
+// allocation is just moving head forward, bytes are given back in the same order
+// when fence of the frame that used them is signaled
+struct RingBuffer
+{
+    VkBuffer buffer;
+    MemoryAllocation memory;
+    byte* mapped;
+    VkDeviceSize size;
+    VkDeviceSize alignment;
+    // next free byte
+    VkDeviceSize head;
+    // bytes between tail (oldest byte still read by gpu) and head
+    VkDeviceSize used;
+    // bytes taken by each frame slot, freed after waiting for its fence
+    std::vector<VkDeviceSize> frameUsed;
+    uint32_t currentFrameSlot;
+};
+
+void createRingBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkDeviceSize alignment, uint32_t frameSlotCount,
+    DeviceAllocator* allocator, RingBuffer* ring)
+{
+    createBuffer(size, usage, allocator, &ring->buffer,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &ring->memory);
+
+    // host visible blocks are mapped by allocator for whole lifetime, coherent so no flush is needed
+    ring->mapped = ring->memory.mapped;
+    ring->size = size;
+    ring->alignment = alignment;
+    ring->head = 0;
+    ring->used = 0;
+    ring->frameUsed.assign(frameSlotCount, 0);
+    ring->currentFrameSlot = 0;
+}
+
+// call after waiting for frame slot fence, everything that slot allocated last time is free again
+void ringBufferBeginFrame(RingBuffer* ring, uint32_t frameSlot)
+{
+    ring->used -= ring->frameUsed[frameSlot];
+    ring->frameUsed[frameSlot] = 0;
+    ring->currentFrameSlot = frameSlot;
+}
+
+// returns pointer to write to and offset in ring->buffer, nullptr if ring is full
+void* ringBufferAlloc(RingBuffer* ring, VkDeviceSize size, VkDeviceSize* offset)
+{
+    VkDeviceSize start = alignUp(ring->head, ring->alignment);
+
+    // doesnt fit at the end, skip the rest and start from 0
+    if (start + size > ring->size)
+        start = ring->size;
+
+    // skipped bytes (alignment or end of buffer) count as used, they are freed together with this frame
+    VkDeviceSize taken = start - ring->head + size;
+
+    if (start == ring->size)
+        start = 0;
+
+    if (ring->used + taken > ring->size)
+        return nullptr;
+
+    ring->used += taken;
+    ring->frameUsed[ring->currentFrameSlot] += taken;
+    ring->head = start + size;
+    *offset = start;
+
+    return ring->mapped + start;
+}
+
+void destroyRingBuffer(DeviceAllocator* allocator, RingBuffer* ring)
+{
+    destroyBuffer(allocator, ring->buffer, &ring->memory);
+}
+
+/**************************************************************************
+CPU profiler
+Purpose: how long each part of the frame loop takes on cpu, as distribution not average
+every phase has a histogram (log-linear buckets, ~3% precision) from which percentiles are read
+counters are relaxed atomics so another thread can read them while main thread records, no locks
+frame to frame times also go through hitch detection (frame much slower than recent median)
+*/
+// values below 64us have their own bucket, above that every power of two is split into 32 buckets
+const uint32_t latencyHistogramBuckets = 64 + 32 * 27;
+
+struct LatencyHistogram
+{
+    std::atomic<uint64_t> buckets[latencyHistogramBuckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> totalUs;
+    std::atomic<uint64_t> maxUs;
+};
+
+void resetLatencyHistogram(LatencyHistogram* histogram)
+{
+    for (uint32_t i = 0; i < latencyHistogramBuckets; i++)
+        histogram->buckets[i].store(0, std::memory_order_relaxed);
+
+    histogram->count.store(0, std::memory_order_relaxed);
+    histogram->totalUs.store(0, std::memory_order_relaxed);
+    histogram->maxUs.store(0, std::memory_order_relaxed);
+}
+
+uint32_t latencyBucket(uint64_t us)
+{
+    if (us < 64)
+        return (uint32_t)us;
+
+    // position of highest bit, 6 for 64..127
+    uint32_t exponent = 6;
+    while ((us >> (exponent + 1)) != 0)
+        exponent++;
+
+    // top 6 bits of value, 32..63
+    uint32_t bucket = 64 + (exponent - 6) * 32 + (uint32_t)(us >> (exponent - 5)) - 32;
+    return bucket < latencyHistogramBuckets ? bucket : latencyHistogramBuckets - 1;
+}
+
+// smallest value that goes to bucket
+uint64_t latencyBucketValue(uint32_t bucket)
+{
+    if (bucket < 64)
+        return bucket;
+
+    uint32_t exponent = (bucket - 64) / 32 + 6;
+    return (uint64_t)(32 + (bucket - 64) % 32) << (exponent - 5);
+}
+
+// single writer
+void recordLatency(LatencyHistogram* histogram, uint64_t us)
+{
+    histogram->buckets[latencyBucket(us)].fetch_add(1, std::memory_order_relaxed);
+    histogram->count.fetch_add(1, std::memory_order_relaxed);
+    histogram->totalUs.fetch_add(us, std::memory_order_relaxed);
+
+    if (us > histogram->maxUs.load(std::memory_order_relaxed))
+        histogram->maxUs.store(us, std::memory_order_relaxed);
+}
+
+// value below which is fraction of samples (0.99 for p99), in microseconds
+uint64_t latencyPercentile(const LatencyHistogram* histogram, double fraction)
+{
+    uint64_t count = histogram->count.load(std::memory_order_relaxed);
+    if (count == 0)
+        return 0;
+
+    // nearest rank, epsilon so 0.99 * 100 is 99 and not 100
+    uint64_t target = (uint64_t)ceil(fraction * count - 1e-9);
+    if (target == 0)
+        target = 1;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < latencyHistogramBuckets; i++)
+    {
+        seen += histogram->buckets[i].load(std::memory_order_relaxed);
+
+        if (seen >= target)
+        {
+            // middle of bucket, but never above real max
+            uint64_t value = (latencyBucketValue(i) + (i + 1 < latencyHistogramBuckets ? latencyBucketValue(i + 1) : latencyBucketValue(i))) / 2;
+            uint64_t maxUs = histogram->maxUs.load(std::memory_order_relaxed);
+            return value < maxUs ? value : maxUs;
+        }
+    }
+
+    return histogram->maxUs.load(std::memory_order_relaxed);
+}
+
+enum CpuPhase
+{
+    CPU_PHASE_MESSAGES,
+    CPU_PHASE_FENCE_WAIT,
+    CPU_PHASE_ACQUIRE,
+    CPU_PHASE_UPDATE,
+    CPU_PHASE_RECORD,
+    CPU_PHASE_SUBMIT,
+    CPU_PHASE_PRESENT,
+    // whole frame, start of one to start of next
+    CPU_PHASE_FRAME,
+    CPU_PHASE_COUNT
+};
+
+const char* cpuPhaseNames[CPU_PHASE_COUNT] = { "messages", "fence wait", "acquire", "update", "record", "submit", "present", "frame" };
+
+struct CpuProfiler
+{
+    LatencyHistogram phases[CPU_PHASE_COUNT];
+    // from reading input (end of message pump) to present call returning, or submit in headless
+    LatencyHistogram inputToPresent;
+    std::chrono::steady_clock::time_point inputTime;
+    std::chrono::steady_clock::time_point phaseStart;
+    std::chrono::steady_clock::time_point frameStart;
+    // frame pacing, frame time is hitch if it's hitchFactor times recent median
+    std::vector<float> recentFrameMs;
+    uint32_t recentNext;
+    float hitchFactor;
+    std::atomic<uint32_t> hitchCount;
+    float worstHitchMs;
+    uint64_t worstHitchFrame;
+    // squared frame to frame differences, jitter even without big hitches
+    double frameDeltaSquaredSum;
+    float previousFrameMs;
+};
+
+void createCpuProfiler(float hitchFactor, CpuProfiler* profiler)
+{
+    for (uint32_t i = 0; i < CPU_PHASE_COUNT; i++)
+        resetLatencyHistogram(&profiler->phases[i]);
+    resetLatencyHistogram(&profiler->inputToPresent);
+
+    profiler->phaseStart = std::chrono::steady_clock::now();
+    profiler->inputTime = profiler->phaseStart;
+    profiler->frameStart = profiler->phaseStart;
+    profiler->recentFrameMs.clear();
+    profiler->recentFrameMs.reserve(64);
+    profiler->recentNext = 0;
+    profiler->hitchFactor = hitchFactor;
+    profiler->hitchCount.store(0, std::memory_order_relaxed);
+    profiler->worstHitchMs = 0;
+    profiler->worstHitchFrame = 0;
+    profiler->frameDeltaSquaredSum = 0;
+    profiler->previousFrameMs = 0;
+}
+
+// time since previous phase ended (or frame started) goes to phase
+void endCpuPhase(CpuProfiler* profiler, CpuPhase phase)
+{
+    auto now = std::chrono::steady_clock::now();
+    uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - profiler->phaseStart).count();
+    recordLatency(&profiler->phases[phase], us);
+    profiler->phaseStart = now;
+}
+
+// input that affects this frame was read now
+void markCpuInput(CpuProfiler* profiler)
+{
+    profiler->inputTime = std::chrono::steady_clock::now();
+}
+
+// frame was handed to presentation engine, display can still be a vsync or more later
+void markCpuPresent(CpuProfiler* profiler)
+{
+    auto now = std::chrono::steady_clock::now();
+    recordLatency(&profiler->inputToPresent, (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - profiler->inputTime).count());
+}
+
+// time since end of last frame is not recorded anywhere, only between frames
+void resumeCpuProfiler(CpuProfiler* profiler)
+{
+    profiler->phaseStart = std::chrono::steady_clock::now();
+    profiler->frameStart = profiler->phaseStart;
+}
+
+// call once at end of every presented/submitted frame
+void endCpuFrame(CpuProfiler* profiler, uint64_t frameIndex)
+{
+    auto now = std::chrono::steady_clock::now();
+    uint64_t us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(now - profiler->frameStart).count();
+    profiler->frameStart = now;
+    profiler->phaseStart = now;
+
+    recordLatency(&profiler->phases[CPU_PHASE_FRAME], us);
+    float ms = us / 1000.0f;
+
+    // median of last 64 frames, needs some history before it means anything
+    if (profiler->recentFrameMs.size() >= 16)
+    {
+        std::vector<float> sorted = profiler->recentFrameMs;
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        float median = sorted[sorted.size() / 2];
+
+        if (ms > median * profiler->hitchFactor)
+        {
+            profiler->hitchCount.fetch_add(1, std::memory_order_relaxed);
+
+            if (ms > profiler->worstHitchMs)
+            {
+                profiler->worstHitchMs = ms;
+                profiler->worstHitchFrame = frameIndex;
+            }
+        }
+    }
+
+    if (profiler->recentFrameMs.size() < 64)
+    {
+        profiler->recentFrameMs.push_back(ms);
+    }
+    else
+    {
+        profiler->recentFrameMs[profiler->recentNext] = ms;
+        profiler->recentNext = (profiler->recentNext + 1) % 64;
+    }
+
+    if (profiler->phases[CPU_PHASE_FRAME].count.load(std::memory_order_relaxed) > 1)
+        profiler->frameDeltaSquaredSum += (ms - profiler->previousFrameMs) * (ms - profiler->previousFrameMs);
+    profiler->previousFrameMs = ms;
+}
+
+void printLatencyRow(const char* name, const LatencyHistogram& histogram)
+{
+    uint64_t count = histogram.count.load(std::memory_order_relaxed);
+
+    if (count == 0)
+        return;
+
+    printf("cpu %-16s %8llu %8.3f %8.3f %8.3f %8.3f %8.3f\n", name, (unsigned long long)count,
+        histogram.totalUs.load(std::memory_order_relaxed) / 1000.0 / count,
+        latencyPercentile(&histogram, 0.50) / 1000.0, latencyPercentile(&histogram, 0.95) / 1000.0,
+        latencyPercentile(&histogram, 0.99) / 1000.0, histogram.maxUs.load(std::memory_order_relaxed) / 1000.0);
+}
+
+void printCpuProfilerReport(const CpuProfiler* profiler)
+{
+    printf("cpu %-16s %8s %8s %8s %8s %8s %8s\n", "phase", "samples", "avg ms", "p50 ms", "p95 ms", "p99 ms", "max ms");
+
+    for (uint32_t i = 0; i < CPU_PHASE_COUNT; i++)
+        printLatencyRow(cpuPhaseNames[i], profiler->phases[i]);
+
+    printLatencyRow("input to present", profiler->inputToPresent);
+
+    uint64_t frames = profiler->phases[CPU_PHASE_FRAME].count.load(std::memory_order_relaxed);
+    uint32_t hitches = profiler->hitchCount.load(std::memory_order_relaxed);
+
+    printf("frame pacing: %u hitch(es) over %.1fx recent median", hitches, profiler->hitchFactor);
+    if (hitches > 0)
+        printf(", worst %.3f ms at frame %llu", profiler->worstHitchMs, (unsigned long long)profiler->worstHitchFrame);
+    printf(", frame to frame jitter %.3f ms rms\n", frames > 1 ? sqrt(profiler->frameDeltaSquaredSum / (frames - 1)) : 0.0);
+}
+
+/**************************************************************************
+GPU profiler
+Purpose: how long gpu spends in parts of command buffer
+named scopes write timestamp queries at begin and end, results are read when frame slot fence is signaled
+(no waiting), converted to ms with timestampPeriod and added to rolling statistics and trace files
+every command stream (frames, upload batches) has its own profiler so query resets are always in order
+*/
+// chrome://tracing or ui.perfetto.dev json and/or csv, shared by all profilers so their events have one time base
+struct GpuTraceWriter
+{
+    FILE* json;
+    FILE* csv;
+    bool firstEvent;
+    bool hasBaseTick;
+    uint64_t baseTick;
+};
+
+struct GpuProfilerScope
+{
+    const char* name;
+    uint32_t depth;
+    // query index within frame, UINT32_MAX if frame ran out of queries
+    uint32_t beginQuery;
+};
+
+struct GpuProfilerFrame
+{
+    std::vector<GpuProfilerScope> scopes;
+    uint32_t queryCount;
+    uint64_t frameIndex;
+    bool recorded;
+};
+
+// last rollingWindow durations of one scope name
+struct GpuScopeStats
+{
+    const char* name;
+    uint64_t count;
+    double totalMs;
+    double minMs;
+    double maxMs;
+    std::vector<float> recentMs;
+    uint32_t recentNext;
+};
+
+struct GpuProfiler
+{
+    VkDevice device;
+    // false if queue family doesnt support timestamps, then all calls do nothing
+    bool enabled;
+    VkQueryPool queryPool;
+    uint32_t queriesPerFrame;
+    // nanoseconds per tick
+    double timestampPeriod;
+    uint64_t timestampMask;
+    std::vector<GpuProfilerFrame> frames;
+    uint32_t currentFrame;
+    // scopes that are begun but not ended, indices into current frame scopes
+    std::vector<uint32_t> openScopes;
+    std::vector<GpuScopeStats> stats;
+    uint32_t rollingWindow;
+    GpuTraceWriter* trace;
+    // thread id in trace, every profiler gets its own track
+    uint32_t traceTrack;
+    const char* traceTrackName;
+};
+
+void createGpuTraceWriter(const char* jsonFile, const char* csvFile, GpuTraceWriter* trace)
+{
+    trace->json = jsonFile ? fopen(jsonFile, "w") : nullptr;
+    trace->csv = csvFile ? fopen(csvFile, "w") : nullptr;
+    trace->firstEvent = true;
+    trace->hasBaseTick = false;
+    trace->baseTick = 0;
+
+    if (trace->json)
+        fprintf(trace->json, "{\"traceEvents\":[\n");
+    if (trace->csv)
+        fprintf(trace->csv, "track,frame,scope,depth,start_ms,duration_ms\n");
+}
+
+void closeGpuTraceWriter(GpuTraceWriter* trace)
+{
+    if (trace->json)
+    {
+        fprintf(trace->json, "\n],\"displayTimeUnit\":\"ms\"}\n");
+        fclose(trace->json);
+    }
+
+    if (trace->csv)
+        fclose(trace->csv);
+
+    trace->json = nullptr;
+    trace->csv = nullptr;
+}
+
+void createGpuProfiler(VkDevice device, const VkPhysicalDeviceProperties& properties, uint32_t timestampValidBits,
+    uint32_t frameSlotCount, uint32_t maxScopesPerFrame, GpuTraceWriter* trace, uint32_t traceTrack, const char* traceTrackName,
+    GpuProfiler* profiler)
+{
+    profiler->device = device;
+    profiler->enabled = timestampValidBits > 0 && properties.limits.timestampPeriod > 0;
+    profiler->queryPool = VK_NULL_HANDLE;
+    profiler->queriesPerFrame = maxScopesPerFrame * 2;
+    profiler->timestampPeriod = properties.limits.timestampPeriod;
+    profiler->timestampMask = timestampValidBits >= 64 ? ~0ull : (1ull << timestampValidBits) - 1;
+    profiler->frames.resize(frameSlotCount);
+    profiler->currentFrame = 0;
+    profiler->rollingWindow = 120;
+    profiler->trace = trace;
+    profiler->traceTrack = traceTrack;
+    profiler->traceTrackName = traceTrackName;
+
+    for (uint32_t i = 0; i < frameSlotCount; i++)
+    {
+        profiler->frames[i].queryCount = 0;
+        profiler->frames[i].frameIndex = 0;
+        profiler->frames[i].recorded = false;
+    }
+
+    if (!profiler->enabled)
+        return;
+
+    VkQueryPoolCreateInfo queryPoolCreateInfo = {};
+    queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolCreateInfo.queryCount = profiler->queriesPerFrame * frameSlotCount;
+
+    assert(vkCreateQueryPool(device, &queryPoolCreateInfo, nullptr, &profiler->queryPool) == VK_SUCCESS);
+
+    if (trace && trace->json)
+    {
+        // names the track in trace viewer
+        fprintf(trace->json, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            trace->firstEvent ? "" : ",\n", traceTrack, traceTrackName);
+        trace->firstEvent = false;
+    }
+}
+
+GpuScopeStats* findGpuScopeStats(GpuProfiler* profiler, const char* name)
+{
+    for (size_t i = 0; i < profiler->stats.size(); i++)
+    {
+        if (strcmp(profiler->stats[i].name, name) == 0)
+            return &profiler->stats[i];
+    }
+
+    GpuScopeStats stats = {};
+    stats.name = name;
+    stats.minMs = 1e30;
+    profiler->stats.push_back(stats);
+
+    return &profiler->stats.back();
+}
+
+// reads results of frame slot, gpu must be done with it (fence signaled)
+void collectGpuProfilerFrame(GpuProfiler* profiler, uint32_t frameSlot)
+{
+    GpuProfilerFrame& frame = profiler->frames[frameSlot];
+
+    if (!profiler->enabled || !frame.recorded || frame.queryCount == 0)
+    {
+        frame.recorded = false;
+        return;
+    }
+
+    frame.recorded = false;
+
+    std::vector<uint64_t> ticks(frame.queryCount);
+    VkResult result = vkGetQueryPoolResults(profiler->device, profiler->queryPool, frameSlot * profiler->queriesPerFrame,
+        frame.queryCount, ticks.size() * sizeof(uint64_t), ticks.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+    if (result != VK_SUCCESS)
+        return;
+
+    GpuTraceWriter* trace = profiler->trace;
+
+    for (size_t i = 0; i < frame.scopes.size(); i++)
+    {
+        const GpuProfilerScope& scope = frame.scopes[i];
+
+        if (scope.beginQuery == UINT32_MAX)
+            continue;
+
+        uint64_t begin = ticks[scope.beginQuery] & profiler->timestampMask;
+        uint64_t end = ticks[scope.beginQuery + 1] & profiler->timestampMask;
+        // counter can wrap around when it has less than 64 bits
+        double ms = ((end - begin) & profiler->timestampMask) * profiler->timestampPeriod / 1e6;
+
+        GpuScopeStats* stats = findGpuScopeStats(profiler, scope.name);
+        stats->count++;
+        stats->totalMs += ms;
+        if (ms < stats->minMs)
+            stats->minMs = ms;
+        if (ms > stats->maxMs)
+            stats->maxMs = ms;
+
+        if (stats->recentMs.size() < profiler->rollingWindow)
+        {
+            stats->recentMs.push_back((float)ms);
+        }
+        else
+        {
+            stats->recentMs[stats->recentNext] = (float)ms;
+            stats->recentNext = (stats->recentNext + 1) % profiler->rollingWindow;
+        }
+
+        if (!trace || (!trace->json && !trace->csv))
+            continue;
+
+        if (!trace->hasBaseTick)
+        {
+            trace->baseTick = begin;
+            trace->hasBaseTick = true;
+        }
+
+        double startMs = (double)(int64_t)(begin - trace->baseTick) * profiler->timestampPeriod / 1e6;
+
+        if (trace->json)
+        {
+            // complete event, times in microseconds
+            fprintf(trace->json, "%s{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu}}",
+                trace->firstEvent ? "" : ",\n", scope.name, profiler->traceTrack, startMs * 1000.0, ms * 1000.0,
+                (unsigned long long)frame.frameIndex);
+            trace->firstEvent = false;
+        }
+
+        if (trace->csv)
+        {
+            fprintf(trace->csv, "%s,%llu,%s,%u,%.6f,%.6f\n", profiler->traceTrackName, (unsigned long long)frame.frameIndex,
+                scope.name, scope.depth, startMs, ms);
+        }
+    }
+}
+
+// call when fence of frame slot is signaled, before anything else is recorded into command buffer
+// collects previous results of the slot and resets its queries (outside render pass)
+void beginGpuProfilerFrame(GpuProfiler* profiler, uint32_t frameSlot, VkCommandBuffer command, uint64_t frameIndex)
+{
+    collectGpuProfilerFrame(profiler, frameSlot);
+
+    GpuProfilerFrame& frame = profiler->frames[frameSlot];
+    frame.scopes.clear();
+    frame.queryCount = 0;
+    frame.frameIndex = frameIndex;
+    frame.recorded = profiler->enabled;
+
+    profiler->currentFrame = frameSlot;
+    profiler->openScopes.clear();
+
+    if (profiler->enabled)
+        vkCmdResetQueryPool(command, profiler->queryPool, frameSlot * profiler->queriesPerFrame, profiler->queriesPerFrame);
+}
+
+// name must stay valid until results are collected (string literal)
+void beginGpuScope(GpuProfiler* profiler, VkCommandBuffer command, const char* name)
+{
+    if (!profiler->enabled)
+        return;
+
+    GpuProfilerFrame& frame = profiler->frames[profiler->currentFrame];
+
+    GpuProfilerScope scope;
+    scope.name = name;
+    scope.depth = (uint32_t)profiler->openScopes.size();
+    scope.beginQuery = UINT32_MAX;
+
+    if (frame.queryCount + 2 <= profiler->queriesPerFrame)
+    {
+        scope.beginQuery = frame.queryCount;
+        frame.queryCount += 2;
+
+        // top of pipe, timestamp is written when previous commands started (not finished)
+        vkCmdWriteTimestamp(command, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->queryPool,
+            profiler->currentFrame * profiler->queriesPerFrame + scope.beginQuery);
+    }
+
+    profiler->openScopes.push_back((uint32_t)frame.scopes.size());
+    frame.scopes.push_back(scope);
+}
+
+void endGpuScope(GpuProfiler* profiler, VkCommandBuffer command)
+{
+    if (!profiler->enabled)
+        return;
+
+    assert(!profiler->openScopes.empty());
+
+    GpuProfilerFrame& frame = profiler->frames[profiler->currentFrame];
+    const GpuProfilerScope& scope = frame.scopes[profiler->openScopes.back()];
+    profiler->openScopes.pop_back();
+
+    // bottom of pipe, written when everything before it is finished
+    if (scope.beginQuery != UINT32_MAX)
+    {
+        vkCmdWriteTimestamp(command, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler->queryPool,
+            profiler->currentFrame * profiler->queriesPerFrame + scope.beginQuery + 1);
+    }
+}
+
+void printGpuProfilerStats(GpuProfiler* profiler)
+{
+    if (!profiler->enabled)
+    {
+        printf("gpu profiler (%s): timestamps not supported on this queue\n", profiler->traceTrackName);
+        return;
+    }
+
+    for (size_t i = 0; i < profiler->stats.size(); i++)
+    {
+        const GpuScopeStats& stats = profiler->stats[i];
+
+        double recentTotal = 0;
+        for (size_t k = 0; k < stats.recentMs.size(); k++)
+            recentTotal += stats.recentMs[k];
+
+        printf("gpu %-8s %-16s %6llu samples, avg %.3f ms, last %u avg %.3f ms, min %.3f ms, max %.3f ms\n",
+            profiler->traceTrackName, stats.name, (unsigned long long)stats.count, stats.totalMs / stats.count,
+            (uint32_t)stats.recentMs.size(), recentTotal / stats.recentMs.size(), stats.minMs, stats.maxMs);
+    }
+}
+
+// reads everything that is still not collected, gpu must be idle
+void flushGpuProfiler(GpuProfiler* profiler)
+{
+    for (uint32_t i = 0; i < profiler->frames.size(); i++)
+        collectGpuProfilerFrame(profiler, i);
+}
+
+void destroyGpuProfiler(GpuProfiler* profiler)
+{
+    if (profiler->queryPool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(profiler->device, profiler->queryPool, nullptr);
+}
+
+/**************************************************************************
+Upload manager
+Purpose: copies data to device local buffers and images without stalling the queue
+data goes to staging ring, copies are collected into a batch and recorded into one command buffer
+with all barriers merged, batch is submitted with a fence and caller gets a token to poll or wait for
+with dedicated transfer queue copies run next to rendering, resources go between queue families with
+release/acquire barriers: owner (graphics) releases images with content before the copy, transfer queue
+releases everything after it and owner acquires it in a small submit that waits for the copy semaphore,
+submitted with the copy if owner released anything (frames must not see released images), otherwise once the copy is done
+*/
+struct StagingBuffer
+{
+    VkBuffer buffer;
+    MemoryAllocation memory;
+};
+
+struct PendingBufferUpload
+{
+    VkBuffer src;
+    VkBuffer dst;
+    VkBufferCopy region;
+};
+
+struct PendingImageUpload
+{
+    VkBuffer src;
+    VkImage dst;
+    VkImageSubresourceRange range;
+    // undefined discards old content, anything else keeps it (partial updates)
+    VkImageLayout oldLayout;
+    VkImageLayout finalLayout;
+    // range in UploadManager::pendingImageRegions
+    uint32_t firstRegion;
+    uint32_t regionCount;
+    // if not 0, only base level is copied and the rest of range levels are blitted from it
+    uint32_t generateMipLevels;
+    VkExtent2D baseExtent;
+};
+
+struct UploadManager
+{
+    DeviceAllocator* allocator;
+    VkQueue queue;
+    uint32_t queueFamilyIndex;
+    VkCommandPool commandPool;
+    // queue that uses uploaded resources, ownership goes to it after the copy if it's different family
+    bool ownershipTransfer;
+    VkQueue ownerQueue;
+    uint32_t ownerQueueFamilyIndex;
+    VkCommandPool ownerCommandPool;
+    // per batch slot, only with ownershipTransfer
+    std::vector<VkCommandBuffer> releaseCommandBuffers;
+    std::vector<VkCommandBuffer> acquireCommandBuffers;
+    std::vector<VkSemaphore> releaseSemaphores;
+    std::vector<VkSemaphore> copySemaphores;
+    std::vector<VkFence> acquireFences;
+    // acquire of slot is recorded but not submitted yet
+    std::vector<bool> acquirePending;
+    RingBuffer staging;
+    // batches in flight, every slot has command buffer, fence and part of staging ring
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<VkFence> fences;
+    std::vector<uint64_t> slotTokens;
+    // uploads too big for staging ring get their own buffer, freed when batch is done
+    std::vector<std::vector<StagingBuffer>> slotTempBuffers;
+    uint32_t currentSlot;
+    bool batchOpen;
+    // token of the batch being collected, every submit increments it
+    uint64_t currentToken;
+    // all batches with token <= completedToken are finished
+    uint64_t completedToken;
+    std::vector<PendingBufferUpload> pendingBuffers;
+    std::vector<PendingImageUpload> pendingImages;
+    std::vector<VkBufferImageCopy> pendingImageRegions;
+    // statistics
+    uint64_t bytesUploaded;
+    uint32_t batchesSubmitted;
+    // can be nullptr, has one frame per batch slot
+    GpuProfiler* profiler;
+};
+
+// queue can be dedicated transfer queue, then resources are handed over to ownerQueue after every batch
+// with the same family there is no ownership transfer and ownerQueue isnt used
+// profiler must be nullptr or disabled for transfer only queue, vkCmdResetQueryPool needs graphics or compute
+void createUploadManager(VkQueue queue, uint32_t queueFamilyIndex, VkQueue ownerQueue, uint32_t ownerQueueFamilyIndex,
+    VkDeviceSize stagingSize, uint32_t batchSlotCount, VkDeviceSize copyAlignment, DeviceAllocator* allocator, GpuProfiler* profiler,
+    UploadManager* uploads)
+{
+    uploads->allocator = allocator;
+    uploads->queue = queue;
+    uploads->queueFamilyIndex = queueFamilyIndex;
+    uploads->ownershipTransfer = queueFamilyIndex != ownerQueueFamilyIndex;
+    uploads->ownerQueue = ownerQueue;
+    uploads->ownerQueueFamilyIndex = ownerQueueFamilyIndex;
+    uploads->ownerCommandPool = VK_NULL_HANDLE;
+    uploads->profiler = profiler;
+
+    VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    assert(vkCreateCommandPool(allocator->device, &commandPoolCreateInfo, nullptr, &uploads->commandPool) == VK_SUCCESS);
+
+    uploads->commandBuffers.resize(batchSlotCount);
+
+    VkCommandBufferAllocateInfo commandBufferAllocInfo = {};
+    commandBufferAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocInfo.commandPool = uploads->commandPool;
+    commandBufferAllocInfo.commandBufferCount = batchSlotCount;
+
+    assert(vkAllocateCommandBuffers(allocator->device, &commandBufferAllocInfo, uploads->commandBuffers.data()) == VK_SUCCESS);
+
+    VkFenceCreateInfo fenceCreateInfo = {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    uploads->fences.resize(batchSlotCount);
+    for (uint32_t i = 0; i < batchSlotCount; i++)
+        assert(vkCreateFence(allocator->device, &fenceCreateInfo, nullptr, &uploads->fences[i]) == VK_SUCCESS);
+
+    uploads->acquirePending.assign(batchSlotCount, false);
+
+    if (uploads->ownershipTransfer)
+    {
+        commandPoolCreateInfo.queueFamilyIndex = ownerQueueFamilyIndex;
+        assert(vkCreateCommandPool(allocator->device, &commandPoolCreateInfo, nullptr, &uploads->ownerCommandPool) == VK_SUCCESS);
+
+        uploads->releaseCommandBuffers.resize(batchSlotCount);
+        uploads->acquireCommandBuffers.resize(batchSlotCount);
+        commandBufferAllocInfo.commandPool = uploads->ownerCommandPool;
+        assert(vkAllocateCommandBuffers(allocator->device, &commandBufferAllocInfo, uploads->releaseCommandBuffers.data()) == VK_SUCCESS);
+        assert(vkAllocateCommandBuffers(allocator->device, &commandBufferAllocInfo, uploads->acquireCommandBuffers.data()) == VK_SUCCESS);
+
+        VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        uploads->releaseSemaphores.resize(batchSlotCount);
+        uploads->copySemaphores.resize(batchSlotCount);
+        uploads->acquireFences.resize(batchSlotCount);
+
+        for (uint32_t i = 0; i < batchSlotCount; i++)
+        {
+            assert(vkCreateSemaphore(allocator->device, &semaphoreCreateInfo, nullptr, &uploads->releaseSemaphores[i]) == VK_SUCCESS);
+            assert(vkCreateSemaphore(allocator->device, &semaphoreCreateInfo, nullptr, &uploads->copySemaphores[i]) == VK_SUCCESS);
+            assert(vkCreateFence(allocator->device, &fenceCreateInfo, nullptr, &uploads->acquireFences[i]) == VK_SUCCESS);
+        }
+    }
+
+    // every batch slot is a "frame" of the ring
+    createRingBuffer(stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, copyAlignment, batchSlotCount, allocator, &uploads->staging);
+
+    uploads->slotTokens.assign(batchSlotCount, 0);
+    uploads->slotTempBuffers.resize(batchSlotCount);
+    uploads->currentSlot = 0;
+    uploads->batchOpen = false;
+    uploads->currentToken = 1;
+    uploads->completedToken = 0;
+    uploads->bytesUploaded = 0;
+    uploads->batchesSubmitted = 0;
+}
+
+// slot fence is signaled, its staging memory and temp buffers can be reused
+void retireUploadSlot(UploadManager* uploads, uint32_t slot)
+{
+    if (uploads->slotTokens[slot] > uploads->completedToken)
+        uploads->completedToken = uploads->slotTokens[slot];
+
+    for (size_t i = 0; i < uploads->slotTempBuffers[slot].size(); i++)
+        destroyBuffer(uploads->allocator, uploads->slotTempBuffers[slot][i].buffer, &uploads->slotTempBuffers[slot][i].memory);
+
+    uploads->slotTempBuffers[slot].clear();
+}
+
+// submits recorded acquires of all batches up to token to owner queue, oldest first
+// owner queue waits on gpu for copies that are not finished yet, cpu never waits here
+void acquireUploads(UploadManager* uploads, uint64_t token)
+{
+    while (true)
+    {
+        // oldest pending batch
+        uint32_t slot = UINT32_MAX;
+        for (uint32_t i = 0; i < uploads->fences.size(); i++)
+        {
+            if (uploads->acquirePending[i] && uploads->slotTokens[i] <= token &&
+                (slot == UINT32_MAX || uploads->slotTokens[i] < uploads->slotTokens[slot]))
+                slot = i;
+        }
+
+        if (slot == UINT32_MAX)
+            return;
+
+        // ownership transfer barriers are transfer stage on both sides, that is where the wait is
+        VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &uploads->copySemaphores[slot];
+        submitInfo.pWaitDstStageMask = &waitStage;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &uploads->acquireCommandBuffers[slot];
+
+        vkResetFences(uploads->allocator->device, 1, &uploads->acquireFences[slot]);
+        assert(vkQueueSubmit(uploads->ownerQueue, 1, &submitInfo, uploads->acquireFences[slot]) == VK_SUCCESS);
+        uploads->acquirePending[slot] = false;
+    }
+}
+
+// acquires every batch whose copy is done, call once per frame before submitting work that could use them
+// with one queue there is nothing to do
+void updateUploads(UploadManager* uploads)
+{
+    if (!uploads->ownershipTransfer)
+        return;
+
+    // newest finished batch, fence of later batch means all earlier ones are done too
+    uint64_t finished = 0;
+    for (uint32_t i = 0; i < uploads->fences.size(); i++)
+    {
+        if (uploads->acquirePending[i] && uploads->slotTokens[i] > finished &&
+            vkGetFenceStatus(uploads->allocator->device, uploads->fences[i]) == VK_SUCCESS)
+            finished = uploads->slotTokens[i];
+    }
+
+    if (finished > 0)
+        acquireUploads(uploads, finished);
+}
+
+void beginUploadBatch(UploadManager* uploads)
+{
+    if (uploads->batchOpen)
+        return;
+
+    // blocks only if all slots are still in flight
+    uint32_t slot = uploads->currentSlot;
+    vkWaitForFences(uploads->allocator->device, 1, &uploads->fences[slot], VK_TRUE, UINT64_MAX);
+
+    if (uploads->ownershipTransfer)
+    {
+        // copy is done so acquire doesnt wait, its command buffer and semaphores are reused after it finishes
+        acquireUploads(uploads, uploads->slotTokens[slot]);
+        vkWaitForFences(uploads->allocator->device, 1, &uploads->acquireFences[slot], VK_TRUE, UINT64_MAX);
+    }
+
+    retireUploadSlot(uploads, slot);
+    ringBufferBeginFrame(&uploads->staging, slot);
+
+    uploads->batchOpen = true;
+}
+
+// every level is blitted from the previous one, needs graphics queue
+// level has to be transfer src while it is read and next one transfer dst while it is written
+// all levels start in transfer dst, all but the last one end in transfer src
+void recordMipChain(VkCommandBuffer command, const PendingImageUpload& upload)
+{
+    int32_t w = (int32_t)upload.baseExtent.width;
+    int32_t h = (int32_t)upload.baseExtent.height;
+
+    for (uint32_t level = 1; level < upload.generateMipLevels; level++)
+    {
+        uint32_t srcLevel = upload.range.baseMipLevel + level - 1;
+
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = upload.dst;
+        barrier.subresourceRange = upload.range;
+        barrier.subresourceRange.baseMipLevel = srcLevel;
+        barrier.subresourceRange.levelCount = 1;
+
+        vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        int32_t nextW = w > 1 ? w / 2 : 1;
+        int32_t nextH = h > 1 ? h / 2 : 1;
+
+        VkImageBlit blit = {};
+        blit.srcSubresource.aspectMask = upload.range.aspectMask;
+        blit.srcSubresource.mipLevel = srcLevel;
+        blit.srcSubresource.baseArrayLayer = upload.range.baseArrayLayer;
+        blit.srcSubresource.layerCount = upload.range.layerCount;
+        blit.srcOffsets[1] = { w, h, 1 };
+        blit.dstSubresource = blit.srcSubresource;
+        blit.dstSubresource.mipLevel = srcLevel + 1;
+        blit.dstOffsets[1] = { nextW, nextH, 1 };
+
+        // linear filter on exact half size is 2x2 box filter
+        vkCmdBlitImage(command, upload.dst, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, upload.dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit, VK_FILTER_LINEAR);
+
+        w = nextW;
+        h = nextH;
+    }
+}
+
+// barrier from transfer dst to final layout for the whole range of upload
+// generated mips have all levels but last one in transfer src, they need two barriers
+void addUploadPostBarriers(const PendingImageUpload& upload, std::vector<VkImageMemoryBarrier>& postBarriers)
+{
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = upload.finalLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = upload.dst;
+    barrier.subresourceRange = upload.range;
+
+    if (upload.generateMipLevels > 1)
+    {
+        VkImageMemoryBarrier srcLevels = barrier;
+        srcLevels.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        srcLevels.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        srcLevels.subresourceRange.levelCount = upload.generateMipLevels - 1;
+        postBarriers.push_back(srcLevels);
+
+        barrier.subresourceRange.baseMipLevel += upload.generateMipLevels - 1;
+        barrier.subresourceRange.levelCount = 1;
+    }
+
+    postBarriers.push_back(barrier);
+}
+
+// everything that can read uploaded data
+const VkAccessFlags uploadReadAccess = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT |
+    VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+const VkPipelineStageFlags uploadReadStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+    VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+// records release barriers at the end of copy command buffer and matching acquire (+ mip generation)
+// into acquire command buffer of the slot, acquire is submitted later by acquireUploads
+void recordUploadOwnershipTransfer(UploadManager* uploads, VkCommandBuffer command, uint32_t slot)
+{
+    std::vector<VkImageMemoryBarrier> imageBarriers;
+    std::vector<VkBufferMemoryBarrier> bufferBarriers;
+
+    for (size_t i = 0; i < uploads->pendingImages.size(); i++)
+    {
+        const PendingImageUpload& upload = uploads->pendingImages[i];
+
+        // layout transition is part of the transfer, both sides have to specify the same layouts
+        // images with mips stay transfer dst, blits run on owner queue
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = upload.generateMipLevels > 1 ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : upload.finalLayout;
+        barrier.srcQueueFamilyIndex = uploads->queueFamilyIndex;
+        barrier.dstQueueFamilyIndex = uploads->ownerQueueFamilyIndex;
+        barrier.image = upload.dst;
+        barrier.subresourceRange = upload.range;
+        imageBarriers.push_back(barrier);
+    }
+
+    // one barrier per destination buffer over everything written to it
+    for (size_t i = 0; i < uploads->pendingBuffers.size(); i++)
+    {
+        const PendingBufferUpload& upload = uploads->pendingBuffers[i];
+        VkDeviceSize end = upload.region.dstOffset + upload.region.size;
+        size_t k = 0;
+
+        while (k < bufferBarriers.size() && bufferBarriers[k].buffer != upload.dst)
+            k++;
+
+        if (k == bufferBarriers.size())
+        {
+            VkBufferMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcQueueFamilyIndex = uploads->queueFamilyIndex;
+            barrier.dstQueueFamilyIndex = uploads->ownerQueueFamilyIndex;
+            barrier.buffer = upload.dst;
+            barrier.offset = upload.region.dstOffset;
+            barrier.size = upload.region.size;
+            bufferBarriers.push_back(barrier);
+            continue;
+        }
+
+        VkDeviceSize barrierEnd = bufferBarriers[k].offset + bufferBarriers[k].size;
+        bufferBarriers[k].offset = std::min(bufferBarriers[k].offset, upload.region.dstOffset);
+        bufferBarriers[k].size = std::max(barrierEnd, end) - bufferBarriers[k].offset;
+    }
+
+    // release, dst access is ignored and acquire does the visibility
+    for (size_t i = 0; i < imageBarriers.size(); i++)
+        imageBarriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    for (size_t i = 0; i < bufferBarriers.size(); i++)
+        bufferBarriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+        (uint32_t)bufferBarriers.size(), bufferBarriers.data(), (uint32_t)imageBarriers.size(), imageBarriers.data());
+
+    // acquire, src access is ignored
+    VkCommandBuffer acquire = uploads->acquireCommandBuffers[slot];
+    vkResetCommandBuffer(acquire, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    assert(vkBeginCommandBuffer(acquire, &beginInfo) == VK_SUCCESS);
+
+    for (size_t i = 0; i < imageBarriers.size(); i++)
+    {
+        imageBarriers[i].srcAccessMask = 0;
+        imageBarriers[i].dstAccessMask = uploads->pendingImages[i].generateMipLevels > 1 ?
+            VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+    }
+
+    for (size_t i = 0; i < bufferBarriers.size(); i++)
+    {
+        bufferBarriers[i].srcAccessMask = 0;
+        bufferBarriers[i].dstAccessMask = uploadReadAccess;
+    }
+
+    vkCmdPipelineBarrier(acquire, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | uploadReadStages, 0, 0, nullptr,
+        (uint32_t)bufferBarriers.size(), bufferBarriers.data(), (uint32_t)imageBarriers.size(), imageBarriers.data());
+
+    std::vector<VkImageMemoryBarrier> postBarriers;
+
+    for (size_t i = 0; i < uploads->pendingImages.size(); i++)
+    {
+        if (uploads->pendingImages[i].generateMipLevels > 1)
+        {
+            recordMipChain(acquire, uploads->pendingImages[i]);
+            addUploadPostBarriers(uploads->pendingImages[i], postBarriers);
+        }
+    }
+
+    if (!postBarriers.empty())
+    {
+        vkCmdPipelineBarrier(acquire, VK_PIPELINE_STAGE_TRANSFER_BIT, uploadReadStages, 0, 0, nullptr, 0, nullptr,
+            (uint32_t)postBarriers.size(), postBarriers.data());
+    }
+
+    assert(vkEndCommandBuffer(acquire) == VK_SUCCESS);
+    uploads->acquirePending[slot] = true;
+}
+
+// images with content are owned by owner queue, it releases them to transfer queue before the copy
+// returns false if there is nothing to release
+bool submitUploadRelease(UploadManager* uploads, uint32_t slot)
+{
+    std::vector<VkImageMemoryBarrier> barriers;
+
+    for (size_t i = 0; i < uploads->pendingImages.size(); i++)
+    {
+        const PendingImageUpload& upload = uploads->pendingImages[i];
+        if (upload.oldLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+            continue;
+
+        // same as acquire at the start of copy command buffer
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = upload.oldLayout;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = uploads->ownerQueueFamilyIndex;
+        barrier.dstQueueFamilyIndex = uploads->queueFamilyIndex;
+        barrier.image = upload.dst;
+        barrier.subresourceRange = upload.range;
+        barriers.push_back(barrier);
+    }
+
+    if (barriers.empty())
+        return false;
+
+    VkCommandBuffer release = uploads->releaseCommandBuffers[slot];
+    vkResetCommandBuffer(release, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    assert(vkBeginCommandBuffer(release, &beginInfo) == VK_SUCCESS);
+
+    // earlier frames may still read them, nothing was written so no access to make available
+    vkCmdPipelineBarrier(release, uploadReadStages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+        0, nullptr, (uint32_t)barriers.size(), barriers.data());
+
+    assert(vkEndCommandBuffer(release) == VK_SUCCESS);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &release;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &uploads->releaseSemaphores[slot];
+
+    // copy fence of this slot covers it, copy cant finish before release
+    assert(vkQueueSubmit(uploads->ownerQueue, 1, &submitInfo, VK_NULL_HANDLE) == VK_SUCCESS);
+    return true;
+}
+
+// records everything collected so far into one command buffer and submits it, returns its token
+// does nothing if there is nothing to upload
+uint64_t submitUploads(UploadManager* uploads)
+{
+    if (!uploads->batchOpen)
+        return uploads->currentToken - 1;
+
+    VkDevice device = uploads->allocator->device;
+    uint32_t slot = uploads->currentSlot;
+    VkCommandBuffer command = uploads->commandBuffers[slot];
+    bool transfer = uploads->ownershipTransfer;
+
+    // before copy command buffer is submitted, so owner queue cant be waiting on copy at the same time
+    bool released = transfer && submitUploadRelease(uploads, slot);
+
+    vkResetCommandBuffer(command, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    assert(vkBeginCommandBuffer(command, &beginInfo) == VK_SUCCESS);
+
+    // slot fence was waited for in beginUploadBatch
+    if (uploads->profiler)
+    {
+        beginGpuProfilerFrame(uploads->profiler, slot, command, uploads->currentToken);
+        beginGpuScope(uploads->profiler, command, "upload batch");
+    }
+
+    // image layout transition to transfer target for all images in one call
+    // staging buffer contains image in linear format (first row, then second row etc.)
+    // image has VK_IMAGE_TILING_OPTIMAL which is implementation specific, copy command does the conversion
+    std::vector<VkImageMemoryBarrier> imageBarriers(uploads->pendingImages.size());
+    // images that already have content may still be read by frames submitted earlier
+    // on transfer queue they were released by owner queue and the wait for it is in transfer stage
+    VkPipelineStageFlags preBarrierSrcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+    for (size_t i = 0; i < uploads->pendingImages.size(); i++)
+    {
+        VkImageMemoryBarrier& barrier = imageBarriers[i];
+        barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = uploads->pendingImages[i].oldLayout;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = uploads->pendingImages[i].dst;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.subresourceRange = uploads->pendingImages[i].range;
+
+        if (barrier.oldLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+        {
+            if (transfer)
+            {
+                barrier.srcQueueFamilyIndex = uploads->ownerQueueFamilyIndex;
+                barrier.dstQueueFamilyIndex = uploads->queueFamilyIndex;
+                preBarrierSrcStage |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+            }
+            else
+            {
+                preBarrierSrcStage = uploadReadStages;
+            }
+        }
+    }
+
+    if (!imageBarriers.empty())
+    {
+        // host writes to staging are visible to the device after vkQueueSubmit, no need to wait for anything here
+        vkCmdPipelineBarrier(command, preBarrierSrcStage, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, (uint32_t)imageBarriers.size(), imageBarriers.data());
+    }
+
+    // buffer copies, consecutive copies with the same source and destination become one command
+    std::vector<VkBufferCopy> regions;
+
+    for (size_t i = 0; i < uploads->pendingBuffers.size(); i++)
+    {
+        const PendingBufferUpload& upload = uploads->pendingBuffers[i];
+        regions.push_back(upload.region);
+
+        bool last = i + 1 == uploads->pendingBuffers.size() ||
+            uploads->pendingBuffers[i + 1].src != upload.src || uploads->pendingBuffers[i + 1].dst != upload.dst;
+
+        if (last)
+        {
+            vkCmdCopyBuffer(command, upload.src, upload.dst, (uint32_t)regions.size(), regions.data());
+            regions.clear();
+        }
+    }
+
+    for (size_t i = 0; i < uploads->pendingImages.size(); i++)
+    {
+        const PendingImageUpload& upload = uploads->pendingImages[i];
+        vkCmdCopyBufferToImage(command, upload.src, upload.dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            upload.regionCount, uploads->pendingImageRegions.data() + upload.firstRegion);
+    }
+
+    if (transfer)
+    {
+        // mips and final layouts are done by owner queue when it takes the resources
+        recordUploadOwnershipTransfer(uploads, command, slot);
+    }
+    else
+    {
+        bool generatesMips = false;
+        for (size_t i = 0; i < uploads->pendingImages.size(); i++)
+            generatesMips = generatesMips || uploads->pendingImages[i].generateMipLevels > 1;
+
+        if (uploads->profiler && generatesMips)
+            beginGpuScope(uploads->profiler, command, "mip generation");
+
+        for (size_t i = 0; i < uploads->pendingImages.size(); i++)
+            recordMipChain(command, uploads->pendingImages[i]);
+
+        if (uploads->profiler && generatesMips)
+            endGpuScope(uploads->profiler, command);
+
+        // once the data has been uploaded images go to the layout they will be used in (usually shader read)
+        // and buffer writes are made visible to everything that can read them, all in one barrier
+        std::vector<VkImageMemoryBarrier> postBarriers;
+        for (size_t i = 0; i < uploads->pendingImages.size(); i++)
+            addUploadPostBarriers(uploads->pendingImages[i], postBarriers);
+
+        VkMemoryBarrier bufferBarrier = {};
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = uploadReadAccess;
+
+        // barrier also orders later submissions on this queue, draws dont have to wait for the fence
+        vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TRANSFER_BIT, uploadReadStages,
+            0, uploads->pendingBuffers.empty() ? 0 : 1, &bufferBarrier, 0, nullptr, (uint32_t)postBarriers.size(), postBarriers.data());
+    }
+
+    if (uploads->profiler)
+        endGpuScope(uploads->profiler, command);
+
+    assert(vkEndCommandBuffer(command) == VK_SUCCESS);
+
+    vkResetFences(device, 1, &uploads->fences[slot]);
+
+    VkPipelineStageFlags releaseWaitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = released ? 1 : 0;
+    submitInfo.pWaitSemaphores = released ? &uploads->releaseSemaphores[slot] : nullptr;
+    submitInfo.pWaitDstStageMask = &releaseWaitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &command;
+    submitInfo.signalSemaphoreCount = transfer ? 1 : 0;
+    submitInfo.pSignalSemaphores = transfer ? &uploads->copySemaphores[slot] : nullptr;
+
+    assert(vkQueueSubmit(uploads->queue, 1, &submitInfo, uploads->fences[slot]) == VK_SUCCESS);
+
+    uint64_t token = uploads->currentToken;
+    uploads->slotTokens[slot] = token;
+    uploads->currentToken++;
+    uploads->currentSlot = (slot + 1) % (uint32_t)uploads->fences.size();
+    uploads->batchOpen = false;
+    uploads->batchesSubmitted++;
+    uploads->pendingBuffers.clear();
+    uploads->pendingImages.clear();
+    uploads->pendingImageRegions.clear();
+
+    // owner queue gave away images that frames still use, it must get them back before the next frame is submitted
+    // acquire waits for the copy on gpu, later owner queue work is ordered after it by the acquire barrier
+    // batches that released nothing are acquired later by updateUploads so rendering doesnt wait for them
+    if (released)
+        acquireUploads(uploads, token);
+
+    return token;
+}
+
+// space in staging memory for upload, if ring is full current batch is submitted and next slot is used
+void* allocateStaging(UploadManager* uploads, VkDeviceSize size, VkBuffer* src, VkDeviceSize* srcOffset)
+{
+    beginUploadBatch(uploads);
+
+    // big uploads would take most of the ring, they get their own buffer
+    if (size > uploads->staging.size / 2)
+    {
+        StagingBuffer temp;
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, uploads->allocator, &temp.buffer,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &temp.memory);
+        uploads->slotTempBuffers[uploads->currentSlot].push_back(temp);
+
+        *src = temp.buffer;
+        *srcOffset = 0;
+        return temp.memory.mapped;
+    }
+
+    void* memory = ringBufferAlloc(&uploads->staging, size, srcOffset);
+
+    while (memory == nullptr)
+    {
+        submitUploads(uploads);
+        beginUploadBatch(uploads);
+        memory = ringBufferAlloc(&uploads->staging, size, srcOffset);
+    }
+
+    *src = uploads->staging.buffer;
+    return memory;
+}
+
+// copies data to dst buffer at dstOffset, returns token of the batch that does the copy
+// dst must not be used by owner queue yet (nothing reads it, nothing in it is needed), like undefined layout for images
+// with transfer queue anything outside of written range is undefined after the copy
+uint64_t uploadBuffer(UploadManager* uploads, VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+    PendingBufferUpload upload = {};
+    void* staging = allocateStaging(uploads, size, &upload.src, &upload.region.srcOffset);
+    memcpy(staging, data, (size_t)size);
+
+    upload.dst = dst;
+    upload.region.dstOffset = dstOffset;
+    upload.region.size = size;
+
+    uploads->pendingBuffers.push_back(upload);
+    uploads->bytesUploaded += size;
+
+    return uploads->currentToken;
+}
+
+// copies data to dst image, regions[i].bufferOffset is relative to data
+// image is transitioned from oldLayout to finalLayout for the whole range, every image at most once per batch
+uint64_t uploadImage(UploadManager* uploads, VkImage dst, VkImageSubresourceRange range, VkImageLayout oldLayout, VkImageLayout finalLayout,
+    const void* data, VkDeviceSize size, const VkBufferImageCopy* regions, uint32_t regionCount)
+{
+    PendingImageUpload upload = {};
+    VkDeviceSize srcOffset = 0;
+    void* staging = allocateStaging(uploads, size, &upload.src, &srcOffset);
+    memcpy(staging, data, (size_t)size);
+
+    upload.dst = dst;
+    upload.range = range;
+    upload.oldLayout = oldLayout;
+    upload.finalLayout = finalLayout;
+    upload.firstRegion = (uint32_t)uploads->pendingImageRegions.size();
+    upload.regionCount = regionCount;
+    upload.generateMipLevels = 0;
+
+    for (uint32_t i = 0; i < regionCount; i++)
+    {
+        VkBufferImageCopy region = regions[i];
+        region.bufferOffset += srcOffset;
+        uploads->pendingImageRegions.push_back(region);
+    }
+
+    uploads->pendingImages.push_back(upload);
+    uploads->bytesUploaded += size;
+
+    return uploads->currentToken;
+}
+
+// like uploadImage but regions fill only range.baseMipLevel (extent is its size),
+// other range levels are generated on gpu with linear blits
+// format has to support VK_FORMAT_FEATURE_BLIT_SRC/DST and SAMPLED_IMAGE_FILTER_LINEAR, see formatSupportsLinearBlit
+uint64_t uploadImageGenerateMips(UploadManager* uploads, VkImage dst, VkImageSubresourceRange range, VkExtent2D extent,
+    VkImageLayout oldLayout, VkImageLayout finalLayout, const void* data, VkDeviceSize size, const VkBufferImageCopy* regions, uint32_t regionCount)
+{
+    uint64_t token = uploadImage(uploads, dst, range, oldLayout, finalLayout, data, size, regions, regionCount);
+
+    uploads->pendingImages.back().generateMipLevels = range.levelCount;
+    uploads->pendingImages.back().baseExtent = extent;
+
+    return token;
+}
+
+// non blocking check, with ownership transfer a finished batch is also acquired by owner queue here
+// so work submitted to owner queue after this returned true can use the data
+bool isUploadComplete(UploadManager* uploads, uint64_t token)
+{
+    if (token <= uploads->completedToken)
+        return true;
+
+    // batch is not even submitted yet
+    if (token >= uploads->currentToken)
+        return false;
+
+    // fence of later batch on the same queue also means all earlier batches are done
+    for (uint32_t i = 0; i < uploads->fences.size(); i++)
+    {
+        if (uploads->slotTokens[i] >= token && vkGetFenceStatus(uploads->allocator->device, uploads->fences[i]) == VK_SUCCESS)
+        {
+            if (uploads->ownershipTransfer)
+                acquireUploads(uploads, uploads->slotTokens[i]);
+
+            uploads->completedToken = uploads->slotTokens[i] > uploads->completedToken ? uploads->slotTokens[i] : uploads->completedToken;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void waitForUpload(UploadManager* uploads, uint64_t token)
+{
+    if (token >= uploads->currentToken)
+        submitUploads(uploads);
+
+    for (uint32_t i = 0; i < uploads->fences.size(); i++)
+    {
+        if (uploads->slotTokens[i] == token)
+        {
+            vkWaitForFences(uploads->allocator->device, 1, &uploads->fences[i], VK_TRUE, UINT64_MAX);
+
+            // layout transitions and mips happen in acquire, batch isnt done before it is
+            if (uploads->ownershipTransfer)
+            {
+                acquireUploads(uploads, token);
+                vkWaitForFences(uploads->allocator->device, 1, &uploads->acquireFences[i], VK_TRUE, UINT64_MAX);
+            }
+
+            break;
+        }
+    }
+
+    if (token > uploads->completedToken)
+        uploads->completedToken = token;
+}
+
+void destroyUploadManager(UploadManager* uploads)
+{
+    VkDevice device = uploads->allocator->device;
+
+    vkWaitForFences(device, (uint32_t)uploads->fences.size(), uploads->fences.data(), VK_TRUE, UINT64_MAX);
+
+    if (uploads->ownershipTransfer)
+    {
+        // copy semaphores that were signaled must be waited for before they are destroyed
+        acquireUploads(uploads, UINT64_MAX);
+        vkWaitForFences(device, (uint32_t)uploads->acquireFences.size(), uploads->acquireFences.data(), VK_TRUE, UINT64_MAX);
+
+        for (uint32_t i = 0; i < uploads->acquireFences.size(); i++)
+        {
+            vkDestroySemaphore(device, uploads->releaseSemaphores[i], nullptr);
+            vkDestroySemaphore(device, uploads->copySemaphores[i], nullptr);
+            vkDestroyFence(device, uploads->acquireFences[i], nullptr);
+        }
+
+        vkDestroyCommandPool(device, uploads->ownerCommandPool, nullptr);
+    }
+
+    for (uint32_t i = 0; i < uploads->fences.size(); i++)
+    {
+        retireUploadSlot(uploads, i);
+        vkDestroyFence(device, uploads->fences[i], nullptr);
+    }
+
+    destroyRingBuffer(uploads->allocator, &uploads->staging);
+    vkDestroyCommandPool(device, uploads->commandPool, nullptr);
+}
+
+/**************************************************************************
+Compressed textures
+Purpose: KTX2 files with block compressed (BC1/BC3/BC7, ETC2, ASTC) or RGBA8 levels
+compressed formats take 4-8x less memory and bandwidth than RGBA8, gpu samples them directly
+formats that device cant sample are decoded to RGBA8 on cpu (BC only, ETC2/ASTC are used only where supported)
+*/
+struct TextureFormatInfo
+{
+    VkFormat format;
+    const char* name;
+    uint32_t blockWidth;
+    uint32_t blockHeight;
+    uint32_t blockBytes;
+    // what cpu decoder writes, VK_FORMAT_UNDEFINED if there is no decoder
+    VkFormat decodedFormat;
+};
+
+const TextureFormatInfo textureFormats[] =
+{
+    { VK_FORMAT_R8G8B8A8_UNORM, "RGBA8", 1, 1, 4, VK_FORMAT_UNDEFINED },
+    { VK_FORMAT_R8G8B8A8_SRGB, "RGBA8 sRGB", 1, 1, 4, VK_FORMAT_UNDEFINED },
+    { VK_FORMAT_BC1_RGB_UNORM_BLOCK, "BC1", 4, 4, 8, VK_FORMAT_R8G8B8A8_UNORM },
+    { VK_FORMAT_BC1_RGB_SRGB_BLOCK, "BC1 sRGB", 4, 4, 8, VK_FORMAT_R8G8B8A8_SRGB },
+    { VK_FORMAT_BC1_RGBA_UNORM_BLOCK, "BC1 RGBA", 4, 4, 8, VK_FORMAT_R8G8B8A8_UNORM },
+    { VK_FORMAT_BC1_RGBA_SRGB_BLOCK, "BC1 RGBA sRGB", 4, 4, 8, VK_FORMAT_R8G8B8A8_SRGB },
+    { VK_FORMAT_BC3_UNORM_BLOCK, "BC3", 4, 4, 16, VK_FORMAT_R8G8B8A8_UNORM },
+    { VK_FORMAT_BC3_SRGB_BLOCK, "BC3 sRGB", 4, 4, 16, VK_FORMAT_R8G8B8A8_SRGB },
+    { VK_FORMAT_BC7_UNORM_BLOCK, "BC7", 4, 4, 16, VK_FORMAT_R8G8B8A8_UNORM },
+    { VK_FORMAT_BC7_SRGB_BLOCK, "BC7 sRGB", 4, 4, 16, VK_FORMAT_R8G8B8A8_SRGB },
+    { VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, "ETC2 RGB", 4, 4, 8, VK_FORMAT_UNDEFINED },
+    { VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK, "ETC2 RGB sRGB", 4, 4, 8, VK_FORMAT_UNDEFINED },
+    { VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, "ETC2 RGBA", 4, 4, 16, VK_FORMAT_UNDEFINED },
+    { VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK, "ETC2 RGBA sRGB", 4, 4, 16, VK_FORMAT_UNDEFINED },
+    { VK_FORMAT_ASTC_4x4_UNORM_BLOCK, "ASTC 4x4", 4, 4, 16, VK_FORMAT_UNDEFINED },
+    { VK_FORMAT_ASTC_4x4_SRGB_BLOCK, "ASTC 4x4 sRGB", 4, 4, 16, VK_FORMAT_UNDEFINED },
+};
+
+const TextureFormatInfo* findTextureFormat(VkFormat format)
+{
+    for (size_t i = 0; i < sizeof(textureFormats) / sizeof(textureFormats[0]); i++)
+    {
+        if (textureFormats[i].format == format)
+            return &textureFormats[i];
+    }
+
+    return nullptr;
+}
+
+// compressed formats can be used only if their device feature was enabled when device was created
+bool textureFormatFeatureEnabled(const VkPhysicalDeviceFeatures& features, VkFormat format)
+{
+    if (format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK)
+        return features.textureCompressionBC == VK_TRUE;
+    if (format >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK && format <= VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK)
+        return features.textureCompressionETC2 == VK_TRUE;
+    if (format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_4x4_SRGB_BLOCK)
+        return features.textureCompressionASTC_LDR == VK_TRUE;
+
+    return true;
+}
+
+// sampler filters linearly so that has to be supported as well
+bool textureFormatSupported(VkPhysicalDevice gpu, const VkPhysicalDeviceFeatures& enabledFeatures, VkFormat format)
+{
+    if (!textureFormatFeatureEnabled(enabledFeatures, format))
+        return false;
+
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(gpu, format, &properties);
+
+    VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    return (properties.optimalTilingFeatures & needed) == needed;
+}
+
+// decoders write 4x4 RGBA8 pixels (64 bytes), row by row
+
+void expandRgb565(uint32_t color, byte* rgba)
+{
+    uint32_t r = (color >> 11) & 31;
+    uint32_t g = (color >> 5) & 63;
+    uint32_t b = color & 31;
+
+    rgba[0] = (byte)((r << 3) | (r >> 2));
+    rgba[1] = (byte)((g << 2) | (g >> 4));
+    rgba[2] = (byte)((b << 3) | (b >> 2));
+    rgba[3] = 255;
+}
+
+// color part of BC1/BC3, two 565 endpoints and 2 bit index per pixel
+// BC1 with color0 <= color1 has 3 colors and transparent black, BC3 always has 4 colors
+void decodeBc1Block(const byte* block, byte* rgba, bool allowThreeColors)
+{
+    uint32_t color0 = block[0] | block[1] << 8;
+    uint32_t color1 = block[2] | block[3] << 8;
+
+    byte colors[4][4];
+    expandRgb565(color0, colors[0]);
+    expandRgb565(color1, colors[1]);
+
+    for (uint32_t c = 0; c < 3; c++)
+    {
+        if (color0 > color1 || !allowThreeColors)
+        {
+            colors[2][c] = (byte)((2 * colors[0][c] + colors[1][c] + 1) / 3);
+            colors[3][c] = (byte)((colors[0][c] + 2 * colors[1][c] + 1) / 3);
+        }
+        else
+        {
+            colors[2][c] = (byte)((colors[0][c] + colors[1][c] + 1) / 2);
+            colors[3][c] = 0;
+        }
+    }
+
+    colors[2][3] = 255;
+    colors[3][3] = color0 > color1 || !allowThreeColors ? 255 : 0;
+
+    uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+
+    for (uint32_t i = 0; i < 16; i++)
+        memcpy(rgba + i * 4, colors[(indices >> (i * 2)) & 3], 4);
+}
+
+// alpha part of BC3, two 8 bit endpoints and 3 bit index per pixel, only alpha of rgba is written
+void decodeBc3AlphaBlock(const byte* block, byte* rgba)
+{
+    uint32_t alpha0 = block[0];
+    uint32_t alpha1 = block[1];
+
+    byte alphas[8] = { (byte)alpha0, (byte)alpha1 };
+
+    if (alpha0 > alpha1)
+    {
+        for (uint32_t i = 1; i < 7; i++)
+            alphas[i + 1] = (byte)(((7 - i) * alpha0 + i * alpha1 + 3) / 7);
+    }
+    else
+    {
+        for (uint32_t i = 1; i < 5; i++)
+            alphas[i + 1] = (byte)(((5 - i) * alpha0 + i * alpha1 + 2) / 5);
+        alphas[6] = 0;
+        alphas[7] = 255;
+    }
+
+    uint64_t indices = 0;
+    for (uint32_t i = 0; i < 6; i++)
+        indices |= (uint64_t)block[2 + i] << (i * 8);
+
+    for (uint32_t i = 0; i < 16; i++)
+        rgba[i * 4 + 3] = alphas[(indices >> (i * 3)) & 7];
+}
+
+// BC7 has 8 modes that differ in number of subsets (1-3, pixels are split by partition table),
+// endpoint precision, alpha and index sizes, see BPTC in khronos data format spec
+struct Bc7Mode
+{
+    uint32_t subsets;
+    uint32_t partitionBits;
+    uint32_t rotationBits;
+    uint32_t indexSelectionBits;
+    uint32_t colorBits;
+    uint32_t alphaBits;
+    // one p bit per endpoint or one shared by both endpoints of subset
+    uint32_t endpointPBits;
+    uint32_t sharedPBits;
+    uint32_t indexBits;
+    // second index set (alpha or color, see index selection), 0 if mode has only one
+    uint32_t index2Bits;
+};
+
+const Bc7Mode bc7Modes[8] =
+{
+    { 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+    { 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+    { 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+    { 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+    { 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+    { 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+    { 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+    { 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 },
+};
+
+// two subsets, bit i is subset of pixel i
+const uint16_t bc7Partitions2[64] =
+{
+    0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+    0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE, 0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+    0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A, 0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+    0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C, 0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+};
+
+// three subsets, subset of every pixel, mode 0 uses only first 16
+const byte bc7Partitions3[64][16] =
+{
+    { 0,0,1,1,0,0,1,1,0,2,2,1,2,2,2,2 }, { 0,0,0,1,0,0,1,1,2,2,1,1,2,2,2,1 }, { 0,0,0,0,2,0,0,1,2,2,1,1,2,2,1,1 }, { 0,2,2,2,0,0,2,2,0,0,1,1,0,1,1,1 },
+    { 0,0,0,0,0,0,0,0,1,1,2,2,1,1,2,2 }, { 0,0,1,1,0,0,1,1,0,0,2,2,0,0,2,2 }, { 0,0,2,2,0,0,2,2,1,1,1,1,1,1,1,1 }, { 0,0,1,1,0,0,1,1,2,2,1,1,2,2,1,1 },
+    { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2 }, { 0,0,0,0,1,1,1,1,1,1,1,1,2,2,2,2 }, { 0,0,0,0,1,1,1,1,2,2,2,2,2,2,2,2 }, { 0,0,1,2,0,0,1,2,0,0,1,2,0,0,1,2 },
+    { 0,1,1,2,0,1,1,2,0,1,1,2,0,1,1,2 }, { 0,1,2,2,0,1,2,2,0,1,2,2,0,1,2,2 }, { 0,0,1,1,0,1,1,2,1,1,2,2,1,2,2,2 }, { 0,0,1,1,2,0,0,1,2,2,0,0,2,2,2,0 },
+    { 0,0,0,1,0,0,1,1,0,1,1,2,1,1,2,2 }, { 0,1,1,1,0,0,1,1,2,0,0,1,2,2,0,0 }, { 0,0,0,0,1,1,2,2,1,1,2,2,1,1,2,2 }, { 0,0,2,2,0,0,2,2,0,0,2,2,1,1,1,1 },
+    { 0,1,1,1,0,1,1,1,0,2,2,2,0,2,2,2 }, { 0,0,0,1,0,0,0,1,2,2,2,1,2,2,2,1 }, { 0,0,0,0,0,0,1,1,0,1,2,2,0,1,2,2 }, { 0,0,0,0,1,1,0,0,2,2,1,0,2,2,1,0 },
+    { 0,1,2,2,0,1,2,2,0,0,1,1,0,0,0,0 }, { 0,0,1,2,0,0,1,2,1,1,2,2,2,2,2,2 }, { 0,1,1,0,1,2,2,1,1,2,2,1,0,1,1,0 }, { 0,0,0,0,0,1,1,0,1,2,2,1,1,2,2,1 },
+    { 0,0,2,2,1,1,0,2,1,1,0,2,0,0,2,2 }, { 0,1,1,0,0,1,1,0,2,0,0,2,2,2,2,2 }, { 0,0,1,1,0,1,2,2,0,1,2,2,0,0,1,1 }, { 0,0,0,0,2,0,0,0,2,2,1,1,2,2,2,1 },
+    { 0,0,0,0,0,0,0,2,1,1,2,2,1,2,2,2 }, { 0,2,2,2,0,0,2,2,0,0,1,2,0,0,1,1 }, { 0,0,1,1,0,0,1,2,0,0,2,2,0,2,2,2 }, { 0,1,2,0,0,1,2,0,0,1,2,0,0,1,2,0 },
+    { 0,0,0,0,1,1,1,1,2,2,2,2,0,0,0,0 }, { 0,1,2,0,1,2,0,1,2,0,1,2,0,1,2,0 }, { 0,1,2,0,2,0,1,2,1,2,0,1,0,1,2,0 }, { 0,0,1,1,2,2,0,0,1,1,2,2,0,0,1,1 },
+    { 0,0,1,1,1,1,2,2,2,2,0,0,0,0,1,1 }, { 0,1,0,1,0,1,0,1,2,2,2,2,2,2,2,2 }, { 0,0,0,0,0,0,0,0,2,1,2,1,2,1,2,1 }, { 0,0,2,2,1,1,2,2,0,0,2,2,1,1,2,2 },
+    { 0,0,2,2,0,0,1,1,0,0,2,2,0,0,1,1 }, { 0,2,2,0,1,2,2,1,0,2,2,0,1,2,2,1 }, { 0,1,0,1,2,2,2,2,2,2,2,2,0,1,0,1 }, { 0,0,0,0,2,1,2,1,2,1,2,1,2,1,2,1 },
+    { 0,1,0,1,0,1,0,1,0,1,0,1,2,2,2,2 }, { 0,2,2,2,0,1,1,1,0,2,2,2,0,1,1,1 }, { 0,0,0,2,1,1,1,2,0,0,0,2,1,1,1,2 }, { 0,0,0,0,2,1,1,2,2,1,1,2,2,1,1,2 },
+    { 0,2,2,2,0,1,1,1,0,1,1,1,0,2,2,2 }, { 0,0,0,2,1,1,1,2,1,1,1,2,0,0,0,2 }, { 0,1,1,0,0,1,1,0,0,1,1,0,2,2,2,2 }, { 0,0,0,0,0,0,0,0,2,1,1,2,2,1,1,2 },
+    { 0,1,1,0,0,1,1,0,2,2,2,2,2,2,2,2 }, { 0,0,2,2,0,0,1,1,0,0,1,1,0,0,2,2 }, { 0,0,2,2,1,1,2,2,1,1,2,2,0,0,2,2 }, { 0,0,0,0,0,0,0,0,0,0,0,0,2,1,1,2 },
+    { 0,0,0,2,0,0,0,1,0,0,0,2,0,0,0,1 }, { 0,2,2,2,1,2,2,2,0,2,2,2,1,2,2,2 }, { 0,1,0,1,2,2,2,2,2,2,2,2,2,2,2,2 }, { 0,1,1,1,2,0,1,1,2,2,0,1,2,2,2,0 },
+};
+
+// anchor pixel of every subset has index with implicit 0 top bit (one bit less in the block)
+// subset 0 anchor is always pixel 0
+const byte bc7Anchors2[64] =
+{
+    15,15,15,15,15,15,15,15, 15,15,15,15,15,15,15,15, 15, 2, 8, 2, 2, 8, 8,15, 2, 8, 2, 2, 8, 8, 2, 2,
+    15,15, 6, 8, 2, 8,15,15, 2, 8, 2, 2, 2,15,15, 6, 6, 2, 6, 8,15,15, 2, 2, 15,15,15,15,15, 2, 2,15,
+};
+
+const byte bc7Anchors3[2][64] =
+{
+    {
+        3, 3,15,15, 8, 3,15,15, 8, 8, 6, 6, 6, 5, 3, 3, 3, 3, 8,15, 3, 3, 6,10, 5, 8, 8, 6, 8, 5,15,15,
+        8,15, 3, 5, 6,10, 8,15, 15, 3,15, 5,15,15,15,15, 3,15, 5, 5, 5, 8, 5,10, 5,10, 8,13,15,12, 3, 3,
+    },
+    {
+        15, 8, 8, 3,15,15, 3, 8, 15,15,15,15,15,15,15, 8, 15, 8,15, 3,15, 8,15, 8, 3,15, 6,10,15,15,10, 8,
+        15, 3,15,10,10, 8, 9,10, 6,15, 8,15, 3, 6, 6, 8, 15, 3,15,15,15,15,15,15, 15,15,15,15, 3,15,15, 8,
+    },
+};
+
+const byte bc7Weights2[4] = { 0, 21, 43, 64 };
+const byte bc7Weights3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+const byte bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// block bits are read from lowest bit of first byte, extra zero byte so 8 bits can always be read at once
+struct Bc7Reader
+{
+    byte bytes[17];
+    uint32_t position;
+};
+
+uint32_t readBc7Bits(Bc7Reader* reader, uint32_t count)
+{
+    uint32_t byteIndex = reader->position >> 3;
+    uint32_t window = reader->bytes[byteIndex] | reader->bytes[byteIndex + 1] << 8;
+    reader->position += count;
+
+    return (window >> ((reader->position - count) & 7)) & ((1u << count) - 1);
+}
+
+byte bc7Interpolate(uint32_t e0, uint32_t e1, uint32_t index, uint32_t indexBits)
+{
+    const byte* weights = indexBits == 2 ? bc7Weights2 : indexBits == 3 ? bc7Weights3 : bc7Weights4;
+    uint32_t weight = weights[index];
+
+    return (byte)(((64 - weight) * e0 + weight * e1 + 32) >> 6);
+}
+
+void decodeBc7Block(const byte* block, byte* rgba)
+{
+    Bc7Reader reader = {};
+    memcpy(reader.bytes, block, 16);
+
+    // mode is the number of zero bits before first one
+    uint32_t modeIndex = 0;
+    while (modeIndex < 8 && readBc7Bits(&reader, 1) == 0)
+        modeIndex++;
+
+    // reserved mode decodes to transparent black
+    if (modeIndex == 8)
+    {
+        memset(rgba, 0, 64);
+        return;
+    }
+
+    const Bc7Mode& mode = bc7Modes[modeIndex];
+    uint32_t partition = readBc7Bits(&reader, mode.partitionBits);
+    uint32_t rotation = readBc7Bits(&reader, mode.rotationBits);
+    uint32_t indexSelection = readBc7Bits(&reader, mode.indexSelectionBits);
+
+    // endpoints[subset * 2 + 0/1][channel], channels are stored R of all endpoints, then G...
+    uint32_t endpoints[6][4];
+    uint32_t endpointCount = mode.subsets * 2;
+
+    for (uint32_t c = 0; c < 3; c++)
+    {
+        for (uint32_t e = 0; e < endpointCount; e++)
+            endpoints[e][c] = readBc7Bits(&reader, mode.colorBits);
+    }
+
+    for (uint32_t e = 0; e < endpointCount; e++)
+        endpoints[e][3] = mode.alphaBits ? readBc7Bits(&reader, mode.alphaBits) : 255;
+
+    // p bit is the lowest bit of every channel of endpoint
+    uint32_t colorBits = mode.colorBits;
+    uint32_t alphaBits = mode.alphaBits;
+
+    if (mode.endpointPBits || mode.sharedPBits)
+    {
+        uint32_t pBits[6];
+
+        for (uint32_t e = 0; e < endpointCount; e++)
+        {
+            if (mode.endpointPBits || e % 2 == 0)
+                pBits[e] = readBc7Bits(&reader, 1);
+            else
+                pBits[e] = pBits[e - 1];
+        }
+
+        for (uint32_t e = 0; e < endpointCount; e++)
+        {
+            for (uint32_t c = 0; c < (alphaBits ? 4u : 3u); c++)
+                endpoints[e][c] = endpoints[e][c] << 1 | pBits[e];
+        }
+
+        colorBits++;
+        if (alphaBits)
+            alphaBits++;
+    }
+
+    // to 8 bits, top bits are repeated at the bottom
+    for (uint32_t e = 0; e < endpointCount; e++)
+    {
+        for (uint32_t c = 0; c < 3; c++)
+            endpoints[e][c] = (endpoints[e][c] << (8 - colorBits)) | (endpoints[e][c] >> (2 * colorBits - 8));
+
+        if (alphaBits)
+            endpoints[e][3] = (endpoints[e][3] << (8 - alphaBits)) | (endpoints[e][3] >> (2 * alphaBits - 8));
+    }
+
+    uint32_t subsetOfPixel[16];
+    bool anchor[16] = {};
+    anchor[0] = true;
+
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        if (mode.subsets == 1)
+            subsetOfPixel[i] = 0;
+        else if (mode.subsets == 2)
+            subsetOfPixel[i] = (bc7Partitions2[partition] >> i) & 1;
+        else
+            subsetOfPixel[i] = bc7Partitions3[partition][i];
+    }
+
+    if (mode.subsets == 2)
+        anchor[bc7Anchors2[partition]] = true;
+    if (mode.subsets == 3)
+    {
+        anchor[bc7Anchors3[0][partition]] = true;
+        anchor[bc7Anchors3[1][partition]] = true;
+    }
+
+    uint32_t indices[16];
+    uint32_t indices2[16];
+
+    for (uint32_t i = 0; i < 16; i++)
+        indices[i] = readBc7Bits(&reader, mode.indexBits - (anchor[i] ? 1 : 0));
+
+    // second set has only one subset, its anchor is pixel 0
+    for (uint32_t i = 0; i < 16 && mode.index2Bits; i++)
+        indices2[i] = readBc7Bits(&reader, mode.index2Bits - (i == 0 ? 1 : 0));
+
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        const uint32_t* e0 = endpoints[subsetOfPixel[i] * 2];
+        const uint32_t* e1 = endpoints[subsetOfPixel[i] * 2 + 1];
+
+        uint32_t colorIndex = indices[i];
+        uint32_t colorIndexBits = mode.indexBits;
+        uint32_t alphaIndex = indices[i];
+        uint32_t alphaIndexBits = mode.indexBits;
+
+        if (mode.index2Bits)
+        {
+            alphaIndex = indices2[i];
+            alphaIndexBits = mode.index2Bits;
+        }
+
+        if (indexSelection)
+        {
+            std::swap(colorIndex, alphaIndex);
+            std::swap(colorIndexBits, alphaIndexBits);
+        }
+
+        byte* pixel = rgba + i * 4;
+        for (uint32_t c = 0; c < 3; c++)
+            pixel[c] = bc7Interpolate(e0[c], e1[c], colorIndex, colorIndexBits);
+        pixel[3] = bc7Interpolate(e0[3], e1[3], alphaIndex, alphaIndexBits);
+
+        // rotation swaps alpha with one of the colors
+        if (rotation)
+            std::swap(pixel[3], pixel[rotation - 1]);
+    }
+}
+
+// whole level, partial blocks at right and bottom edge are clipped, dst is width * height RGBA8
+void decodeTextureLevel(const TextureFormatInfo& info, const byte* src, uint32_t width, uint32_t height, byte* dst)
+{
+    uint32_t blocksX = (width + 3) / 4;
+    uint32_t blocksY = (height + 3) / 4;
+
+    for (uint32_t by = 0; by < blocksY; by++)
+    {
+        for (uint32_t bx = 0; bx < blocksX; bx++)
+        {
+            const byte* block = src + (by * blocksX + bx) * info.blockBytes;
+            byte pixels[64];
+
+            switch (info.format)
+            {
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+                decodeBc1Block(block, pixels, true);
+                // no alpha, transparent black is just black
+                for (uint32_t i = 0; i < 16; i++)
+                    pixels[i * 4 + 3] = 255;
+                break;
+            case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+                decodeBc1Block(block, pixels, true);
+                break;
+            case VK_FORMAT_BC3_UNORM_BLOCK:
+            case VK_FORMAT_BC3_SRGB_BLOCK:
+                decodeBc1Block(block + 8, pixels, false);
+                decodeBc3AlphaBlock(block, pixels);
+                break;
+            case VK_FORMAT_BC7_UNORM_BLOCK:
+            case VK_FORMAT_BC7_SRGB_BLOCK:
+                decodeBc7Block(block, pixels);
+                break;
+            default:
+                assert(!"no decoder for format");
+                break;
+            }
+
+            uint32_t w = std::min(4u, width - bx * 4);
+            uint32_t h = std::min(4u, height - by * 4);
+
+            for (uint32_t y = 0; y < h; y++)
+                memcpy(dst + ((by * 4 + y) * width + bx * 4) * 4, pixels + y * 16, w * 4);
+        }
+    }
+}
+
+// KTX2 file starts with this, then level index (one entry per level, level 0 is the biggest)
+// level data itself is stored from the smallest level
+struct Ktx2Header
+{
+    byte identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct Ktx2Level
+{
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+struct Texture
+{
+    VkImage image;
+    MemoryAllocation memory;
+    // format of the image and format in file, they differ if cpu decoder was used
+    VkFormat format;
+    VkFormat sourceFormat;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    // all levels in gpu memory and the same as RGBA8, for statistics
+    VkDeviceSize size;
+    VkDeviceSize rgba8Size;
+    bool cpuDecoded;
+};
+
+// 2D image with its levels from KTX2 file, data is copied to staging so it can be released after this returns
+// all stored levels go in one copy (one vkCmdCopyBufferToImage with region per level), token is of that upload
+// device has to support format (see textureFormatSupported), otherwise or with forceCpuDecode levels are decoded to RGBA8
+// returns false if file is invalid or format cant be used, nothing is created then
+bool loadKtx2Texture(VkPhysicalDevice gpu, const VkPhysicalDeviceFeatures& enabledFeatures, bool forceCpuDecode,
+    const byte* data, size_t size, UploadManager* uploads, Texture* texture, uint64_t* token)
+{
+    static const byte identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+    Ktx2Header header;
+    if (size < sizeof(header))
+        return false;
+
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.identifier, identifier, sizeof(identifier)) != 0)
+    {
+        printf("ktx2: not a ktx2 file\n");
+        return false;
+    }
+
+    // basis universal (format undefined) needs transcoder and zstd/zlib a decompressor
+    if (header.vkFormat == VK_FORMAT_UNDEFINED || header.supercompressionScheme != 0)
+    {
+        printf("ktx2: supercompressed and basis universal files are not supported\n");
+        return false;
+    }
+
+    if (header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1)
+    {
+        printf("ktx2: only 2D images without layers or faces are supported\n");
+        return false;
+    }
+
+    const TextureFormatInfo* info = findTextureFormat((VkFormat)header.vkFormat);
+
+    if (!info)
+    {
+        printf("ktx2: format %u is not supported\n", header.vkFormat);
+        return false;
+    }
+
+    bool native = textureFormatSupported(gpu, enabledFeatures, info->format);
+    if (forceCpuDecode && info->decodedFormat != VK_FORMAT_UNDEFINED)
+        native = false;
+
+    if (!native && info->decodedFormat == VK_FORMAT_UNDEFINED)
+    {
+        printf("ktx2: %s is not supported by device and there is no cpu decoder for it\n", info->name);
+        return false;
+    }
+
+    // 0 means that only base level is stored and loader should make the rest
+    uint32_t storedLevels = header.levelCount ? header.levelCount : 1;
+
+    if (storedLevels > mipLevelCount(header.pixelWidth, header.pixelHeight) ||
+        sizeof(header) + storedLevels * sizeof(Ktx2Level) > size)
+    {
+        printf("ktx2: level index is not valid\n");
+        return false;
+    }
+
+    std::vector<Ktx2Level> levels(storedLevels);
+    memcpy(levels.data(), data + sizeof(header), storedLevels * sizeof(Ktx2Level));
+
+    // levels are stored together, whole range goes to staging in one memcpy
+    uint64_t dataStart = UINT64_MAX;
+    uint64_t dataEnd = 0;
+
+    for (uint32_t level = 0; level < storedLevels; level++)
+    {
+        uint32_t w = std::max(1u, header.pixelWidth >> level);
+        uint32_t h = std::max(1u, header.pixelHeight >> level);
+        uint64_t levelSize = (uint64_t)((w + info->blockWidth - 1) / info->blockWidth) *
+            ((h + info->blockHeight - 1) / info->blockHeight) * info->blockBytes;
+
+        // copy offsets must be multiple of block size, file aligns levels to it
+        if (levels[level].byteLength != levelSize || levels[level].byteOffset % info->blockBytes != 0 ||
+            levels[level].byteOffset > size || levels[level].byteLength > size - levels[level].byteOffset)
+        {
+            printf("ktx2: level %u is not valid\n", level);
+            return false;
+        }
+
+        dataStart = std::min(dataStart, levels[level].byteOffset);
+        dataEnd = std::max(dataEnd, levels[level].byteOffset + levels[level].byteLength);
+    }
+
+    // missing levels can be blitted only for uncompressed formats
+    bool generateMips = header.levelCount == 0 && native && info->blockWidth == 1 && formatSupportsLinearBlit(gpu, info->format);
+
+    texture->format = native ? info->format : info->decodedFormat;
+    texture->sourceFormat = info->format;
+    texture->width = header.pixelWidth;
+    texture->height = header.pixelHeight;
+    texture->levelCount = generateMips ? mipLevelCount(header.pixelWidth, header.pixelHeight) : storedLevels;
+    texture->cpuDecoded = !native;
+    texture->size = 0;
+    texture->rgba8Size = 0;
+
+    for (uint32_t level = 0; level < texture->levelCount; level++)
+    {
+        uint32_t w = std::max(1u, header.pixelWidth >> level);
+        uint32_t h = std::max(1u, header.pixelHeight >> level);
+        uint32_t blockWidth = native ? info->blockWidth : 1;
+        uint32_t blockHeight = native ? info->blockHeight : 1;
+        uint32_t blockBytes = native ? info->blockBytes : 4;
+
+        texture->size += (VkDeviceSize)((w + blockWidth - 1) / blockWidth) * ((h + blockHeight - 1) / blockHeight) * blockBytes;
+        texture->rgba8Size += (VkDeviceSize)w * h * 4;
+    }
+
+    VkImageCreateInfo imageCreateInfo = {};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.extent = { header.pixelWidth, header.pixelHeight, 1 };
+    imageCreateInfo.mipLevels = texture->levelCount;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.format = texture->format;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT |
+        (generateMips ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    createImage(&imageCreateInfo, uploads->allocator, &texture->image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texture->memory);
+
+    VkImageSubresourceRange range = {};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.baseMipLevel = 0;
+    range.levelCount = texture->levelCount;
+    range.baseArrayLayer = 0;
+    range.layerCount = 1;
+
+    // extent of small levels of block compressed image is not rounded up to block size
+    std::vector<VkBufferImageCopy> regions(storedLevels);
+
+    for (uint32_t level = 0; level < storedLevels; level++)
+    {
+        regions[level] = {};
+        regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[level].imageSubresource.mipLevel = level;
+        regions[level].imageSubresource.baseArrayLayer = 0;
+        regions[level].imageSubresource.layerCount = 1;
+        regions[level].imageExtent = { std::max(1u, header.pixelWidth >> level), std::max(1u, header.pixelHeight >> level), 1 };
+    }
+
+    if (native)
+    {
+        for (uint32_t level = 0; level < storedLevels; level++)
+            regions[level].bufferOffset = levels[level].byteOffset - dataStart;
+
+        if (generateMips)
+        {
+            *token = uploadImageGenerateMips(uploads, texture->image, range, { header.pixelWidth, header.pixelHeight },
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, data + dataStart, dataEnd - dataStart, regions.data(), 1);
+        }
+        else
+        {
+            *token = uploadImage(uploads, texture->image, range, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                data + dataStart, dataEnd - dataStart, regions.data(), storedLevels);
+        }
+    }
+    else
+    {
+        // every level is decoded after the previous one, same layout as buildMipChainRgba8
+        std::vector<byte> decoded((size_t)texture->rgba8Size);
+        VkDeviceSize offset = 0;
+
+        for (uint32_t level = 0; level < storedLevels; level++)
+        {
+            regions[level].bufferOffset = offset;
+            decodeTextureLevel(*info, data + levels[level].byteOffset, regions[level].imageExtent.width,
+                regions[level].imageExtent.height, &decoded[(size_t)offset]);
+            offset += (VkDeviceSize)regions[level].imageExtent.width * regions[level].imageExtent.height * 4;
+        }
+
+        *token = uploadImage(uploads, texture->image, range, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            decoded.data(), decoded.size(), regions.data(), storedLevels);
+    }
+
+    return true;
+}
+
+void destroyTexture(DeviceAllocator* allocator, Texture* texture)
+{
+    destroyImage(allocator, texture->image, &texture->memory);
+    texture->image = VK_NULL_HANDLE;
+}
+
+/**************************************************************************
+Texture atlas
+Purpose: many small images in one VkImage so they can share descriptor set and draw call
+every page is one layer of 2D array image, images are placed with skyline bottom-left packer
+images are kept on cpu so atlas can be repacked when all pages are full
+*/
+struct AtlasRect
+{
+    uint32_t x, y, w, h;
+};
+
+// top edge of used area, nodes cover the whole page width from left to right
+struct SkylineNode
+{
+    uint32_t x, y, width;
+};
+
+struct AtlasPage
+{
+    std::vector<SkylineNode> skyline;
+    uint64_t usedArea;
+};
+
+struct AtlasEntry
+{
+    uint32_t page;
+    // without padding
+    AtlasRect rect;
+    float u0, v0, u1, v1;
+    uint32_t width, height;
+    std::vector<byte> pixels;
+    bool dirty;
+};
+
+struct TextureAtlas
+{
+    VkImage image;
+    MemoryAllocation memory;
+    VkImageView view;
+    uint32_t pageSize;
+    uint32_t maxPages;
+    // every image has border of its edge pixels so filtering doesnt pull in neighbours
+    uint32_t padding;
+    // layout is undefined until first upload
+    bool uploaded;
+    std::vector<AtlasPage> pages;
+    std::vector<AtlasEntry> entries;
+    uint32_t repackCount;
+};
+
+void resetAtlasPage(AtlasPage* page, uint32_t pageSize)
+{
+    page->skyline.clear();
+    page->skyline.push_back({ 0, 0, pageSize });
+    page->usedArea = 0;
+}
+
+// lowest (then narrowest) spot where w x h fits, false if page is full
+bool skylineFindPosition(const AtlasPage* page, uint32_t pageSize, uint32_t w, uint32_t h,
+    uint32_t* bestIndex, uint32_t* bestX, uint32_t* bestY)
+{
+    uint32_t bestWidth = UINT_MAX;
+    *bestY = UINT_MAX;
+
+    for (uint32_t i = 0; i < page->skyline.size(); i++)
+    {
+        uint32_t x = page->skyline[i].x;
+        if (x + w > pageSize)
+            break;
+
+        // rectangle rests on the highest node it spans
+        uint32_t y = 0;
+        uint32_t widthLeft = w;
+        bool fits = true;
+
+        for (uint32_t j = i; widthLeft > 0; j++)
+        {
+            if (page->skyline[j].y > y)
+                y = page->skyline[j].y;
+
+            if (y + h > pageSize)
+            {
+                fits = false;
+                break;
+            }
+
+            widthLeft -= page->skyline[j].width < widthLeft ? page->skyline[j].width : widthLeft;
+        }
+
+        if (fits && (y < *bestY || (y == *bestY && page->skyline[i].width < bestWidth)))
+        {
+            *bestIndex = i;
+            *bestX = x;
+            *bestY = y;
+            bestWidth = page->skyline[i].width;
+        }
+    }
+
+    return *bestY != UINT_MAX;
+}
+
+void skylineAddRect(AtlasPage* page, uint32_t index, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    std::vector<SkylineNode>& nodes = page->skyline;
+    SkylineNode node = { x, y + h, w };
+    nodes.insert(nodes.begin() + index, node);
+
+    // nodes under new one are shortened or removed
+    for (uint32_t i = index + 1; i < nodes.size(); )
+    {
+        uint32_t previousEnd = nodes[i - 1].x + nodes[i - 1].width;
+
+        if (nodes[i].x >= previousEnd)
+            break;
+
+        uint32_t shrink = previousEnd - nodes[i].x;
+
+        if (nodes[i].width <= shrink)
+        {
+            nodes.erase(nodes.begin() + i);
+            continue;
+        }
+
+        nodes[i].x += shrink;
+        nodes[i].width -= shrink;
+        break;
+    }
+
+    // neighbours at the same height become one node
+    for (uint32_t i = 0; i + 1 < nodes.size(); )
+    {
+        if (nodes[i].y == nodes[i + 1].y)
+        {
+            nodes[i].width += nodes[i + 1].width;
+            nodes.erase(nodes.begin() + i + 1);
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    page->usedArea += (uint64_t)w * h;
+}
+
+// finds place for entry in existing pages or opens a new one, false if all pages are full
+bool atlasPlaceEntry(TextureAtlas* atlas, AtlasEntry* entry)
+{
+    uint32_t w = entry->width + 2 * atlas->padding;
+    uint32_t h = entry->height + 2 * atlas->padding;
+
+    if (w > atlas->pageSize || h > atlas->pageSize)
+        return false;
+
+    for (uint32_t p = 0; p <= atlas->pages.size() && p < atlas->maxPages; p++)
+    {
+        if (p == atlas->pages.size())
+        {
+            AtlasPage page;
+            resetAtlasPage(&page, atlas->pageSize);
+            atlas->pages.push_back(page);
+        }
+
+        uint32_t index, x, y;
+        if (!skylineFindPosition(&atlas->pages[p], atlas->pageSize, w, h, &index, &x, &y))
+            continue;
+
+        skylineAddRect(&atlas->pages[p], index, x, y, w, h);
+
+        entry->page = p;
+        entry->rect = { x + atlas->padding, y + atlas->padding, entry->width, entry->height };
+        entry->u0 = entry->rect.x / (float)atlas->pageSize;
+        entry->v0 = entry->rect.y / (float)atlas->pageSize;
+        entry->u1 = (entry->rect.x + entry->rect.w) / (float)atlas->pageSize;
+        entry->v1 = (entry->rect.y + entry->rect.h) / (float)atlas->pageSize;
+        entry->dirty = true;
+
+        return true;
+    }
+
+    return false;
+}
+
+// places everything again from scratch, biggest first which usually packs better than insertion order
+// every entry moves so uv rects have to be read again after this
+// if it doesnt fit atlas stays as it was
+bool atlasRepack(TextureAtlas* atlas)
+{
+    std::vector<AtlasPage> oldPages = atlas->pages;
+    std::vector<AtlasEntry> oldPlacement(atlas->entries.size());
+    for (size_t i = 0; i < atlas->entries.size(); i++)
+    {
+        // pixels are not needed to restore placement
+        const AtlasEntry& entry = atlas->entries[i];
+        oldPlacement[i].page = entry.page;
+        oldPlacement[i].rect = entry.rect;
+        oldPlacement[i].u0 = entry.u0;
+        oldPlacement[i].v0 = entry.v0;
+        oldPlacement[i].u1 = entry.u1;
+        oldPlacement[i].v1 = entry.v1;
+        oldPlacement[i].dirty = entry.dirty;
+    }
+
+    std::vector<uint32_t> order(atlas->entries.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    std::sort(order.begin(), order.end(), [atlas](uint32_t a, uint32_t b) {
+        const AtlasEntry& ea = atlas->entries[a];
+        const AtlasEntry& eb = atlas->entries[b];
+        return ea.height != eb.height ? ea.height > eb.height : ea.width > eb.width;
+    });
+
+    atlas->pages.clear();
+
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        if (!atlasPlaceEntry(atlas, &atlas->entries[order[i]]))
+        {
+            atlas->pages = oldPages;
+            for (size_t k = 0; k < atlas->entries.size(); k++)
+            {
+                AtlasEntry& entry = atlas->entries[k];
+                entry.page = oldPlacement[k].page;
+                entry.rect = oldPlacement[k].rect;
+                entry.u0 = oldPlacement[k].u0;
+                entry.v0 = oldPlacement[k].v0;
+                entry.u1 = oldPlacement[k].u1;
+                entry.v1 = oldPlacement[k].v1;
+                entry.dirty = oldPlacement[k].dirty;
+            }
+
+            return false;
+        }
+    }
+
+    atlas->repackCount++;
+    return true;
+}
+
+void createTextureAtlas(uint32_t pageSize, uint32_t maxPages, DeviceAllocator* allocator, TextureAtlas* atlas)
+{
+    atlas->pageSize = pageSize;
+    atlas->maxPages = maxPages;
+    atlas->padding = 1;
+    atlas->uploaded = false;
+    atlas->repackCount = 0;
+
+    VkImageCreateInfo imageCreateInfo = {};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.extent.width = pageSize;
+    imageCreateInfo.extent.height = pageSize;
+    imageCreateInfo.extent.depth = 1;
+    imageCreateInfo.mipLevels = 1;
+    // all pages exist from the start, memory is not reallocated when atlas grows
+    imageCreateInfo.arrayLayers = maxPages;
+    imageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+    createImage(&imageCreateInfo, allocator, &atlas->image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &atlas->memory);
+
+    VkImageViewCreateInfo viewCreateInfo = {};
+    viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewCreateInfo.image = atlas->image;
+    viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewCreateInfo.subresourceRange.baseMipLevel = 0;
+    viewCreateInfo.subresourceRange.levelCount = 1;
+    viewCreateInfo.subresourceRange.baseArrayLayer = 0;
+    viewCreateInfo.subresourceRange.layerCount = maxPages;
+
+    assert(vkCreateImageView(allocator->device, &viewCreateInfo, nullptr, &atlas->view) == VK_SUCCESS);
+}
+
+// adds RGBA image, returns entry id or UINT32_MAX if it doesnt fit even after repacking
+// pixels are uploaded by atlasFlush
+uint32_t atlasAddImage(TextureAtlas* atlas, const byte* pixels, uint32_t width, uint32_t height)
+{
+    AtlasEntry entry = {};
+    entry.width = width;
+    entry.height = height;
+    entry.pixels.assign(pixels, pixels + width * height * 4);
+
+    atlas->entries.push_back(entry);
+
+    if (atlasPlaceEntry(atlas, &atlas->entries.back()))
+        return (uint32_t)atlas->entries.size() - 1;
+
+    // pages are full, maybe everything fits when placed in better order
+    // new entry has no placement yet, it doesnt matter that repack restores garbage into it on failure
+    if (atlasRepack(atlas))
+        return (uint32_t)atlas->entries.size() - 1;
+
+    atlas->entries.pop_back();
+    return UINT32_MAX;
+}
+
+// uploads all new and moved images in one copy command
+uint64_t atlasFlush(TextureAtlas* atlas, UploadManager* uploads)
+{
+    std::vector<byte> data;
+    std::vector<VkBufferImageCopy> regions;
+    uint32_t p = atlas->padding;
+
+    for (size_t i = 0; i < atlas->entries.size(); i++)
+    {
+        AtlasEntry& entry = atlas->entries[i];
+        if (!entry.dirty)
+            continue;
+
+        // image with its edge pixels repeated around it
+        uint32_t w = entry.width + 2 * p;
+        uint32_t h = entry.height + 2 * p;
+        size_t offset = data.size();
+        data.resize(offset + w * h * 4);
+
+        for (uint32_t y = 0; y < h; y++)
+        {
+            uint32_t sy = y < p ? 0 : (y - p >= entry.height ? entry.height - 1 : y - p);
+
+            for (uint32_t x = 0; x < w; x++)
+            {
+                uint32_t sx = x < p ? 0 : (x - p >= entry.width ? entry.width - 1 : x - p);
+                memcpy(&data[offset + (y * w + x) * 4], &entry.pixels[(sy * entry.width + sx) * 4], 4);
+            }
+        }
+
+        VkBufferImageCopy region = {};
+        region.bufferOffset = offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = entry.page;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = { (int32_t)(entry.rect.x - p), (int32_t)(entry.rect.y - p), 0 };
+        region.imageExtent = { w, h, 1 };
+        regions.push_back(region);
+
+        entry.dirty = false;
+    }
+
+    if (regions.empty())
+        return 0;
+
+    VkImageSubresourceRange range = {};
+    range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    range.baseMipLevel = 0;
+    range.levelCount = 1;
+    range.baseArrayLayer = 0;
+    range.layerCount = atlas->maxPages;
+
+    // after first upload old content has to stay, only new rectangles are written
+    VkImageLayout oldLayout = atlas->uploaded ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+    atlas->uploaded = true;
+
+    return uploadImage(uploads, atlas->image, range, oldLayout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        data.data(), data.size(), regions.data(), (uint32_t)regions.size());
+}
+
+void printTextureAtlasStats(const TextureAtlas* atlas)
+{
+    uint64_t used = 0;
+    for (size_t i = 0; i < atlas->pages.size(); i++)
+        used += atlas->pages[i].usedArea;
+
+    uint64_t total = (uint64_t)atlas->pageSize * atlas->pageSize * (atlas->pages.empty() ? 1 : atlas->pages.size());
+
+    printf("atlas: %u images in %u/%u %ux%u page(s), %.1f%% of used pages filled, %u repack(s)\n",
+        (uint32_t)atlas->entries.size(), (uint32_t)atlas->pages.size(), atlas->maxPages, atlas->pageSize, atlas->pageSize,
+        100.0 * used / total, atlas->repackCount);
+}
+
+void destroyTextureAtlas(DeviceAllocator* allocator, TextureAtlas* atlas)
+{
+    vkDestroyImageView(allocator->device, atlas->view, nullptr);
+    destroyImage(allocator, atlas->image, &atlas->memory);
+}
+
+/**************************************************************************
+Vertex formats
+Purpose: vertex layouts are written as list of (location, format), offsets and stride come from format sizes
+packed formats (half float, 16 and 8 bit unorm) make vertices smaller, quad vertex is 12 bytes instead of 7 floats
+packing from floats runs 4 values at a time with SSE2, other cpus use the scalar versions
+*/
+struct VertexAttribute
+{
+    uint32_t location;
+    VkFormat format;
+};
+
+struct VertexLayout
+{
+    VkVertexInputBindingDescription binding;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+};
+
+// bytes of one attribute, only formats that can be packed here (and plain floats) are supported
+uint32_t vertexFormatSize(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R32_SFLOAT: return 4;
+    case VK_FORMAT_R32G32_SFLOAT: return 8;
+    case VK_FORMAT_R32G32B32_SFLOAT: return 12;
+    case VK_FORMAT_R32G32B32A32_SFLOAT: return 16;
+    case VK_FORMAT_R16G16_SFLOAT: return 4;
+    case VK_FORMAT_R16G16_UNORM: return 4;
+    case VK_FORMAT_R16G16B16A16_SFLOAT: return 8;
+    case VK_FORMAT_R16G16B16A16_UNORM: return 8;
+    case VK_FORMAT_R8G8B8A8_UNORM: return 4;
+    default: assert(!"unsupported vertex format"); return 0;
+    }
+}
+
+// attributes follow each other in the given order without gaps, stride is their total size
+void buildVertexLayout(uint32_t binding, VkVertexInputRate inputRate, const VertexAttribute* attributes, uint32_t attributeCount,
+    VertexLayout* layout)
+{
+    uint32_t offset = 0;
+    layout->attributes.resize(attributeCount);
+
+    for (uint32_t i = 0; i < attributeCount; i++)
+    {
+        layout->attributes[i].binding = binding;
+        layout->attributes[i].location = attributes[i].location;
+        layout->attributes[i].format = attributes[i].format;
+        layout->attributes[i].offset = offset;
+        offset += vertexFormatSize(attributes[i].format);
+    }
+
+    layout->binding.binding = binding;
+    layout->binding.stride = offset;
+    layout->binding.inputRate = inputRate;
+}
+
+// round to nearest even, too big values become infinity, too small ones denormals or zero
+uint16_t floatToHalf(float value)
+{
+    uint32_t x;
+    memcpy(&x, &value, 4);
+
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+
+    uint32_t half;
+    if (x >= 0x47800000u)
+    {
+        // infinity or nan (stays nan)
+        half = x > 0x7f800000u ? 0x7e00 : 0x7c00;
+    }
+    else if (x < 0x38800000u)
+    {
+        // float add with magic number puts denormal mantissa to the lowest bits and rounds it
+        const uint32_t magicBits = 126u << 23;
+        float magic;
+        memcpy(&magic, &magicBits, 4);
+        float f;
+        memcpy(&f, &x, 4);
+        f += magic;
+        memcpy(&half, &f, 4);
+        half -= magicBits;
+    }
+    else
+    {
+        // rebias exponent, 0xfff + lowest kept bit rounds to even
+        uint32_t mantissaOdd = (x >> 13) & 1;
+        x += ((uint32_t)(15 - 127) << 23) + 0xfff + mantissaOdd;
+        half = x >> 13;
+    }
+
+    return (uint16_t)(half | (sign >> 16));
+}
+
+uint16_t floatToUnorm16(float value)
+{
+    // nan becomes 0
+    value = value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+    return (uint16_t)(value * 65535.0f + 0.5f);
+}
+
+uint32_t floatToUnorm8(float value)
+{
+    value = value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+    return (uint32_t)(value * 255.0f + 0.5f);
+}
+
+#ifdef HAS_SSE2
+// same steps as floatToHalf on 4 lanes, branches become selects
+__m128i floatToHalf4(__m128 value)
+{
+    __m128i x = _mm_castps_si128(value);
+    __m128i sign = _mm_and_si128(x, _mm_set1_epi32((int)0x80000000u));
+    x = _mm_xor_si128(x, sign);
+
+    // compares are signed but sign bit is cleared
+    __m128i infNan = _mm_cmpgt_epi32(x, _mm_set1_epi32(0x477fffff));
+    __m128i isNan = _mm_cmpgt_epi32(x, _mm_set1_epi32(0x7f800000));
+    __m128i denormal = _mm_cmplt_epi32(x, _mm_set1_epi32(0x38800000));
+
+    __m128i infNanHalf = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(isNan, _mm_set1_epi32(0x0200)));
+
+    __m128i magicBits = _mm_set1_epi32(126 << 23);
+    __m128i denormalHalf = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(x), _mm_castsi128_ps(magicBits))), magicBits);
+
+    __m128i mantissaOdd = _mm_and_si128(_mm_srli_epi32(x, 13), _mm_set1_epi32(1));
+    __m128i normalHalf = _mm_add_epi32(x, _mm_set1_epi32((int)(((uint32_t)(15 - 127) << 23) + 0xfff)));
+    normalHalf = _mm_srli_epi32(_mm_add_epi32(normalHalf, mantissaOdd), 13);
+
+    __m128i half = _mm_or_si128(_mm_and_si128(denormal, denormalHalf), _mm_andnot_si128(denormal, normalHalf));
+    half = _mm_or_si128(_mm_and_si128(infNan, infNanHalf), _mm_andnot_si128(infNan, half));
+
+    return _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+}
+
+// 8 values in lanes 0-65535 to 16 bits, sign extended first because _mm_packs_epi32 saturates signed values
+__m128i packLow16(__m128i a, __m128i b)
+{
+    a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    return _mm_packs_epi32(a, b);
+}
+#endif
+
+void packHalf(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+#ifdef HAS_SSE2
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i a = floatToHalf4(_mm_loadu_ps(src + i));
+        __m128i b = floatToHalf4(_mm_loadu_ps(src + i + 4));
+        _mm_storeu_si128((__m128i*)(dst + i), packLow16(a, b));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = floatToHalf(src[i]);
+}
+
+void packUnorm16(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+#ifdef HAS_SSE2
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 scale = _mm_set1_ps(65535.0f);
+    __m128 round = _mm_set1_ps(0.5f);
+
+    for (; i + 8 <= count; i += 8)
+    {
+        // max first so nan becomes 0 like in floatToUnorm16
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), zero), one);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), zero), one);
+        __m128i ai = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(a, scale), round));
+        __m128i bi = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(b, scale), round));
+        _mm_storeu_si128((__m128i*)(dst + i), packLow16(ai, bi));
+    }
+#endif
+    for (; i < count; i++)
+        dst[i] = floatToUnorm16(src[i]);
+}
+
+// RGBA floats (4 per color) to R8G8B8A8_UNORM
+void packUnorm8x4(const float* src, uint32_t* dst, size_t count)
+{
+    size_t i = 0;
+#ifdef HAS_SSE2
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 scale = _mm_set1_ps(255.0f);
+    __m128 round = _mm_set1_ps(0.5f);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i c[4];
+        for (uint32_t k = 0; k < 4; k++)
+        {
+            __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + (i + k) * 4), zero), one);
+            c[k] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scale), round));
+        }
+
+        // values are 0-255 so neither pack saturates, bytes end up in memory order R G B A
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(c[0], c[1]), _mm_packs_epi32(c[2], c[3]));
+        _mm_storeu_si128((__m128i*)(dst + i), bytes);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        const float* c = src + i * 4;
+        dst[i] = floatToUnorm8(c[0]) | (floatToUnorm8(c[1]) << 8) | (floatToUnorm8(c[2]) << 16) | (floatToUnorm8(c[3]) << 24);
+    }
+}
+
+// 12 byte vertex of the quad mesh
+struct PackedVertex
+{
+    // R16G16_SFLOAT
+    uint16_t x, y;
+    // R16G16_UNORM
+    uint16_t u, v;
+    // R8G8B8A8_UNORM
+    uint32_t color;
+};
+
+const VertexAttribute packedVertexAttributes[] = {
+    { 0, VK_FORMAT_R16G16_SFLOAT },
+    { 2, VK_FORMAT_R16G16_UNORM },
+    { 1, VK_FORMAT_R8G8B8A8_UNORM },
+};
+
+// vertices with 7 floats each (x y, r g b, u v), every column is packed as one array so simd can be used
+void packVertices(const float* vertices, uint32_t count, PackedVertex* packed)
+{
+    std::vector<float> positions(count * 2);
+    std::vector<float> uvs(count * 2);
+    std::vector<float> colors(count * 4);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const float* v = vertices + i * 7;
+        positions[i * 2 + 0] = v[0];
+        positions[i * 2 + 1] = v[1];
+        colors[i * 4 + 0] = v[2];
+        colors[i * 4 + 1] = v[3];
+        colors[i * 4 + 2] = v[4];
+        colors[i * 4 + 3] = 1.0f;
+        uvs[i * 2 + 0] = v[5];
+        uvs[i * 2 + 1] = v[6];
+    }
+
+    std::vector<uint16_t> halfPositions(count * 2);
+    std::vector<uint16_t> unormUvs(count * 2);
+    std::vector<uint32_t> packedColors(count);
+
+    packHalf(positions.data(), halfPositions.data(), count * 2);
+    packUnorm16(uvs.data(), unormUvs.data(), count * 2);
+    packUnorm8x4(colors.data(), packedColors.data(), count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        packed[i].x = halfPositions[i * 2 + 0];
+        packed[i].y = halfPositions[i * 2 + 1];
+        packed[i].u = unormUvs[i * 2 + 0];
+        packed[i].v = unormUvs[i * 2 + 1];
+        packed[i].color = packedColors[i];
+    }
+}
+
+/**************************************************************************
+Mesh
+Purpose: vertex and index buffer with their counts, so draws dont have to guess them from source arrays
+indices are 16 bit, triangles share vertices instead of repeating them and gpu can reuse transformed ones
+from post transform cache, same mesh is also used for instanced draws (every sprite is one instance of quad)
+*/
+struct Mesh
+{
+    VkBuffer vertexBuffer;
+    MemoryAllocation vertexMemory;
+    VkBuffer indexBuffer;
+    MemoryAllocation indexMemory;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+};
+
+// 2 triangles, same winding as 4 vertex triangle strip (0 1 2, 2 1 3)
+const uint16_t quadIndices[] = { 0, 1, 2, 2, 1, 3 };
+
+// both buffers are device local, returns token of the upload
+uint64_t createMesh(const void* vertices, uint32_t vertexCount, uint32_t vertexStride, const uint16_t* indices, uint32_t indexCount,
+    DeviceAllocator* allocator, UploadManager* uploads, Mesh* mesh)
+{
+    VkDeviceSize vertexSize = (VkDeviceSize)vertexCount * vertexStride;
+    VkDeviceSize indexSize = (VkDeviceSize)indexCount * sizeof(uint16_t);
+
+    createBuffer(vertexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        allocator, &mesh->vertexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mesh->vertexMemory);
+    createBuffer(indexSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        allocator, &mesh->indexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &mesh->indexMemory);
+
+    mesh->vertexCount = vertexCount;
+    mesh->indexCount = indexCount;
+
+    uploadBuffer(uploads, mesh->vertexBuffer, 0, vertices, vertexSize);
+    return uploadBuffer(uploads, mesh->indexBuffer, 0, indices, indexSize);
+}
+
+// vertex binding 0 and index buffer, instanced draws bind their instance data to binding 1 themselves
+void bindMesh(VkCommandBuffer command, const Mesh& mesh)
+{
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(command, 0, 1, &mesh.vertexBuffer, &offset);
+    vkCmdBindIndexBuffer(command, mesh.indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+}
+
+void drawMesh(VkCommandBuffer command, const Mesh& mesh, uint32_t instanceCount, uint32_t firstInstance)
+{
+    vkCmdDrawIndexed(command, mesh.indexCount, instanceCount, 0, 0, firstInstance);
+}
+
+void destroyMesh(DeviceAllocator* allocator, Mesh* mesh)
+{
+    destroyBuffer(allocator, mesh->vertexBuffer, &mesh->vertexMemory);
+    destroyBuffer(allocator, mesh->indexBuffer, &mesh->indexMemory);
+}
+
+/**************************************************************************
+Descriptor allocator
+Purpose: descriptor sets come from pools that are created when needed, sets are never freed one by one
+frame allocator has pools per frame slot and resets them all with vkResetDescriptorPool after the slot fence,
+set cache keeps sets that dont change and gives the same set back for the same bindings without vkUpdateDescriptorSets
+*/
+// what one binding points to, buffer or image depending on type
+struct DescriptorBinding
+{
+    uint32_t binding;
+    VkDescriptorType type;
+    VkDescriptorBufferInfo buffer;
+    VkDescriptorImageInfo image;
+};
+
+DescriptorBinding bufferDescriptor(uint32_t binding, VkDescriptorType type, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+    DescriptorBinding descriptor = {};
+    descriptor.binding = binding;
+    descriptor.type = type;
+    descriptor.buffer.buffer = buffer;
+    descriptor.buffer.offset = offset;
+    descriptor.buffer.range = range;
+    return descriptor;
+}
+
+DescriptorBinding imageDescriptor(uint32_t binding, VkImageView view, VkSampler sampler)
+{
+    DescriptorBinding descriptor = {};
+    descriptor.binding = binding;
+    descriptor.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptor.image.imageView = view;
+    descriptor.image.sampler = sampler;
+    descriptor.image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    return descriptor;
+}
+
+bool isImageDescriptor(VkDescriptorType type)
+{
+    return type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER || type == VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE ||
+        type == VK_DESCRIPTOR_TYPE_STORAGE_IMAGE || type == VK_DESCRIPTOR_TYPE_SAMPLER;
+}
+
+// one vkUpdateDescriptorSets for all bindings
+void writeDescriptorSet(VkDevice device, VkDescriptorSet set, const DescriptorBinding* bindings, uint32_t bindingCount)
+{
+    std::vector<VkWriteDescriptorSet> writes(bindingCount);
+
+    for (uint32_t i = 0; i < bindingCount; i++)
+    {
+        writes[i] = {};
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = set;
+        writes[i].dstBinding = bindings[i].binding;
+        writes[i].descriptorCount = 1;
+        writes[i].descriptorType = bindings[i].type;
+        if (isImageDescriptor(bindings[i].type))
+            writes[i].pImageInfo = &bindings[i].image;
+        else
+            writes[i].pBufferInfo = &bindings[i].buffer;
+    }
+
+    vkUpdateDescriptorSets(device, bindingCount, writes.data(), 0, nullptr);
+}
+
+// pool and how full it is, vulkan 1.0 without VK_KHR_maintenance1 doesnt have to report a full pool
+// so allocator must not allocate past maxSets
+struct DescriptorPool
+{
+    VkDescriptorPool pool;
+    uint32_t maxSets;
+    uint32_t setsAllocated;
+};
+
+struct DescriptorAllocator
+{
+    VkDevice device;
+    // descriptors of every type per set, pool has this times setsPerPool
+    // every layout allocated from it must fit in this
+    std::vector<VkDescriptorPoolSize> sizesPerSet;
+    // next pool is twice as big, up to maxSetsPerPool
+    uint32_t setsPerPool;
+    uint32_t maxSetsPerPool;
+    // pools used by every frame slot, last one is where sets are allocated from
+    std::vector<std::vector<DescriptorPool>> slotPools;
+    // reset pools, used again before new ones are created
+    std::vector<DescriptorPool> freePools;
+    uint32_t currentSlot;
+    uint32_t poolCount;
+    uint32_t setsAllocated;
+};
+
+// frameSlotCount 1 and no descriptorAllocatorBeginFrame makes allocator for sets that live until destroy
+void createDescriptorAllocator(VkDevice device, const VkDescriptorPoolSize* sizesPerSet, uint32_t sizeCount, uint32_t firstSetsPerPool,
+    uint32_t frameSlotCount, DescriptorAllocator* allocator)
+{
+    allocator->device = device;
+    allocator->sizesPerSet.assign(sizesPerSet, sizesPerSet + sizeCount);
+    allocator->setsPerPool = firstSetsPerPool;
+    allocator->maxSetsPerPool = 4096;
+    allocator->slotPools.assign(frameSlotCount, std::vector<DescriptorPool>());
+    allocator->freePools.clear();
+    allocator->currentSlot = 0;
+    allocator->poolCount = 0;
+    allocator->setsAllocated = 0;
+}
+
+DescriptorPool createDescriptorPool(DescriptorAllocator* allocator)
+{
+    std::vector<VkDescriptorPoolSize> sizes = allocator->sizesPerSet;
+    for (size_t i = 0; i < sizes.size(); i++)
+        sizes[i].descriptorCount *= allocator->setsPerPool;
+
+    // no VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT, sets are only released by resetting the whole pool
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.maxSets = allocator->setsPerPool;
+    poolInfo.poolSizeCount = (uint32_t)sizes.size();
+    poolInfo.pPoolSizes = sizes.data();
+
+    DescriptorPool pool;
+    pool.maxSets = allocator->setsPerPool;
+    pool.setsAllocated = 0;
+    assert(vkCreateDescriptorPool(allocator->device, &poolInfo, nullptr, &pool.pool) == VK_SUCCESS);
+
+    allocator->poolCount++;
+    allocator->setsPerPool = std::min(allocator->setsPerPool * 2, allocator->maxSetsPerPool);
+    return pool;
+}
+
+// call after waiting for frame slot fence, every set the slot allocated last time becomes invalid
+void descriptorAllocatorBeginFrame(DescriptorAllocator* allocator, uint32_t frameSlot)
+{
+    std::vector<DescriptorPool>& pools = allocator->slotPools[frameSlot];
+
+    for (size_t i = 0; i < pools.size(); i++)
+    {
+        vkResetDescriptorPool(allocator->device, pools[i].pool, 0);
+        pools[i].setsAllocated = 0;
+        allocator->freePools.push_back(pools[i]);
+    }
+
+    pools.clear();
+    allocator->currentSlot = frameSlot;
+}
+
+VkDescriptorSet allocateDescriptorSet(DescriptorAllocator* allocator, VkDescriptorSetLayout layout)
+{
+    std::vector<DescriptorPool>& pools = allocator->slotPools[allocator->currentSlot];
+
+    VkDescriptorSetAllocateInfo setInfo = {};
+    setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    setInfo.descriptorSetCount = 1;
+    setInfo.pSetLayouts = &layout;
+
+    VkDescriptorSet set = VK_NULL_HANDLE;
+
+    // every set fits in sizesPerSet so counting sets is enough, pool is full before vulkan would fail
+    if (!pools.empty() && pools.back().setsAllocated < pools.back().maxSets)
+    {
+        setInfo.descriptorPool = pools.back().pool;
+        VkResult result = vkAllocateDescriptorSets(allocator->device, &setInfo, &set);
+
+        if (result == VK_SUCCESS)
+        {
+            pools.back().setsAllocated++;
+            allocator->setsAllocated++;
+            return set;
+        }
+
+        // shouldnt happen with the count above, but maintenance1 drivers can still report fragmentation
+        assert(result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL);
+    }
+
+    // current pool is full (or there is none yet), take reset one or create bigger one
+    if (!allocator->freePools.empty())
+    {
+        pools.push_back(allocator->freePools.back());
+        allocator->freePools.pop_back();
+    }
+    else
+    {
+        pools.push_back(createDescriptorPool(allocator));
+    }
+
+    setInfo.descriptorPool = pools.back().pool;
+    VkResult result = vkAllocateDescriptorSets(allocator->device, &setInfo, &set);
+    assert(result == VK_SUCCESS);
+    pools.back().setsAllocated++;
+    allocator->setsAllocated++;
+
+    return set;
+}
+
+void destroyDescriptorAllocator(DescriptorAllocator* allocator)
+{
+    for (size_t i = 0; i < allocator->slotPools.size(); i++)
+    {
+        for (size_t k = 0; k < allocator->slotPools[i].size(); k++)
+            vkDestroyDescriptorPool(allocator->device, allocator->slotPools[i][k].pool, nullptr);
+        allocator->slotPools[i].clear();
+    }
+
+    for (size_t i = 0; i < allocator->freePools.size(); i++)
+        vkDestroyDescriptorPool(allocator->device, allocator->freePools[i].pool, nullptr);
+    allocator->freePools.clear();
+}
+
+// sets are looked up by hash of layout and bindings, whole key is compared so collisions dont return wrong set
+// sets point to views and buffers directly, clear the cache before destroying anything that is in it
+struct CachedDescriptorSet
+{
+    VkDescriptorSetLayout layout;
+    std::vector<DescriptorBinding> bindings;
+    VkDescriptorSet set;
+};
+
+struct DescriptorSetCache
+{
+    DescriptorAllocator pools;
+    std::unordered_map<uint64_t, std::vector<CachedDescriptorSet>> sets;
+    uint64_t hits;
+    uint64_t misses;
+};
+
+void createDescriptorSetCache(VkDevice device, const VkDescriptorPoolSize* sizesPerSet, uint32_t sizeCount, DescriptorSetCache* cache)
+{
+    // one slot that is never reset, sets live until the cache is cleared
+    createDescriptorAllocator(device, sizesPerSet, sizeCount, 16, 1, &cache->pools);
+    cache->sets.clear();
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+// FNV-1a
+uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+    const byte* bytes = (const byte*)data;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// field by field so padding in the structs doesnt matter
+uint64_t hashDescriptorBindings(VkDescriptorSetLayout layout, const DescriptorBinding* bindings, uint32_t bindingCount)
+{
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashBytes(hash, &layout, sizeof(layout));
+
+    for (uint32_t i = 0; i < bindingCount; i++)
+    {
+        const DescriptorBinding& b = bindings[i];
+        hash = hashBytes(hash, &b.binding, sizeof(b.binding));
+        hash = hashBytes(hash, &b.type, sizeof(b.type));
+
+        if (isImageDescriptor(b.type))
+        {
+            hash = hashBytes(hash, &b.image.sampler, sizeof(b.image.sampler));
+            hash = hashBytes(hash, &b.image.imageView, sizeof(b.image.imageView));
+            hash = hashBytes(hash, &b.image.imageLayout, sizeof(b.image.imageLayout));
+        }
+        else
+        {
+            hash = hashBytes(hash, &b.buffer.buffer, sizeof(b.buffer.buffer));
+            hash = hashBytes(hash, &b.buffer.offset, sizeof(b.buffer.offset));
+            hash = hashBytes(hash, &b.buffer.range, sizeof(b.buffer.range));
+        }
+    }
+
+    return hash;
+}
+
+bool sameDescriptorBinding(const DescriptorBinding& a, const DescriptorBinding& b)
+{
+    if (a.binding != b.binding || a.type != b.type)
+        return false;
+
+    if (isImageDescriptor(a.type))
+        return a.image.sampler == b.image.sampler && a.image.imageView == b.image.imageView && a.image.imageLayout == b.image.imageLayout;
+
+    return a.buffer.buffer == b.buffer.buffer && a.buffer.offset == b.buffer.offset && a.buffer.range == b.buffer.range;
+}
+
+// existing set with exactly these bindings, or new one that is written once
+VkDescriptorSet getCachedDescriptorSet(DescriptorSetCache* cache, VkDescriptorSetLayout layout, const DescriptorBinding* bindings,
+    uint32_t bindingCount)
+{
+    uint64_t hash = hashDescriptorBindings(layout, bindings, bindingCount);
+    std::vector<CachedDescriptorSet>& candidates = cache->sets[hash];
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        const CachedDescriptorSet& cached = candidates[i];
+        if (cached.layout != layout || cached.bindings.size() != bindingCount)
+            continue;
+
+        bool same = true;
+        for (uint32_t k = 0; k < bindingCount && same; k++)
+            same = sameDescriptorBinding(cached.bindings[k], bindings[k]);
+
+        if (same)
+        {
+            cache->hits++;
+            return cached.set;
+        }
+    }
+
+    CachedDescriptorSet cached;
+    cached.layout = layout;
+    cached.bindings.assign(bindings, bindings + bindingCount);
+    cached.set = allocateDescriptorSet(&cache->pools, layout);
+    writeDescriptorSet(cache->pools.device, cached.set, bindings, bindingCount);
+    candidates.push_back(cached);
+    cache->misses++;
+
+    return cached.set;
+}
+
+// every cached set becomes invalid, gpu must not use them anymore
+void clearDescriptorSetCache(DescriptorSetCache* cache)
+{
+    descriptorAllocatorBeginFrame(&cache->pools, 0);
+    cache->sets.clear();
+}
+
+void destroyDescriptorSetCache(DescriptorSetCache* cache)
+{
+    destroyDescriptorAllocator(&cache->pools);
+    cache->sets.clear();
+}
+
+/**************************************************************************
+Draw parameters
+Purpose: small per draw data (quad transform, sprite camera) goes to vertex shader as push constants when it fits
+push constants are recorded into command buffer, new values for a draw need no memory write and no descriptor change
+otherwise (too big or --no-push-constants) data goes to uniform ring and is selected with dynamic offset of binding 0
+shaders are compiled twice, *_push.spv variants read push_constant block instead of uniform buffer
+*/
+// uniform / push_constant block of glsl.vert and sprite.vert
+struct Transform
+{
+    float scale, x, y;
+};
+
+// pipeline layout and where its per draw params go
+struct DrawLayout
+{
+    VkPipelineLayout pipelineLayout;
+    bool pushConstants;
+    uint32_t paramsSize;
+    VkShaderStageFlags paramsStages;
+};
+
+// spec guarantees at least 128 bytes, most devices have 256
+bool drawParamsFitPushConstants(uint32_t paramsSize, const VkPhysicalDeviceLimits& limits)
+{
+    return paramsSize <= limits.maxPushConstantsSize && paramsSize % 4 == 0;
+}
+
+// push constant range is added only when params are pushed
+void createDrawLayout(VkDevice device, const VkDescriptorSetLayout* setLayouts, uint32_t setLayoutCount, uint32_t paramsSize,
+    VkShaderStageFlags paramsStages, bool pushConstants, DrawLayout* layout)
+{
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = paramsStages;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = paramsSize;
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = setLayoutCount;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = pushConstants ? 1 : 0;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    assert(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &layout->pipelineLayout) == VK_SUCCESS);
+
+    layout->pushConstants = pushConstants;
+    layout->paramsSize = paramsSize;
+    layout->paramsStages = paramsStages;
+}
+
+// params of one draw, data is pushed or dynamicOffset selects its copy in uniform ring
+struct DrawParams
+{
+    const void* data;
+    uint32_t dynamicOffset;
+};
+
+// copies data to ring only when layout doesnt push it
+// with push constants data is read when commands are recorded so it must stay valid until then
+DrawParams writeDrawParams(const DrawLayout& layout, RingBuffer* ring, const void* data)
+{
+    DrawParams params = {};
+    params.data = data;
+
+    if (!layout.pushConstants)
+    {
+        VkDeviceSize offset = 0;
+        void* memory = ringBufferAlloc(ring, layout.paramsSize, &offset);
+        assert(memory != nullptr);
+        memcpy(memory, data, layout.paramsSize);
+        params.dynamicOffset = (uint32_t)offset;
+    }
+
+    return params;
+}
+
+// set 0 has dynamic uniform buffer at binding 0 either way, with push constants its offset is 0 and shader doesnt read it
+void bindDrawParams(VkCommandBuffer command, const DrawLayout& layout, VkDescriptorSet descriptorSet, const DrawParams& params)
+{
+    vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS, layout.pipelineLayout, 0, 1, &descriptorSet, 1, &params.dynamicOffset);
+
+    if (layout.pushConstants)
+        vkCmdPushConstants(command, layout.pipelineLayout, layout.paramsStages, 0, layout.paramsSize, params.data);
+}
+
+/**************************************************************************
+Sprite batcher
+Purpose: draws many textured quads with few draw calls
+every sprite is one instance of the quad from vertex buffer, per instance data is streamed to a ring buffer
+that is bound as second vertex binding (VK_VERTEX_INPUT_RATE_INSTANCE)
+consecutive sprites with the same pipeline and descriptor set are drawn by one vkCmdDrawIndexed
+*/
+struct SpriteInstance
+{
+    float x, y;
+    float scaleX, scaleY;
+    // texture rectangle, u0 v0 is top left
+    float u0, v0, u1, v1;
+    // RGBA, 8 bits per channel (VK_FORMAT_R8G8B8A8_UNORM)
+    uint32_t color;
+    // atlas page (array layer)
+    float layer;
+};
+
+// in SpriteInstance order, color is vec4 in 0..1 range for shader
+const VertexAttribute spriteInstanceAttributes[] = {
+    { 3, VK_FORMAT_R32G32_SFLOAT },
+    { 4, VK_FORMAT_R32G32_SFLOAT },
+    { 5, VK_FORMAT_R32G32B32A32_SFLOAT },
+    { 6, VK_FORMAT_R8G8B8A8_UNORM },
+    { 7, VK_FORMAT_R32_SFLOAT },
+};
+
+struct SpriteBatch
+{
+    VkPipeline pipeline;
+    VkDescriptorSet descriptorSet;
+    uint32_t firstInstance;
+    uint32_t instanceCount;
+};
+
+struct SpriteBatcher
+{
+    RingBuffer instanceRing;
+    // this frame's part of the ring, sprites are written straight to mapped memory
+    SpriteInstance* instances;
+    VkDeviceSize instanceOffset;
+    uint32_t capacity;
+    uint32_t count;
+    std::vector<SpriteBatch> batches;
+};
+
+void createSpriteBatcher(uint32_t maxSpritesPerFrame, uint32_t frameSlotCount, DeviceAllocator* allocator, SpriteBatcher* batcher)
+{
+    // every frame in flight has room for all sprites
+    createRingBuffer((VkDeviceSize)maxSpritesPerFrame * sizeof(SpriteInstance) * frameSlotCount, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        16, frameSlotCount, allocator, &batcher->instanceRing);
+
+    batcher->instances = nullptr;
+    batcher->instanceOffset = 0;
+    batcher->capacity = maxSpritesPerFrame;
+    batcher->count = 0;
+}
+
+// call after waiting for frame slot fence
+void spriteBatcherBeginFrame(SpriteBatcher* batcher, uint32_t frameSlot)
+{
+    ringBufferBeginFrame(&batcher->instanceRing, frameSlot);
+
+    batcher->instances = (SpriteInstance*)ringBufferAlloc(&batcher->instanceRing,
+        (VkDeviceSize)batcher->capacity * sizeof(SpriteInstance), &batcher->instanceOffset);
+    assert(batcher->instances != nullptr);
+
+    batcher->count = 0;
+    batcher->batches.clear();
+}
+
+// returns false if batcher is full for this frame
+bool drawSprite(SpriteBatcher* batcher, VkPipeline pipeline, VkDescriptorSet descriptorSet, const SpriteInstance& sprite)
+{
+    if (batcher->count == batcher->capacity)
+        return false;
+
+    // memory is write combined, write it once and never read it
+    batcher->instances[batcher->count] = sprite;
+
+    if (batcher->batches.empty() || batcher->batches.back().pipeline != pipeline || batcher->batches.back().descriptorSet != descriptorSet)
+    {
+        SpriteBatch batch = {};
+        batch.pipeline = pipeline;
+        batch.descriptorSet = descriptorSet;
+        batch.firstInstance = batcher->count;
+        batcher->batches.push_back(batch);
+    }
+
+    batcher->batches.back().instanceCount++;
+    batcher->count++;
+
+    return true;
+}
+
+// one instanced draw per batch, must be called inside render pass
+// quad is the indexed 4 vertex mesh, params (camera) are the same for all batches
+void recordSpriteBatches(SpriteBatcher* batcher, VkCommandBuffer command, const DrawLayout& layout,
+    const Mesh& quad, const DrawParams& params)
+{
+    if (batcher->batches.empty())
+        return;
+
+    bindMesh(command, quad);
+    vkCmdBindVertexBuffers(command, 1, 1, &batcher->instanceRing.buffer, &batcher->instanceOffset);
+
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    VkDescriptorSet boundSet = VK_NULL_HANDLE;
+
+    for (size_t i = 0; i < batcher->batches.size(); i++)
+    {
+        const SpriteBatch& batch = batcher->batches[i];
+
+        if (batch.pipeline != boundPipeline)
+        {
+            vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, batch.pipeline);
+            boundPipeline = batch.pipeline;
+        }
+
+        if (batch.descriptorSet != boundSet)
+        {
+            bindDrawParams(command, layout, batch.descriptorSet, params);
+            boundSet = batch.descriptorSet;
+        }
+
+        drawMesh(command, quad, batch.instanceCount, batch.firstInstance);
+    }
+}
+
+void destroySpriteBatcher(DeviceAllocator* allocator, SpriteBatcher* batcher)
+{
+    destroyRingBuffer(allocator, &batcher->instanceRing);
+}
+
+// reserves count instances in one batch so other threads can fill them, main thread only
+// returns where instance firstInstance goes, nullptr if batcher is full
+SpriteInstance* reserveSprites(SpriteBatcher* batcher, VkPipeline pipeline, VkDescriptorSet descriptorSet, uint32_t count,
+    uint32_t* firstInstance)
+{
+    if (batcher->count + count > batcher->capacity)
+        return nullptr;
+
+    SpriteBatch batch = {};
+    batch.pipeline = pipeline;
+    batch.descriptorSet = descriptorSet;
+    batch.firstInstance = batcher->count;
+    batch.instanceCount = count;
+    batcher->batches.push_back(batch);
+
+    *firstInstance = batcher->count;
+    batcher->count += count;
+
+    return batcher->instances + *firstInstance;
+}
+
+// draws part of reserved instances, binds everything because secondary command buffers dont inherit state
+// safe to call from many threads with different command buffers
+void recordSpriteInstances(const SpriteBatcher* batcher, VkCommandBuffer command, VkPipeline pipeline, VkDescriptorSet descriptorSet,
+    const DrawLayout& layout, const Mesh& quad, const DrawParams& params, uint32_t firstInstance, uint32_t instanceCount)
+{
+    if (instanceCount == 0)
+        return;
+
+    bindMesh(command, quad);
+    vkCmdBindVertexBuffers(command, 1, 1, &batcher->instanceRing.buffer, &batcher->instanceOffset);
+    vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    bindDrawParams(command, layout, descriptorSet, params);
+    drawMesh(command, quad, instanceCount, firstInstance);
+}
+
+/**************************************************************************
+GPU culling
+Purpose: sprites are culled and drawn without cpu touching them every frame
+every sprite lives in a device local storage buffer (written once), compute shader tests them against the view
+and appends visible ones to this frame's instance buffer, instance count goes to VkDrawIndexedIndirectCommand
+cpu records the same dispatch and one vkCmdDrawIndexedIndirect no matter how many sprites there are
+and sprites outside of the view never reach vertex shader
+*/
+// matches CullParams in cull.comp, comes from uniform ring every frame
+struct CullParams
+{
+    float scale, x, y;
+    uint32_t objectCount;
+};
+
+struct GpuCuller
+{
+    VkDevice device;
+    VkDescriptorSetLayout setLayout;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+    DescriptorAllocator descriptors;
+    VkDescriptorSet descriptorSet;
+    uint32_t objectCount;
+    // all sprites, filled by upload manager
+    VkBuffer objectBuffer;
+    MemoryAllocation objectMemory;
+    // visible sprites, one region per frame slot, storage buffer for compute and instance vertex buffer for draw
+    VkBuffer visibleBuffer;
+    MemoryAllocation visibleMemory;
+    VkDeviceSize visibleSlotSize;
+    // one VkDrawIndexedIndirectCommand per frame slot
+    VkBuffer indirectBuffer;
+    MemoryAllocation indirectMemory;
+    VkDeviceSize indirectSlotSize;
+    // instance count of every frame slot copied back for stats
+    VkBuffer countBuffer;
+    MemoryAllocation countMemory;
+};
+
+// uniformBuffer is where CullParams are allocated, its offset is given when culling is recorded
+void createGpuCuller(VkDevice device, VkShaderModule cullModule, VkPipelineCache pipelineCache, VkBuffer uniformBuffer,
+    const VkPhysicalDeviceLimits& limits, uint32_t objectCount, uint32_t frameSlotCount, DeviceAllocator* allocator, GpuCuller* culler)
+{
+    culler->device = device;
+    culler->objectCount = objectCount;
+
+    VkDeviceSize objectsSize = (VkDeviceSize)objectCount * sizeof(SpriteInstance);
+    culler->visibleSlotSize = alignUp(objectsSize, limits.minStorageBufferOffsetAlignment);
+    culler->indirectSlotSize = alignUp(sizeof(VkDrawIndexedIndirectCommand), limits.minStorageBufferOffsetAlignment);
+
+    createBuffer(objectsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        allocator, &culler->objectBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &culler->objectMemory);
+    createBuffer(culler->visibleSlotSize * frameSlotCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        allocator, &culler->visibleBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &culler->visibleMemory);
+    // reset with vkCmdUpdateBuffer, read back with vkCmdCopyBuffer
+    createBuffer(culler->indirectSlotSize * frameSlotCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        allocator, &culler->indirectBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &culler->indirectMemory);
+    createBuffer(sizeof(uint32_t) * frameSlotCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT, allocator, &culler->countBuffer,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &culler->countMemory);
+    memset(culler->countMemory.mapped, 0, sizeof(uint32_t) * frameSlotCount);
+
+    // params, objects, visible, draw command, dynamic ones get offset of the frame slot when set is bound
+    VkDescriptorSetLayoutBinding bindings[4] = {};
+    VkDescriptorType types[4] = { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC };
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = types[i];
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+    setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    setLayoutInfo.bindingCount = 4;
+    setLayoutInfo.pBindings = bindings;
+    assert(vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr, &culler->setLayout) == VK_SUCCESS);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &culler->setLayout;
+    assert(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &culler->pipelineLayout) == VK_SUCCESS);
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = cullModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = culler->pipelineLayout;
+    assert(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &culler->pipeline) == VK_SUCCESS);
+
+    VkDescriptorPoolSize sizesPerSet[3] = {};
+    sizesPerSet[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    sizesPerSet[0].descriptorCount = 1;
+    sizesPerSet[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    sizesPerSet[1].descriptorCount = 1;
+    sizesPerSet[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    sizesPerSet[2].descriptorCount = 2;
+
+    // one set that lives until destroy, own allocator because its types dont fit pools of the draw sets
+    createDescriptorAllocator(device, sizesPerSet, 3, 1, 1, &culler->descriptors);
+    culler->descriptorSet = allocateDescriptorSet(&culler->descriptors, culler->setLayout);
+
+    // dynamic ones cover one frame slot, offset 0 here
+    DescriptorBinding setBindings[4] = {
+        bufferDescriptor(0, types[0], uniformBuffer, 0, sizeof(CullParams)),
+        bufferDescriptor(1, types[1], culler->objectBuffer, 0, objectsSize),
+        bufferDescriptor(2, types[2], culler->visibleBuffer, 0, objectsSize),
+        bufferDescriptor(3, types[3], culler->indirectBuffer, 0, sizeof(VkDrawIndexedIndirectCommand))
+    };
+
+    writeDescriptorSet(device, culler->descriptorSet, setBindings, 4);
+}
+
+// sprites that are culled every frame, returns token of the upload
+uint64_t uploadCullObjects(GpuCuller* culler, UploadManager* uploads, const SpriteInstance* sprites)
+{
+    return uploadBuffer(uploads, culler->objectBuffer, 0, sprites, (VkDeviceSize)culler->objectCount * sizeof(SpriteInstance));
+}
+
+// must be called outside of render pass before recordCulledSprites of the same frame slot
+// paramsOffset is CullParams in uniform buffer given to createGpuCuller, quad is the mesh that recordCulledSprites draws
+void recordGpuCulling(GpuCuller* culler, VkCommandBuffer command, const Mesh& quad, uint32_t frameSlot, uint32_t paramsOffset)
+{
+    VkDeviceSize indirectOffset = culler->indirectSlotSize * frameSlot;
+
+    // all indices of the quad, shader counts instances
+    VkDrawIndexedIndirectCommand reset = { quad.indexCount, 0, 0, 0, 0 };
+    vkCmdUpdateBuffer(command, culler->indirectBuffer, indirectOffset, sizeof(reset), &reset);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = culler->indirectBuffer;
+    barrier.offset = indirectOffset;
+    barrier.size = sizeof(reset);
+
+    vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        0, nullptr, 1, &barrier, 0, nullptr);
+
+    // binding order: params, visible, draw command
+    uint32_t dynamicOffsets[] = { paramsOffset, (uint32_t)(culler->visibleSlotSize * frameSlot), (uint32_t)indirectOffset };
+    vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_COMPUTE, culler->pipeline);
+    vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_COMPUTE, culler->pipelineLayout, 0, 1, &culler->descriptorSet, 3, dynamicOffsets);
+    vkCmdDispatch(command, (culler->objectCount + 63) / 64, 1, 1);
+
+    // draw reads command and instances, count readback copies from the command
+    VkBufferMemoryBarrier written[2] = { barrier, barrier };
+    written[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    written[0].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+    written[1].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    written[1].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+    written[1].buffer = culler->visibleBuffer;
+    written[1].offset = culler->visibleSlotSize * frameSlot;
+    written[1].size = culler->visibleSlotSize;
+
+    vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr, 2, written, 0, nullptr);
+}
+
+// one indirect draw of whatever survived culling, must be called inside render pass
+// binds everything so it also works in secondary command buffers
+void recordCulledSprites(const GpuCuller* culler, VkCommandBuffer command, VkPipeline pipeline, VkDescriptorSet descriptorSet,
+    const DrawLayout& layout, const Mesh& quad, const DrawParams& params, uint32_t frameSlot)
+{
+    VkDeviceSize visibleOffset = culler->visibleSlotSize * frameSlot;
+    bindMesh(command, quad);
+    vkCmdBindVertexBuffers(command, 1, 1, &culler->visibleBuffer, &visibleOffset);
+    vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    bindDrawParams(command, layout, descriptorSet, params);
+    vkCmdDrawIndexedIndirect(command, culler->indirectBuffer, culler->indirectSlotSize * frameSlot, 1,
+        sizeof(VkDrawIndexedIndirectCommand));
+}
+
+// copies instance count of the frame slot to host, read it with culledSpriteCount after waiting for slot fence
+// must be called outside of render pass after recordGpuCulling
+void recordCulledCountReadback(GpuCuller* culler, VkCommandBuffer command, uint32_t frameSlot)
+{
+    VkBufferCopy region = {};
+    region.srcOffset = culler->indirectSlotSize * frameSlot + offsetof(VkDrawIndexedIndirectCommand, instanceCount);
+    region.dstOffset = sizeof(uint32_t) * frameSlot;
+    region.size = sizeof(uint32_t);
+    vkCmdCopyBuffer(command, culler->indirectBuffer, culler->countBuffer, 1, &region);
+
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = culler->countBuffer;
+    barrier.offset = region.dstOffset;
+    barrier.size = region.size;
+
+    vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// sprites drawn when frame slot was used last time
+uint32_t culledSpriteCount(const GpuCuller* culler, uint32_t frameSlot)
+{
+    return ((const uint32_t*)culler->countMemory.mapped)[frameSlot];
+}
+
+void destroyGpuCuller(DeviceAllocator* allocator, GpuCuller* culler)
+{
+    vkDestroyPipeline(culler->device, culler->pipeline, nullptr);
+    vkDestroyPipelineLayout(culler->device, culler->pipelineLayout, nullptr);
+    destroyDescriptorAllocator(&culler->descriptors);
+    vkDestroyDescriptorSetLayout(culler->device, culler->setLayout, nullptr);
+    destroyBuffer(allocator, culler->objectBuffer, &culler->objectMemory);
+    destroyBuffer(allocator, culler->visibleBuffer, &culler->visibleMemory);
+    destroyBuffer(allocator, culler->indirectBuffer, &culler->indirectMemory);
+    destroyBuffer(allocator, culler->countBuffer, &culler->countMemory);
+}
+
+/**************************************************************************
+Command recorder
+Purpose: records one render pass worth of draws on worker threads into secondary command buffers
+every worker has own command pool per frame slot (pools are not thread safe and
+pool of a slot can only be reset after gpu is done with it), primary runs them with vkCmdExecuteCommands
+*/
+// task gets its index, how many tasks there are and command buffer that is already begun inside render pass
+typedef std::function<void(uint32_t task, uint32_t taskCount, VkCommandBuffer command)> RecordTask;
+
+struct RecordWorker
+{
+    std::thread thread;
+    // one per frame slot
+    std::vector<VkCommandPool> pools;
+    std::vector<VkCommandBuffer> commands;
+};
+
+struct CommandRecorder
+{
+    VkDevice device;
+    std::vector<RecordWorker> workers;
+
+    std::mutex mutex;
+    // workers wait for new generation, main thread waits for remaining to be 0
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t generation;
+    bool quit;
+
+    // current job, only written by main thread while workers are idle
+    uint32_t taskCount;
+    uint32_t remaining;
+    uint32_t frameSlot;
+    VkCommandBufferInheritanceInfo inheritance;
+    const RecordTask* task;
+};
+
+void recordWorkerMain(CommandRecorder* recorder, uint32_t index)
+{
+    uint64_t seenGeneration = 0;
+    RecordWorker& worker = recorder->workers[index];
+
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(recorder->mutex);
+        recorder->wake.wait(lock, [&] { return recorder->quit || recorder->generation != seenGeneration; });
+
+        if (recorder->quit)
+            return;
+
+        seenGeneration = recorder->generation;
+
+        // more workers than tasks, this one sits out
+        if (index >= recorder->taskCount)
+            continue;
+
+        uint32_t taskCount = recorder->taskCount;
+        uint32_t slot = recorder->frameSlot;
+        VkCommandBufferInheritanceInfo inheritance = recorder->inheritance;
+        const RecordTask* task = recorder->task;
+        lock.unlock();
+
+        // resetting whole pool is cheaper than resetting buffers one by one
+        vkResetCommandPool(recorder->device, worker.pools[slot], 0);
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        beginInfo.pInheritanceInfo = &inheritance;
+
+        VkCommandBuffer command = worker.commands[slot];
+        assert(vkBeginCommandBuffer(command, &beginInfo) == VK_SUCCESS);
+        (*task)(index, taskCount, command);
+        assert(vkEndCommandBuffer(command) == VK_SUCCESS);
+
+        lock.lock();
+        if (--recorder->remaining == 0)
+            recorder->done.notify_one();
+    }
+}
+
+void createCommandRecorder(VkDevice device, uint32_t queueFamilyIndex, uint32_t workerCount, uint32_t frameSlotCount,
+    CommandRecorder* recorder)
+{
+    recorder->device = device;
+    recorder->generation = 0;
+    recorder->quit = false;
+    recorder->taskCount = 0;
+    recorder->remaining = 0;
+    recorder->frameSlot = 0;
+    recorder->inheritance = {};
+    recorder->task = nullptr;
+
+    // all created before any thread starts, vector doesnt move after this
+    recorder->workers.resize(workerCount);
+
+    for (uint32_t i = 0; i < workerCount; i++)
+    {
+        RecordWorker& worker = recorder->workers[i];
+        worker.pools.resize(frameSlotCount);
+        worker.commands.resize(frameSlotCount);
+
+        for (uint32_t j = 0; j < frameSlotCount; j++)
+        {
+            VkCommandPoolCreateInfo poolCreateInfo = {};
+            poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+            // buffers are rerecorded every frame
+            poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            assert(vkCreateCommandPool(device, &poolCreateInfo, nullptr, &worker.pools[j]) == VK_SUCCESS);
+
+            VkCommandBufferAllocateInfo allocInfo = {};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = worker.pools[j];
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+            assert(vkAllocateCommandBuffers(device, &allocInfo, &worker.commands[j]) == VK_SUCCESS);
+        }
+    }
+
+    for (uint32_t i = 0; i < workerCount; i++)
+        recorder->workers[i].thread = std::thread(recordWorkerMain, recorder, i);
+}
+
+// runs task taskCount times in parallel (at most one per worker) and waits for all of them
+// commands gets secondary command buffers in task order, call only after fence of frameSlot was waited for
+void recordSecondaryCommands(CommandRecorder* recorder, uint32_t frameSlot, uint32_t taskCount, VkRenderPass renderPass,
+    VkFramebuffer framebuffer, const RecordTask& task, std::vector<VkCommandBuffer>& commands)
+{
+    assert(taskCount >= 1 && taskCount <= recorder->workers.size());
+
+    {
+        std::lock_guard<std::mutex> lock(recorder->mutex);
+        recorder->taskCount = taskCount;
+        recorder->remaining = taskCount;
+        recorder->frameSlot = frameSlot;
+        recorder->inheritance = {};
+        recorder->inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        recorder->inheritance.renderPass = renderPass;
+        recorder->inheritance.subpass = 0;
+        // optional but lets driver know the attachments
+        recorder->inheritance.framebuffer = framebuffer;
+        recorder->task = &task;
+        recorder->generation++;
+    }
+
+    recorder->wake.notify_all();
+
+    std::unique_lock<std::mutex> lock(recorder->mutex);
+    recorder->done.wait(lock, [&] { return recorder->remaining == 0; });
+
+    commands.resize(taskCount);
+    for (uint32_t i = 0; i < taskCount; i++)
+        commands[i] = recorder->workers[i].commands[frameSlot];
+}
+
+// gpu must be done with all command buffers
+void destroyCommandRecorder(CommandRecorder* recorder)
+{
+    {
+        std::lock_guard<std::mutex> lock(recorder->mutex);
+        recorder->quit = true;
+    }
+
+    recorder->wake.notify_all();
+
+    for (size_t i = 0; i < recorder->workers.size(); i++)
+    {
+        RecordWorker& worker = recorder->workers[i];
+        worker.thread.join();
+
+        // buffers are freed with pool
+        for (size_t j = 0; j < worker.pools.size(); j++)
+            vkDestroyCommandPool(recorder->device, worker.pools[j], nullptr);
+    }
+
+    recorder->workers.clear();
+}
+
+/**************************************************************************
+Render graph
+Purpose: passes say which images they read and write and graph places barriers between them
+passes run in the order they were added, compile drops passes whose results are never used,
+puts all barriers before a pass into one vkCmdPipelineBarrier and places transient images
+that are never alive at the same time at the same memory (aliasing)
+graph is built and compiled once, every frame only imported images and record functions change
+only color images are tracked, whole image (all levels and layers) is one resource
+*/
+typedef std::function<void(VkCommandBuffer command)> GraphPassRecord;
+
+// what pass does with an image, layout it has to be in and stages/accesses that touch it
+struct GraphImageAccess
+{
+    uint32_t image;
+    VkImageLayout layout;
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    bool read;
+    bool write;
+};
+
+struct GraphImage
+{
+    const char* name;
+    // imported images are set with setGraphImage, transient ones are created by compile
+    VkImage image;
+    bool transient;
+    VkImageCreateInfo createInfo;
+    VkMemoryRequirements memRequirements;
+    uint32_t memorySlot;
+
+    // state of imported image when graph starts and state output has to be left in
+    VkImageLayout initialLayout;
+    VkPipelineStageFlags initialStage;
+    VkAccessFlags initialAccess;
+    bool output;
+    VkImageLayout finalLayout;
+    VkPipelineStageFlags finalStage;
+    VkAccessFlags finalAccess;
+
+    // filled by compile, passes that are not culled
+    bool used;
+    uint32_t firstPass;
+    uint32_t lastPass;
+    // state while barriers are placed, write is the last write or layout transition
+    VkImageLayout layout;
+    VkPipelineStageFlags writeStage;
+    VkAccessFlags writeAccess;
+    VkPipelineStageFlags readStages;
+    // stages and accesses that already see the last write
+    VkPipelineStageFlags visibleStages;
+    VkAccessFlags visibleAccess;
+};
+
+struct GraphPass
+{
+    const char* name;
+    GraphPassRecord record;
+    std::vector<GraphImageAccess> accesses;
+    // pass does something outside of the graph (copy to host buffer etc.), never culled
+    bool sideEffects;
+    bool culled;
+    // merged barrier before the pass, images are filled in when graph runs
+    VkPipelineStageFlags srcStage;
+    VkPipelineStageFlags dstStage;
+    std::vector<VkImageMemoryBarrier> barriers;
+    std::vector<uint32_t> barrierImages;
+};
+
+// one allocation shared by transient images whose lifetimes dont overlap
+struct GraphMemorySlot
+{
+    MemoryAllocation memory;
+    VkMemoryRequirements memRequirements;
+    std::vector<uint32_t> images;
+};
+
+struct RenderGraph
+{
+    DeviceAllocator* allocator;
+    std::vector<GraphImage> images;
+    std::vector<GraphPass> passes;
+    std::vector<GraphMemorySlot> memorySlots;
+    // outputs go to their final state after the last pass
+    GraphPass end;
+    bool compiled;
+
+    uint32_t culledPassCount;
+    uint32_t barrierBatchCount;
+    uint32_t barrierCount;
+    // all transient images one after another and what was actually allocated
+    VkDeviceSize transientBytes;
+    VkDeviceSize aliasedBytes;
+};
+
+void createRenderGraph(DeviceAllocator* allocator, RenderGraph* graph)
+{
+    graph->allocator = allocator;
+    graph->images.clear();
+    graph->passes.clear();
+    graph->memorySlots.clear();
+    graph->end = {};
+    graph->end.name = "end";
+    graph->compiled = false;
+    graph->culledPassCount = 0;
+    graph->barrierBatchCount = 0;
+    graph->barrierCount = 0;
+    graph->transientBytes = 0;
+    graph->aliasedBytes = 0;
+}
+
+uint32_t addGraphImage(RenderGraph* graph, const char* name, bool transient)
+{
+    GraphImage image = {};
+    image.name = name;
+    image.image = VK_NULL_HANDLE;
+    image.transient = transient;
+    image.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    image.initialStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    graph->images.push_back(image);
+    graph->compiled = false;
+    return (uint32_t)graph->images.size() - 1;
+}
+
+// created by compile only if some pass that is not culled uses it, contents are undefined before first write
+uint32_t addGraphTransientImage(RenderGraph* graph, const char* name, const VkImageCreateInfo& createInfo)
+{
+    uint32_t index = addGraphImage(graph, name, true);
+    graph->images[index].createInfo = createInfo;
+    return index;
+}
+
+// image that lives outside of the graph (swapchain, textures), initialStage is what first barrier waits for
+// (for swapchain image it's the stage that waits for acquire semaphore)
+uint32_t importGraphImage(RenderGraph* graph, const char* name, VkImageLayout initialLayout, VkPipelineStageFlags initialStage,
+    VkAccessFlags initialAccess)
+{
+    uint32_t index = addGraphImage(graph, name, false);
+    graph->images[index].initialLayout = initialLayout;
+    graph->images[index].initialStage = initialStage;
+    graph->images[index].initialAccess = initialAccess;
+    return index;
+}
+
+// image can change every frame (swapchain image index), barriers dont depend on the handle
+void setGraphImage(RenderGraph* graph, uint32_t image, VkImage handle)
+{
+    assert(!graph->images[image].transient);
+    graph->images[image].image = handle;
+}
+
+// contents are used after the graph, passes writing it are kept and it's left in final layout
+void setGraphOutput(RenderGraph* graph, uint32_t image, VkImageLayout finalLayout, VkPipelineStageFlags finalStage, VkAccessFlags finalAccess)
+{
+    GraphImage& graphImage = graph->images[image];
+    graphImage.output = true;
+    graphImage.finalLayout = finalLayout;
+    graphImage.finalStage = finalStage;
+    graphImage.finalAccess = finalAccess;
+    graph->compiled = false;
+}
+
+uint32_t addGraphPass(RenderGraph* graph, const char* name, bool sideEffects)
+{
+    GraphPass pass = {};
+    pass.name = name;
+    pass.sideEffects = sideEffects;
+    graph->passes.push_back(pass);
+    graph->compiled = false;
+    return (uint32_t)graph->passes.size() - 1;
+}
+
+// read and write of the same image in one pass is one access, it must be in one layout
+void addGraphAccess(RenderGraph* graph, uint32_t pass, uint32_t image, VkImageLayout layout, VkPipelineStageFlags stage,
+    VkAccessFlags access, bool read, bool write)
+{
+    std::vector<GraphImageAccess>& accesses = graph->passes[pass].accesses;
+    graph->compiled = false;
+
+    for (size_t i = 0; i < accesses.size(); i++)
+    {
+        if (accesses[i].image != image)
+            continue;
+
+        assert(accesses[i].layout == layout);
+        accesses[i].stage |= stage;
+        accesses[i].access |= access;
+        accesses[i].read |= read;
+        accesses[i].write |= write;
+        return;
+    }
+
+    GraphImageAccess graphAccess = { image, layout, stage, access, read, write };
+    accesses.push_back(graphAccess);
+}
+
+void graphPassRead(RenderGraph* graph, uint32_t pass, uint32_t image, VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access)
+{
+    addGraphAccess(graph, pass, image, layout, stage, access, true, false);
+}
+
+// write without read means whole image is replaced, earlier writes are not needed
+void graphPassWrite(RenderGraph* graph, uint32_t pass, uint32_t image, VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access)
+{
+    addGraphAccess(graph, pass, image, layout, stage, access, false, true);
+}
+
+// record function usually captures per frame state so it's set every frame
+void setGraphPassRecord(RenderGraph* graph, uint32_t pass, const GraphPassRecord& record)
+{
+    graph->passes[pass].record = record;
+}
+
+void releaseGraphTransients(RenderGraph* graph)
+{
+    for (size_t i = 0; i < graph->images.size(); i++)
+    {
+        GraphImage& image = graph->images[i];
+        if (image.transient && image.image != VK_NULL_HANDLE)
+        {
+            vkDestroyImage(graph->allocator->device, image.image, nullptr);
+            image.image = VK_NULL_HANDLE;
+        }
+    }
+
+    for (size_t i = 0; i < graph->memorySlots.size(); i++)
+        freeDeviceMemory(graph->allocator, &graph->memorySlots[i].memory);
+
+    graph->memorySlots.clear();
+}
+
+void addGraphBarrier(GraphPass* pass, uint32_t image, VkImageLayout oldLayout, VkImageLayout newLayout,
+    VkPipelineStageFlags srcStage, VkAccessFlags srcAccess, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess)
+{
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcAccessMask = srcAccess;
+    barrier.dstAccessMask = dstAccess;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+    pass->srcStage |= srcStage;
+    pass->dstStage |= dstStage;
+    pass->barriers.push_back(barrier);
+    pass->barrierImages.push_back(image);
+}
+
+// barrier needed before access, if any, and image state after it
+void placeGraphBarrier(RenderGraph* graph, GraphPass* pass, uint32_t imageIndex, const GraphImageAccess& access)
+{
+    GraphImage& image = graph->images[imageIndex];
+    bool layoutChange = image.layout != access.layout;
+
+    if (access.write || layoutChange)
+    {
+        // write after write and write after read, layout transition is a write too
+        VkPipelineStageFlags srcStage = image.writeStage | image.readStages;
+        if (srcStage == 0)
+            srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+
+        addGraphBarrier(pass, imageIndex, image.layout, access.layout, srcStage, image.writeAccess, access.stage, access.access);
+
+        image.layout = access.layout;
+        image.writeStage = access.stage;
+        // transition is made visible by the barrier, write of the pass itself is not
+        image.writeAccess = access.write ? access.access : 0;
+        image.readStages = 0;
+        image.visibleStages = access.write ? 0 : access.stage;
+        image.visibleAccess = access.write ? 0 : access.access;
+
+        if (access.write)
+            return;
+    }
+    else if ((access.stage & ~image.visibleStages) != 0 || (access.access & ~image.visibleAccess) != 0)
+    {
+        // read after write, reads that already see the write dont need another barrier
+        addGraphBarrier(pass, imageIndex, image.layout, image.layout, image.writeStage, image.writeAccess, access.stage, access.access);
+        image.visibleStages |= access.stage;
+        image.visibleAccess |= access.access;
+    }
+
+    image.readStages |= access.stage;
+}
+
+// creates transient images and memory, device must be idle if graph was compiled before
+void compileRenderGraph(RenderGraph* graph)
+{
+    VkDevice device = graph->allocator->device;
+    releaseGraphTransients(graph);
+
+    uint32_t passCount = (uint32_t)graph->passes.size();
+    std::vector<GraphImage>& images = graph->images;
+
+    // from the last pass to the first, pass is needed if it writes something that later needed pass reads
+    std::vector<bool> needed(images.size(), false);
+    for (size_t i = 0; i < images.size(); i++)
+        needed[i] = images[i].output;
+
+    graph->culledPassCount = 0;
+
+    for (uint32_t p = passCount; p-- > 0;)
+    {
+        GraphPass& pass = graph->passes[p];
+        pass.culled = !pass.sideEffects;
+
+        for (size_t i = 0; i < pass.accesses.size() && pass.culled; i++)
+            pass.culled = !(pass.accesses[i].write && needed[pass.accesses[i].image]);
+
+        if (pass.culled)
+        {
+            graph->culledPassCount++;
+            continue;
+        }
+
+        for (size_t i = 0; i < pass.accesses.size(); i++)
+        {
+            if (pass.accesses[i].write && !pass.accesses[i].read)
+                needed[pass.accesses[i].image] = false;
+        }
+
+        for (size_t i = 0; i < pass.accesses.size(); i++)
+        {
+            if (pass.accesses[i].read)
+                needed[pass.accesses[i].image] = true;
+        }
+    }
+
+    // lifetimes, in pass indices
+    for (size_t i = 0; i < images.size(); i++)
+        images[i].used = false;
+
+    for (uint32_t p = 0; p < passCount; p++)
+    {
+        if (graph->passes[p].culled)
+            continue;
+
+        for (size_t i = 0; i < graph->passes[p].accesses.size(); i++)
+        {
+            GraphImage& image = images[graph->passes[p].accesses[i].image];
+            if (!image.used)
+                image.firstPass = p;
+            image.used = true;
+            image.lastPass = p;
+        }
+    }
+
+    // transient images, biggest first so small ones fit into slots of big ones, stable so slots are the same every run
+    std::vector<uint32_t> transients;
+    graph->transientBytes = 0;
+
+    for (uint32_t i = 0; i < images.size(); i++)
+    {
+        if (!images[i].transient || !images[i].used)
+            continue;
+
+        assert(vkCreateImage(device, &images[i].createInfo, nullptr, &images[i].image) == VK_SUCCESS);
+        vkGetImageMemoryRequirements(device, images[i].image, &images[i].memRequirements);
+        graph->transientBytes += images[i].memRequirements.size;
+        transients.push_back(i);
+    }
+
+    std::stable_sort(transients.begin(), transients.end(), [&](uint32_t a, uint32_t b)
+        { return images[a].memRequirements.size > images[b].memRequirements.size; });
+
+    for (size_t t = 0; t < transients.size(); t++)
+    {
+        GraphImage& image = images[transients[t]];
+        uint32_t slotIndex = (uint32_t)graph->memorySlots.size();
+
+        for (uint32_t s = 0; s < graph->memorySlots.size() && slotIndex == graph->memorySlots.size(); s++)
+        {
+            const GraphMemorySlot& slot = graph->memorySlots[s];
+            if ((slot.memRequirements.memoryTypeBits & image.memRequirements.memoryTypeBits) == 0)
+                continue;
+
+            bool overlaps = false;
+            for (size_t k = 0; k < slot.images.size() && !overlaps; k++)
+            {
+                const GraphImage& other = images[slot.images[k]];
+                overlaps = image.firstPass <= other.lastPass && other.firstPass <= image.lastPass;
+            }
+
+            if (!overlaps)
+                slotIndex = s;
+        }
+
+        if (slotIndex == graph->memorySlots.size())
+        {
+            GraphMemorySlot slot = {};
+            slot.memRequirements = image.memRequirements;
+            graph->memorySlots.push_back(slot);
+        }
+
+        GraphMemorySlot& slot = graph->memorySlots[slotIndex];
+        slot.memRequirements.size = std::max(slot.memRequirements.size, image.memRequirements.size);
+        slot.memRequirements.alignment = std::max(slot.memRequirements.alignment, image.memRequirements.alignment);
+        slot.memRequirements.memoryTypeBits &= image.memRequirements.memoryTypeBits;
+        slot.images.push_back(transients[t]);
+        image.memorySlot = slotIndex;
+    }
+
+    graph->aliasedBytes = 0;
+
+    for (size_t s = 0; s < graph->memorySlots.size(); s++)
+    {
+        GraphMemorySlot& slot = graph->memorySlots[s];
+        bool allocated = allocateDeviceMemory(graph->allocator, slot.memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, &slot.memory);
+        assert(allocated);
+        graph->aliasedBytes += slot.memRequirements.size;
+
+        for (size_t k = 0; k < slot.images.size(); k++)
+            vkBindImageMemory(device, images[slot.images[k]].image, slot.memory.memory, slot.memory.offset);
+    }
+
+    // barriers, image states are walked through passes in order
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        GraphImage& image = images[i];
+        image.layout = image.transient ? VK_IMAGE_LAYOUT_UNDEFINED : image.initialLayout;
+        image.writeStage = image.transient ? 0 : image.initialStage;
+        image.writeAccess = image.transient ? 0 : image.initialAccess;
+        image.readStages = 0;
+        image.visibleStages = 0;
+        image.visibleAccess = 0;
+    }
+
+    // transient image starts where previous image in its slot stopped
+    // first one in a slot waits for the last one (of previous frame) so it doesnt overwrite memory that is still read,
+    // state of the last one is known only after all passes so these barriers are patched at the end
+    struct SlotFirstBarrier
+    {
+        uint32_t pass;
+        uint32_t barrier;
+        uint32_t slot;
+    };
+
+    std::vector<int> slotOwner(graph->memorySlots.size(), -1);
+    std::vector<SlotFirstBarrier> slotFirstBarriers;
+
+    graph->barrierBatchCount = 0;
+    graph->barrierCount = 0;
+
+    for (uint32_t p = 0; p < passCount; p++)
+    {
+        GraphPass& pass = graph->passes[p];
+        pass.srcStage = 0;
+        pass.dstStage = 0;
+        pass.barriers.clear();
+        pass.barrierImages.clear();
+
+        if (pass.culled)
+            continue;
+
+        for (size_t i = 0; i < pass.accesses.size(); i++)
+        {
+            uint32_t index = pass.accesses[i].image;
+            GraphImage& image = images[index];
+
+            if (image.transient && image.firstPass == p)
+            {
+                int previous = slotOwner[image.memorySlot];
+                if (previous >= 0)
+                {
+                    // previous owner of the memory is done by now, its state is where this image starts
+                    image.writeStage = images[previous].writeStage | images[previous].readStages;
+                    image.writeAccess = images[previous].writeAccess;
+                }
+                else
+                {
+                    SlotFirstBarrier first = { p, (uint32_t)pass.barriers.size(), image.memorySlot };
+                    slotFirstBarriers.push_back(first);
+                }
+
+                // contents are not kept, UNDEFINED lets driver skip them
+                image.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                slotOwner[image.memorySlot] = (int)index;
+            }
+
+            placeGraphBarrier(graph, &pass, index, pass.accesses[i]);
+        }
+
+        if (!pass.barriers.empty())
+        {
+            graph->barrierBatchCount++;
+            graph->barrierCount += (uint32_t)pass.barriers.size();
+        }
+    }
+
+    for (size_t i = 0; i < slotFirstBarriers.size(); i++)
+    {
+        const GraphImage& last = images[slotOwner[slotFirstBarriers[i].slot]];
+        GraphPass& pass = graph->passes[slotFirstBarriers[i].pass];
+        pass.srcStage |= last.writeStage | last.readStages;
+        pass.barriers[slotFirstBarriers[i].barrier].srcAccessMask |= last.writeAccess;
+    }
+
+    GraphPass& end = graph->end;
+    end.srcStage = 0;
+    end.dstStage = 0;
+    end.barriers.clear();
+    end.barrierImages.clear();
+
+    for (uint32_t i = 0; i < images.size(); i++)
+    {
+        GraphImage& image = images[i];
+        if (!image.output)
+            continue;
+
+        // present needs only the layout, anything that reads it later must also see the last write
+        if (image.layout != image.finalLayout || (image.finalAccess & ~image.visibleAccess) != 0)
+        {
+            VkPipelineStageFlags srcStage = image.writeStage | image.readStages;
+            addGraphBarrier(&end, i, image.layout, image.finalLayout, srcStage ? srcStage : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                image.writeAccess, image.finalStage, image.finalAccess);
+        }
+    }
+
+    if (!end.barriers.empty())
+    {
+        graph->barrierBatchCount++;
+        graph->barrierCount += (uint32_t)end.barriers.size();
+    }
+
+    graph->compiled = true;
+}
+
+void runGraphBarriers(const RenderGraph* graph, GraphPass* pass, VkCommandBuffer command)
+{
+    if (pass->barriers.empty())
+        return;
+
+    for (size_t i = 0; i < pass->barriers.size(); i++)
+        pass->barriers[i].image = graph->images[pass->barrierImages[i]].image;
+
+    vkCmdPipelineBarrier(command, pass->srcStage, pass->dstStage, 0, 0, nullptr, 0, nullptr,
+        (uint32_t)pass->barriers.size(), pass->barriers.data());
+}
+
+// records barriers and passes that were not culled
+void executeRenderGraph(RenderGraph* graph, VkCommandBuffer command)
+{
+    assert(graph->compiled);
+
+    for (size_t p = 0; p < graph->passes.size(); p++)
+    {
+        GraphPass& pass = graph->passes[p];
+        if (pass.culled)
+            continue;
+
+        runGraphBarriers(graph, &pass, command);
+        if (pass.record)
+            pass.record(command);
+    }
+
+    runGraphBarriers(graph, &graph->end, command);
+}
+
+void printRenderGraphStats(const RenderGraph* graph)
+{
+    printf("render graph: %u pass(es), %u culled, %u barrier(s) in %u vkCmdPipelineBarrier, transient %.1f MB in %.1f MB of memory\n",
+        (uint32_t)graph->passes.size(), graph->culledPassCount, graph->barrierCount, graph->barrierBatchCount,
+        graph->transientBytes / (1024.0 * 1024.0), graph->aliasedBytes / (1024.0 * 1024.0));
+}
+
+// gpu must be done with the graph
+void destroyRenderGraph(RenderGraph* graph)
+{
+    releaseGraphTransients(graph);
+    graph->images.clear();
+    graph->passes.clear();
+    graph->compiled = false;
+}
+
+/**************************************************************************
+PNG writer
+Purpose: captured frames as files any tool can open, no zlib so deflate is done here
+one block with fixed huffman codes and greedy LZ77 (last position of every 3 byte hash),
+rendered frames have big flat areas so this gets most of what zlib would, much faster than zlib -9
+*/
+struct BitWriter
+{
+    std::vector<byte>* out;
+    uint32_t bits;
+    uint32_t count;
+};
+
+// deflate fills bytes from least significant bit
+void writeBits(BitWriter* writer, uint32_t value, uint32_t count)
+{
+    writer->bits |= value << writer->count;
+    writer->count += count;
+
+    while (writer->count >= 8)
+    {
+        writer->out->push_back((byte)(writer->bits & 0xff));
+        writer->bits >>= 8;
+        writer->count -= 8;
+    }
+}
+
+// huffman codes go most significant bit first
+void writeHuffmanCode(BitWriter* writer, uint32_t code, uint32_t length)
+{
+    uint32_t reversed = 0;
+    for (uint32_t i = 0; i < length; i++)
+        reversed |= ((code >> i) & 1) << (length - 1 - i);
+
+    writeBits(writer, reversed, length);
+}
+
+// fixed literal/length code from deflate spec (RFC 1951 3.2.6)
+void writeFixedSymbol(BitWriter* writer, uint32_t symbol)
+{
+    if (symbol < 144)
+        writeHuffmanCode(writer, 0x30 + symbol, 8);
+    else if (symbol < 256)
+        writeHuffmanCode(writer, 0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        writeHuffmanCode(writer, symbol - 256, 7);
+    else
+        writeHuffmanCode(writer, 0xc0 + symbol - 280, 8);
+}
+
+void writeDeflateMatch(BitWriter* writer, uint32_t length, uint32_t distance)
+{
+    static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const byte lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static const byte distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+        11, 11, 12, 12, 13, 13 };
+
+    uint32_t l = 28;
+    while (lengthBase[l] > length)
+        l--;
+
+    writeFixedSymbol(writer, 257 + l);
+    writeBits(writer, length - lengthBase[l], lengthExtra[l]);
+
+    uint32_t d = 29;
+    while (distanceBase[d] > distance)
+        d--;
+
+    // distance codes are all 5 bits in fixed block
+    writeHuffmanCode(writer, d, 5);
+    writeBits(writer, distance - distanceBase[d], distanceExtra[d]);
+}
+
+// zlib stream (header, one fixed huffman block, adler32) of data appended to out
+void deflateFixed(const byte* data, size_t size, std::vector<int32_t>& head, std::vector<byte>& out)
+{
+    const uint32_t hashBits = 15;
+    const size_t window = 32768;
+    const uint32_t maxMatch = 258;
+
+    head.assign((size_t)1 << hashBits, -1);
+
+    // deflate, 32K window, no dictionary, fastest level
+    out.push_back(0x78);
+    out.push_back(0x01);
+
+    BitWriter writer = { &out, 0, 0 };
+    // last block, fixed codes
+    writeBits(&writer, 1, 1);
+    writeBits(&writer, 1, 2);
+
+    auto hash3 = [&](size_t i)
+    {
+        uint32_t value = (uint32_t)data[i] << 16 | (uint32_t)data[i + 1] << 8 | data[i + 2];
+        return (value * 2654435761u) >> (32 - hashBits);
+    };
+
+    size_t i = 0;
+    while (i < size)
+    {
+        uint32_t bestLength = 0;
+        size_t bestDistance = 0;
+
+        if (i + 3 <= size)
+        {
+            uint32_t h = hash3(i);
+            int32_t candidate = head[h];
+            head[h] = (int32_t)i;
+
+            if (candidate >= 0 && i - candidate <= window)
+            {
+                size_t maxLength = std::min((size_t)maxMatch, size - i);
+                uint32_t length = 0;
+                while (length < maxLength && data[candidate + length] == data[i + length])
+                    length++;
+
+                if (length >= 3)
+                {
+                    bestLength = length;
+                    bestDistance = i - candidate;
+                }
+            }
+        }
+
+        if (bestLength == 0)
+        {
+            writeFixedSymbol(&writer, data[i]);
+            i++;
+            continue;
+        }
+
+        writeDeflateMatch(&writer, bestLength, (uint32_t)bestDistance);
+
+        // positions inside the match can start later matches
+        for (size_t k = i + 1; k < i + bestLength && k + 3 <= size; k++)
+            head[hash3(k)] = (int32_t)k;
+
+        i += bestLength;
+    }
+
+    // end of block, rest of the last byte is padding
+    writeFixedSymbol(&writer, 256);
+    writeBits(&writer, 0, (8 - writer.count) % 8);
+
+    uint32_t a = 1, b = 0;
+    for (size_t k = 0; k < size; k++)
+    {
+        a = (a + data[k]) % 65521;
+        b = (b + a) % 65521;
+    }
+
+    uint32_t adler = (b << 16) | a;
+    byte adlerBytes[4] = { (byte)(adler >> 24), (byte)(adler >> 16), (byte)(adler >> 8), (byte)adler };
+    out.insert(out.end(), adlerBytes, adlerBytes + 4);
+}
+
+struct Crc32Table
+{
+    uint32_t values[256];
+
+    Crc32Table()
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (uint32_t k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            values[n] = c;
+        }
+    }
+};
+
+uint32_t crc32Bytes(uint32_t crc, const byte* data, size_t size)
+{
+    // static is initialized once even if encoder threads get here at the same time
+    static const Crc32Table table;
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table.values[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void writePngChunk(FILE* file, const char* type, const byte* data, size_t size)
+{
+    byte header[8] = { (byte)(size >> 24), (byte)(size >> 16), (byte)(size >> 8), (byte)size,
+        (byte)type[0], (byte)type[1], (byte)type[2], (byte)type[3] };
+    uint32_t crc = crc32Bytes(crc32Bytes(0, header + 4, 4), data, size);
+    byte crcBytes[4] = { (byte)(crc >> 24), (byte)(crc >> 16), (byte)(crc >> 8), (byte)crc };
+
+    fwrite(header, 1, 8, file);
+    fwrite(data, 1, size, file);
+    fwrite(crcBytes, 1, 4, file);
+}
+
+// BGRA pixels (swapchain format) to 8 bit RGB PNG, scratch vectors are reused between calls
+bool writePng(const char* filename, const byte* pixels, uint32_t width, uint32_t height,
+    std::vector<byte>& rows, std::vector<int32_t>& head, std::vector<byte>& compressed)
+{
+    // every row starts with filter type, sub (difference to left pixel) makes flat areas into zeros
+    size_t rowSize = 1 + (size_t)width * 3;
+    rows.resize(rowSize * height);
+
+    for (uint32_t y = 0; y < height; y++)
+    {
+        byte* row = &rows[y * rowSize];
+        const byte* src = pixels + (size_t)y * width * 4;
+        byte left[3] = { 0, 0, 0 };
+        row[0] = 1;
+
+        for (uint32_t x = 0; x < width; x++)
+        {
+            byte rgb[3] = { src[x * 4 + 2], src[x * 4 + 1], src[x * 4 + 0] };
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                row[1 + x * 3 + c] = (byte)(rgb[c] - left[c]);
+                left[c] = rgb[c];
+            }
+        }
+    }
+
+    compressed.clear();
+    deflateFixed(rows.data(), rows.size(), head, compressed);
+
+    FILE* file = fopen(filename, "wb");
+    if (!file)
+        return false;
+
+    static const byte signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite(signature, 1, 8, file);
+
+    // 8 bit, color type 2 (RGB), deflate, filters per row, no interlace
+    byte ihdr[13] = { (byte)(width >> 24), (byte)(width >> 16), (byte)(width >> 8), (byte)width,
+        (byte)(height >> 24), (byte)(height >> 16), (byte)(height >> 8), (byte)height, 8, 2, 0, 0, 0 };
+    writePngChunk(file, "IHDR", ihdr, sizeof(ihdr));
+    writePngChunk(file, "IDAT", compressed.data(), compressed.size());
+    writePngChunk(file, "IEND", nullptr, 0);
+
+    bool written = ferror(file) == 0;
+    fclose(file);
+    return written;
+}
+
+/**************************************************************************
+Frame capture
+Purpose: rendered frames go to disk as raw or PNG sequence while render loop runs at full rate
+frame is copied to a free slot of a ring of host visible buffers in the frame's command buffer,
+poll thread waits for the slot fences in capture order and hands finished slots to encoder threads
+if no slot is free the frame is dropped and counted, render loop never waits for capture
+*/
+enum CaptureFormat
+{
+    CAPTURE_FORMAT_RAW,
+    CAPTURE_FORMAT_PNG
+};
+
+enum CaptureSlotState
+{
+    CAPTURE_SLOT_FREE,
+    // reserved by main thread, copy is recorded and then submitted
+    CAPTURE_SLOT_COPYING,
+    CAPTURE_SLOT_ENCODING
+};
+
+struct CaptureSlot
+{
+    VkBuffer buffer;
+    MemoryAllocation memory;
+    VkDeviceSize size;
+    // signaled when everything submitted before it (frame with the copy) is done
+    VkFence fence;
+    CaptureSlotState state;
+    uint64_t frameIndex;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct FrameCapture
+{
+    VkDevice device;
+    // slots are created and resized only by main thread, only when they are free
+    DeviceAllocator* allocator;
+    const char* prefix;
+    CaptureFormat format;
+    std::vector<CaptureSlot> slots;
+    std::thread pollThread;
+    std::vector<std::thread> encoders;
+
+    std::mutex mutex;
+    // poll thread waits for submitted, encoders for encode queue, flush for a slot to be free
+    std::condition_variable submittedReady;
+    std::condition_variable encodeReady;
+    std::condition_variable slotFreed;
+    // slot indices in submit order, queue finishes them in this order too
+    std::vector<uint32_t> submitted;
+    std::vector<uint32_t> encodeQueue;
+    bool quit;
+
+    uint64_t captured;
+    uint64_t dropped;
+    uint64_t written;
+    uint64_t failed;
+    double encodeTotalMs;
+};
+
+void capturePollMain(FrameCapture* capture)
+{
+    std::unique_lock<std::mutex> lock(capture->mutex);
+
+    while (true)
+    {
+        capture->submittedReady.wait(lock, [&] { return capture->quit || !capture->submitted.empty(); });
+
+        // quit only after everything submitted is encoded
+        if (capture->submitted.empty())
+            return;
+
+        VkFence fence = capture->slots[capture->submitted.front()].fence;
+        lock.unlock();
+
+        // main thread doesnt touch fence of slot that is not free
+        // not inside assert, encoders would read the slot before the copy is done if asserts are compiled out
+        VkResult waitResult = vkWaitForFences(capture->device, 1, &fence, VK_TRUE, UINT64_MAX);
+        assert(waitResult == VK_SUCCESS);
+
+        lock.lock();
+        uint32_t index = capture->submitted.front();
+        capture->submitted.erase(capture->submitted.begin());
+        capture->slots[index].state = CAPTURE_SLOT_ENCODING;
+        capture->encodeQueue.push_back(index);
+        capture->encodeReady.notify_one();
+    }
+}
+
+void captureEncoderMain(FrameCapture* capture)
+{
+    // reused for every frame this thread encodes
+    std::vector<byte> rows;
+    std::vector<int32_t> head;
+    std::vector<byte> compressed;
+
+    std::unique_lock<std::mutex> lock(capture->mutex);
+
+    while (true)
+    {
+        capture->encodeReady.wait(lock, [&] { return capture->quit || !capture->encodeQueue.empty(); });
+
+        if (capture->encodeQueue.empty())
+            return;
+
+        uint32_t index = capture->encodeQueue.front();
+        capture->encodeQueue.erase(capture->encodeQueue.begin());
+        CaptureSlot slot = capture->slots[index];
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        const byte* pixels = slot.memory.mapped;
+        char filename[512];
+        bool written = false;
+
+        if (capture->format == CAPTURE_FORMAT_PNG)
+        {
+            snprintf(filename, sizeof(filename), "%s%06llu.png", capture->prefix, (unsigned long long)slot.frameIndex);
+            written = writePng(filename, pixels, slot.width, slot.height, rows, head, compressed);
+        }
+        else
+        {
+            // BGRA8 rows without header, size is in the file name
+            snprintf(filename, sizeof(filename), "%s%06llu_%ux%u.bgra", capture->prefix, (unsigned long long)slot.frameIndex,
+                slot.width, slot.height);
+            FILE* file = fopen(filename, "wb");
+            if (file)
+            {
+                written = fwrite(pixels, 4, (size_t)slot.width * slot.height, file) == (size_t)slot.width * slot.height;
+                fclose(file);
+            }
+        }
+
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        capture->slots[index].state = CAPTURE_SLOT_FREE;
+        capture->encodeTotalMs += ms;
+        if (written)
+            capture->written++;
+        else
+            capture->failed++;
+        capture->slotFreed.notify_all();
+    }
+}
+
+// frames are written to prefix + frame number, prefix can contain directory
+void createFrameCapture(VkDevice device, DeviceAllocator* allocator, const char* prefix, CaptureFormat format, uint32_t slotCount,
+    uint32_t encoderCount, FrameCapture* capture)
+{
+    capture->device = device;
+    capture->allocator = allocator;
+    capture->prefix = prefix;
+    capture->format = format;
+    capture->quit = false;
+    capture->captured = 0;
+    capture->dropped = 0;
+    capture->written = 0;
+    capture->failed = 0;
+    capture->encodeTotalMs = 0;
+
+    // buffers are created for the first frame that uses the slot, size isnt known before that
+    capture->slots.resize(slotCount);
+
+    for (uint32_t i = 0; i < slotCount; i++)
+    {
+        CaptureSlot& slot = capture->slots[i];
+        slot = {};
+        slot.buffer = VK_NULL_HANDLE;
+        slot.state = CAPTURE_SLOT_FREE;
+
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        assert(vkCreateFence(device, &fenceInfo, nullptr, &slot.fence) == VK_SUCCESS);
+    }
+
+    capture->pollThread = std::thread(capturePollMain, capture);
+    for (uint32_t i = 0; i < encoderCount; i++)
+        capture->encoders.push_back(std::thread(captureEncoderMain, capture));
+}
+
+// slot for this frame or -1 if every slot is busy (frame is dropped)
+int32_t beginFrameCapture(FrameCapture* capture, uint64_t frameIndex, uint32_t width, uint32_t height)
+{
+    int32_t index = -1;
+
+    {
+        std::lock_guard<std::mutex> lock(capture->mutex);
+
+        for (uint32_t i = 0; i < capture->slots.size() && index < 0; i++)
+        {
+            if (capture->slots[i].state == CAPTURE_SLOT_FREE)
+                index = (int32_t)i;
+        }
+
+        if (index < 0)
+        {
+            capture->dropped++;
+            return -1;
+        }
+
+        capture->slots[index].state = CAPTURE_SLOT_COPYING;
+    }
+
+    // nobody else uses reserved slot, it can be resized without lock
+    CaptureSlot& slot = capture->slots[index];
+    VkDeviceSize size = (VkDeviceSize)width * height * 4;
+
+    if (slot.size < size)
+    {
+        if (slot.buffer != VK_NULL_HANDLE)
+            destroyBuffer(capture->allocator, slot.buffer, &slot.memory);
+
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, capture->allocator, &slot.buffer,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &slot.memory);
+        slot.size = size;
+    }
+
+    vkResetFences(capture->device, 1, &slot.fence);
+    slot.frameIndex = frameIndex;
+    slot.width = width;
+    slot.height = height;
+    capture->captured++;
+
+    return index;
+}
+
+// image must be in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+void recordFrameCapture(FrameCapture* capture, int32_t slotIndex, VkCommandBuffer command, VkImage image)
+{
+    const CaptureSlot& slot = capture->slots[slotIndex];
+
+    VkBufferImageCopy region = {};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { slot.width, slot.height, 1 };
+    vkCmdCopyImageToBuffer(command, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+    // encoder reads it on cpu
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = slot.buffer;
+    barrier.offset = 0;
+    barrier.size = (VkDeviceSize)slot.width * slot.height * 4;
+
+    vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// call after the frame with the copy was submitted, empty submit signals fence when everything before it is done
+// queue must be externally synchronized like for any other submit
+void submitFrameCapture(FrameCapture* capture, int32_t slotIndex, VkQueue queue)
+{
+    assert(vkQueueSubmit(queue, 0, nullptr, capture->slots[slotIndex].fence) == VK_SUCCESS);
+
+    std::lock_guard<std::mutex> lock(capture->mutex);
+    capture->submitted.push_back((uint32_t)slotIndex);
+    capture->submittedReady.notify_one();
+}
+
+// waits until every submitted frame is on disk
+void flushFrameCapture(FrameCapture* capture)
+{
+    std::unique_lock<std::mutex> lock(capture->mutex);
+    capture->slotFreed.wait(lock, [&]
+    {
+        for (size_t i = 0; i < capture->slots.size(); i++)
+        {
+            if (capture->slots[i].state != CAPTURE_SLOT_FREE)
+                return false;
+        }
+        return true;
+    });
+}
+
+void printFrameCaptureStats(const FrameCapture* capture)
+{
+    uint64_t done = capture->written + capture->failed;
+    printf("capture: %llu frame(s) written as %s, %llu dropped (all %u slots busy), %llu failed, encode %.3f ms/frame\n",
+        (unsigned long long)capture->written, capture->format == CAPTURE_FORMAT_PNG ? "png" : "raw",
+        (unsigned long long)capture->dropped, (uint32_t)capture->slots.size(), (unsigned long long)capture->failed,
+        done > 0 ? capture->encodeTotalMs / done : 0.0);
+}
+
+// every reserved slot must have been submitted
+void destroyFrameCapture(FrameCapture* capture)
+{
+    flushFrameCapture(capture);
+
+    {
+        std::lock_guard<std::mutex> lock(capture->mutex);
+        capture->quit = true;
+    }
+
+    capture->submittedReady.notify_all();
+    capture->encodeReady.notify_all();
+
+    capture->pollThread.join();
+    for (size_t i = 0; i < capture->encoders.size(); i++)
+        capture->encoders[i].join();
+    capture->encoders.clear();
+
+    for (size_t i = 0; i < capture->slots.size(); i++)
+    {
+        CaptureSlot& slot = capture->slots[i];
+        if (slot.buffer != VK_NULL_HANDLE)
+            destroyBuffer(capture->allocator, slot.buffer, &slot.memory);
+        vkDestroyFence(capture->device, slot.fence, nullptr);
+    }
+
+    capture->slots.clear();
+}
+
+/**************************************************************************
+Pipeline cache
+Purpose: driver doesnt have to compile shaders again on every start
+cache data is saved to file at exit and loaded next time, data from different gpu or driver is thrown away
+*/
+// header that every implementation puts at the start of cache data (VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+struct PipelineCacheHeader
+{
+    uint32_t headerSize;
+    uint32_t headerVersion;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+// true if data was made by this device and driver
+bool validatePipelineCacheData(const std::vector<byte>& data, const VkPhysicalDeviceProperties& properties)
+{
+    if (data.size() < sizeof(PipelineCacheHeader))
+        return false;
+
+    PipelineCacheHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+
+    if (header.headerSize < sizeof(PipelineCacheHeader) || header.headerSize > data.size())
+        return false;
+    if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+        return false;
+    if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID)
+        return false;
+    // uuid changes with driver version
+    if (memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        return false;
+
+    return true;
+}
+
+// returns true if cache was created from valid file (warm start)
+bool createPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties, const char* filename, VkPipelineCache* cache)
+{
+    std::vector<byte> data;
+    FILE* file = filename ? fopen(filename, "rb") : nullptr;
+
+    if (file)
+    {
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        if (size > 0)
+        {
+            data.resize((size_t)size);
+            if (fread(data.data(), 1, data.size(), file) != data.size())
+                data.clear();
+        }
+
+        fclose(file);
+    }
+
+    bool valid = validatePipelineCacheData(data, properties);
+
+    if (!data.empty() && !valid)
+        printf("pipeline cache %s is from different device or driver, ignoring it\n", filename);
+
+    VkPipelineCacheCreateInfo cacheCreateInfo = {};
+    cacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheCreateInfo.initialDataSize = valid ? data.size() : 0;
+    cacheCreateInfo.pInitialData = valid ? data.data() : nullptr;
+
+    // driver can still reject data (corrupted body), then start with empty cache
+    if (vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, cache) == VK_SUCCESS)
+        return valid;
+
+    cacheCreateInfo.initialDataSize = 0;
+    cacheCreateInfo.pInitialData = nullptr;
+    assert(vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, cache) == VK_SUCCESS);
+
+    return false;
+}
+
+// writes to temporary file first so crash during write doesnt leave broken cache behind
+void savePipelineCache(VkDevice device, VkPipelineCache cache, const char* filename)
+{
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || size == 0)
+        return;
+
+    std::vector<byte> data(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+        return;
+
+    std::vector<char> tempName(strlen(filename) + 5);
+    sprintf(tempName.data(), "%s.tmp", filename);
+
+    FILE* file = fopen(tempName.data(), "wb");
+    if (!file)
+        return;
+
+    bool written = fwrite(data.data(), 1, size, file) == size;
+    written = fclose(file) == 0 && written;
+
+    if (!written)
+    {
+        remove(tempName.data());
+        return;
+    }
+
+    // rename doesnt overwrite on windows
+    remove(filename);
+    rename(tempName.data(), filename);
+}
+
+/**************************************************************************
+Present mode
+Purpose: pick present mode and swapchain image count from what surface supports
+pure functions of surface data, no window or device needed so they can be tried with any made up surface
+*/
+// uncapped isnt a vulkan mode, it's whatever presents fastest (no vsync)
+const VkPresentModeKHR presentModeUncapped = VK_PRESENT_MODE_MAX_ENUM_KHR;
+
+bool parsePresentMode(const char* name, VkPresentModeKHR* mode)
+{
+    if (strcmp(name, "fifo") == 0)
+        *mode = VK_PRESENT_MODE_FIFO_KHR;
+    else if (strcmp(name, "fifo-relaxed") == 0)
+        *mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    else if (strcmp(name, "mailbox") == 0)
+        *mode = VK_PRESENT_MODE_MAILBOX_KHR;
+    else if (strcmp(name, "immediate") == 0)
+        *mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+    else if (strcmp(name, "uncapped") == 0)
+        *mode = presentModeUncapped;
+    else
+        return false;
+
+    return true;
+}
+
+const char* presentModeName(VkPresentModeKHR mode)
+{
+    switch (mode)
+    {
+    case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+    case presentModeUncapped: return "uncapped";
+    default: return "other";
+    }
+}
+
+// requested mode if surface has it, otherwise the closest one, fifo is always there
+// mailbox falls back to fifo (no tearing), immediate to mailbox (no vsync wait), fifo relaxed to fifo
+VkPresentModeKHR choosePresentMode(VkPresentModeKHR requested, const VkPresentModeKHR* available, uint32_t availableCount)
+{
+    VkPresentModeKHR preference[3] = { requested, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR };
+
+    if (requested == VK_PRESENT_MODE_IMMEDIATE_KHR || requested == presentModeUncapped)
+    {
+        preference[0] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+        preference[1] = VK_PRESENT_MODE_MAILBOX_KHR;
+    }
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        for (uint32_t j = 0; j < availableCount; j++)
+        {
+            if (available[j] == preference[i])
+                return preference[i];
+        }
+    }
+
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+// requested 0 picks default: minimum + 1 so cpu doesnt wait for the one image being displayed,
+// mailbox wants 3 so there is always a free image to replace queued one
+// result is within surface limits (maxImageCount 0 means no limit)
+uint32_t chooseSwapchainImageCount(const VkSurfaceCapabilitiesKHR& capabilities, VkPresentModeKHR mode, uint32_t requested)
+{
+    uint32_t count = requested;
+
+    if (count == 0)
+    {
+        count = capabilities.minImageCount + 1;
+        if (mode == VK_PRESENT_MODE_MAILBOX_KHR && count < 3)
+            count = 3;
+    }
+
+    if (count < capabilities.minImageCount)
+        count = capabilities.minImageCount;
+    if (capabilities.maxImageCount > 0 && count > capabilities.maxImageCount)
+        count = capabilities.maxImageCount;
+
+    return count;
+}
+
+/**************************************************************************
+Swapchain
+Purpose: everything that depends on window size (swapchain, its image views and framebuffers)
+is created here so it can be created again when window is resized
+old swapchain is retired, not destroyed, frames in flight may still render to it
+*/
+// surface decides the size on most platforms, 0xFFFFFFFF means that swapchain decides it (window client size)
+// minimized window on windows has 0x0, swapchain cant be created then
+VkExtent2D chooseSwapchainExtent(const VkSurfaceCapabilitiesKHR& capabilities, uint32_t width, uint32_t height)
+{
+    if (capabilities.currentExtent.width != 0xFFFFFFFF)
+        return capabilities.currentExtent;
+
+    VkExtent2D extent = { width, height };
+    extent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, extent.width));
+    extent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, extent.height));
+    return extent;
+}
+
+// oldSwapchain (can be VK_NULL_HANDLE) is retired by this, driver can reuse its resources
+// but it still has to be destroyed by hand after gpu is done with it
+void createSwapchain(VkDevice device, VkSurfaceKHR surface, const VkSurfaceCapabilitiesKHR& capabilities,
+    VkSurfaceFormatKHR format, VkImageUsageFlags usage, VkPresentModeKHR presentMode, uint32_t imageCount, VkExtent2D extent,
+    VkSwapchainKHR oldSwapchain, VkSwapchainKHR* swapchain, std::vector<VkImage>* images)
+{
+    VkSwapchainCreateInfoKHR swapChainArgs = {};
+    swapChainArgs.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    swapChainArgs.surface = surface;
+    swapChainArgs.minImageCount = imageCount;
+    swapChainArgs.imageFormat = format.format;
+    swapChainArgs.imageColorSpace = format.colorSpace;
+    swapChainArgs.imageExtent = extent;
+    // this is 1 unless your render is more than 2D
+    swapChainArgs.imageArrayLayers = 1;
+    // color attachment, transfer src too if frames are captured
+    swapChainArgs.imageUsage = usage;
+    // this flag has best performance if there is only one queue
+    swapChainArgs.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    // this needs to be set if there is more than one queue, e.g. one for graphics and one for present
+    //swapChainArgs.queueFamilyIndexCount = 2;
+    //swapChainArgs.pQueueFamilyIndices = queueFamilyIndices;
+    // idk what that is
+    swapChainArgs.preTransform = capabilities.currentTransform;
+    // idk what that is
+    swapChainArgs.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    swapChainArgs.presentMode = presentMode;
+    // idk what that is
+    swapChainArgs.clipped = VK_TRUE;
+    swapChainArgs.oldSwapchain = oldSwapchain;
+
+    assert(vkCreateSwapchainKHR(device, &swapChainArgs, nullptr, swapchain) == VK_SUCCESS);
+
+    // images were created with swapchain
+    // count was specified above but vulkan might have created more images than that
+    uint32_t count = 0;
+    vkGetSwapchainImagesKHR(device, *swapchain, &count, nullptr);
+    images->resize(count);
+    vkGetSwapchainImagesKHR(device, *swapchain, &count, images->data());
+}
+
+// one view and framebuffer per render target image, used for swapchain and offscreen images
+void createFramebuffers(VkDevice device, VkRenderPass renderPass, VkFormat format, VkExtent2D extent,
+    const std::vector<VkImage>& images, std::vector<VkImageView>* imageViews, std::vector<VkFramebuffer>* framebuffers)
+{
+    imageViews->resize(images.size());
+    framebuffers->resize(images.size());
+
+    for (size_t i = 0; i < images.size(); i++)
+    {
+        VkImageViewCreateInfo imageViewArgs = {};
+        imageViewArgs.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewArgs.image = images[i];
+        imageViewArgs.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewArgs.format = format;
+        imageViewArgs.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewArgs.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewArgs.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewArgs.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewArgs.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewArgs.subresourceRange.baseMipLevel = 0;
+        imageViewArgs.subresourceRange.levelCount = 1;
+        imageViewArgs.subresourceRange.baseArrayLayer = 0;
+        imageViewArgs.subresourceRange.layerCount = 1;
+
+        assert(vkCreateImageView(device, &imageViewArgs, nullptr, &(*imageViews)[i]) == VK_SUCCESS);
+
+        VkFramebufferCreateInfo framebufferInfo = {};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = renderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = &(*imageViews)[i];
+        framebufferInfo.width = extent.width;
+        framebufferInfo.height = extent.height;
+        framebufferInfo.layers = 1;
+
+        assert(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &(*framebuffers)[i]) == VK_SUCCESS);
+    }
+}
+
+void destroyFramebuffers(VkDevice device, std::vector<VkImageView>* imageViews, std::vector<VkFramebuffer>* framebuffers)
+{
+    for (size_t i = 0; i < framebuffers->size(); i++)
+        vkDestroyFramebuffer(device, (*framebuffers)[i], nullptr);
+    for (size_t i = 0; i < imageViews->size(); i++)
+        vkDestroyImageView(device, (*imageViews)[i], nullptr);
+
+    framebuffers->clear();
+    imageViews->clear();
+}
+
+// swapchain replaced by a new one, frames up to lastFrame were rendered to it
+struct RetiredSwapchain
+{
+    VkSwapchainKHR swapchain;
+    std::vector<VkImageView> imageViews;
+    std::vector<VkFramebuffer> framebuffers;
+    int lastFrame;
+};
+
+// completedFrame is the newest frame whose fence was waited for, everything before it is done as well
+// nothing waits here, retired swapchains that are still used stay in the list
+void destroyRetiredSwapchains(VkDevice device, std::vector<RetiredSwapchain>* retired, int completedFrame)
+{
+    for (size_t i = 0; i < retired->size();)
+    {
+        RetiredSwapchain& r = (*retired)[i];
+
+        if (r.lastFrame > completedFrame)
+        {
+            i++;
+            continue;
+        }
+
+        destroyFramebuffers(device, &r.imageViews, &r.framebuffers);
+        vkDestroySwapchainKHR(device, r.swapchain, nullptr);
+        retired->erase(retired->begin() + i);
+    }
+}
+
+// viewport and scissor are dynamic state so pipelines dont depend on window size
+// secondary command buffers dont inherit it, every one of them has to set it again
+void setViewportAndScissor(VkCommandBuffer cmd, VkExtent2D extent)
+{
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)extent.width;
+    viewport.height = (float)extent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+
+    VkRect2D scissor = {};
+    scissor.offset = { 0, 0 };
+    scissor.extent = extent;
+
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+}
+
+/**************************************************************************
+Benchmark
+Purpose: repeatable numbers that can be compared between commits
+every scenario runs fixed number of warm-up and timed iterations, results go to stdout and
+to a file with one json object per line so two runs can be diffed line by line
+*/
+struct BenchReport
+{
+    FILE* file;
+    uint32_t warmupIterations;
+    uint32_t iterations;
+};
+
+// one scenario in progress, see benchScenarioNext
+struct BenchScenario
+{
+    const char* name;
+    const char* unit;
+    // how much work one iteration does in unit (bytes, quads...), throughput is work / time
+    double workPerIteration;
+    uint32_t iteration;
+    uint32_t iterationCount;
+    uint32_t warmupIterations;
+    std::chrono::steady_clock::time_point iterationStart;
+    std::vector<double> iterationMs;
+};
+
+void createBenchReport(const char* filename, const VkPhysicalDeviceProperties& properties, uint32_t warmupIterations,
+    uint32_t iterations, BenchReport* report)
+{
+    report->file = fopen(filename, "wb");
+    assert(report->file);
+    report->warmupIterations = warmupIterations;
+    report->iterations = iterations;
+
+    // first line says what was measured, results cant be compared across devices or drivers
+    fprintf(report->file, "{\"device\":\"%s\",\"driverVersion\":%u,\"apiVersion\":%u,\"warmup\":%u,\"iterations\":%u}\n",
+        properties.deviceName, properties.driverVersion, properties.apiVersion, warmupIterations, iterations);
+
+    printf("benchmark on %s, %u warm-up and %u timed iterations\n", properties.deviceName, warmupIterations, iterations);
+    printf("%-28s %10s %10s %10s %10s %14s\n", "scenario", "min ms", "median ms", "mean ms", "max ms", "throughput");
+}
+
+void beginBenchScenario(const BenchReport* report, const char* name, const char* unit, double workPerIteration, BenchScenario* scenario)
+{
+    scenario->name = name;
+    scenario->unit = unit;
+    scenario->workPerIteration = workPerIteration;
+    scenario->iteration = 0;
+    scenario->warmupIterations = report->warmupIterations;
+    scenario->iterationCount = report->warmupIterations + report->iterations;
+    scenario->iterationMs.clear();
+    scenario->iterationMs.reserve(report->iterations);
+}
+
+// while (benchScenarioNext(&scenario)) { work }
+// every call ends timing of previous iteration, body has to wait for gpu itself if gpu time should count
+bool benchScenarioNext(BenchScenario* scenario)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    if (scenario->iteration > scenario->warmupIterations)
+        scenario->iterationMs.push_back(std::chrono::duration<double, std::milli>(now - scenario->iterationStart).count());
+
+    if (scenario->iteration == scenario->iterationCount)
+        return false;
+
+    scenario->iteration++;
+    // start after bookkeeping so it isnt measured
+    scenario->iterationStart = std::chrono::steady_clock::now();
+    return true;
+}
+
+void endBenchScenario(BenchReport* report, BenchScenario* scenario)
+{
+    std::vector<double>& ms = scenario->iterationMs;
+    assert(!ms.empty());
+    std::sort(ms.begin(), ms.end());
+
+    double total = 0;
+    for (size_t i = 0; i < ms.size(); i++)
+        total += ms[i];
+
+    double mean = total / ms.size();
+    double median = ms.size() % 2 ? ms[ms.size() / 2] : (ms[ms.size() / 2 - 1] + ms[ms.size() / 2]) / 2;
+    // median is less noisy than mean on a shared machine
+    double throughput = median > 0 ? scenario->workPerIteration / (median / 1000.0) : 0;
+
+    char throughputText[64];
+    snprintf(throughputText, sizeof(throughputText), "%.1f %s", throughput, scenario->unit);
+    printf("%-28s %10.3f %10.3f %10.3f %10.3f %14s\n", scenario->name, ms.front(), median, mean, ms.back(), throughputText);
+
+    fprintf(report->file, "{\"scenario\":\"%s\",\"minMs\":%.4f,\"medianMs\":%.4f,\"meanMs\":%.4f,\"maxMs\":%.4f,\"throughput\":%.2f,\"unit\":\"%s\"}\n",
+        scenario->name, ms.front(), median, mean, ms.back(), throughput, scenario->unit);
+}
+
+void closeBenchReport(BenchReport* report)
+{
+    fclose(report->file);
+    report->file = nullptr;
+}
+
+// sprite i of the demo scene at time t (seconds)
+// spread over the screen with golden ratio, every one moves in a small circle
+SpriteInstance buildDemoSprite(const TextureAtlas* atlas, const std::vector<uint32_t>& images, float t, uint32_t i)
+{
+    SpriteInstance sprite;
+    sprite.x = fmodf(i * 0.618034f, 1.0f) * 2.0f - 1.0f + 0.05f * cosf(t + i);
+    sprite.y = fmodf(i * 0.381966f * 0.618034f, 1.0f) * 2.0f - 1.0f + 0.05f * sinf(t + i);
+    sprite.scaleX = 0.02f;
+    sprite.scaleY = 0.02f;
+    // every sprite has different atlas image but they all end up in one batch
+    const AtlasEntry& image = atlas->entries[images[i % images.size()]];
+    sprite.u0 = image.u0;
+    sprite.v0 = image.v0;
+    sprite.u1 = image.u1;
+    sprite.v1 = image.v1;
+    sprite.layer = (float)image.page;
+    sprite.color = 0xffffffff;
+
+    return sprite;
+}
+
+// writes 8bit BGRA pixels (the offscreen render target format) as binary PPM
+void writePpm(const char* filename, const byte* pixels, uint32_t width, uint32_t height)
+{
+    FILE* file = fopen(filename, "wb");
+    assert(file);
+
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+
+    for (uint32_t i = 0; i < width * height; i++)
+    {
+        byte rgb[3] = { pixels[i * 4 + 2], pixels[i * 4 + 1], pixels[i * 4 + 0] };
+        fwrite(rgb, 1, 3, file);
+    }
+
+    fclose(file);
+}
+
+// lower is better, cpu implementations (lavapipe, swiftshader) only if there is nothing else
+uint32_t physicalDeviceTypeRank(VkPhysicalDeviceType type)
+{
+    switch (type)
+    {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return 0;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 1;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return 2;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: return 3;
+    default: return 4;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    /**************************************************************************
+    Arguments
+    --headless       render to offscreen image instead of window (always on for linux)
+    --frames N       how many frames to render in headless mode
+    --out file.ppm   write last headless frame to file
+    --frames-in-flight N   how many frames cpu can record ahead of gpu (1 to 3)
+    --sprites N      draw N instanced sprites every frame on top of the quad
+    --pipeline-cache file   where pipeline cache is loaded from and saved to (default pipeline_cache.bin)
+    --no-pipeline-cache     start cold and dont save the cache
+    --assets file.pak       look up shaders and other assets in this package first
+    --pack out.pak files... write asset package and exit
+    --io-bench file [N]     compare file loaders over N iterations (default 20) and exit
+    --gpu-trace file.json   gpu timestamps of every frame and upload batch as chrome trace
+    --gpu-csv file.csv      same timestamps as csv
+    --report-interval S     print cpu timing report every S seconds while running (default only at exit)
+    --bench file.json       run benchmark scenarios headless instead of program loop, results to file
+    --bench-warmup N        untimed iterations per scenario (default 5)
+    --bench-iterations N    timed iterations per scenario (default 50)
+    --record-threads N      workers recording secondary command buffers, 0 records on main thread (default by core count)
+    --no-transfer-queue     upload through graphics queue even if there is transfer only family
+    --present-mode mode     fifo, fifo-relaxed, mailbox, immediate or uncapped (default fifo)
+    --swapchain-images N    swapchain image count, 0 picks by present mode
+    --texture file.ktx2     KTX2 texture instead of checkerboard
+    --decode-textures       decode block compressed textures on cpu even if gpu can sample them
+    --gpu-culling           cull sprites in compute shader and draw them with one indirect draw
+    --no-push-constants     per draw transforms go to uniform ring instead of push constants
+    --capture prefix        write every frame to prefix000001.png etc. in the background, dropped if encoders are behind
+    --capture-format fmt    png or raw (BGRA8 without header, default png)
+    --capture-slots N       host buffers frames wait in for encoding (default 4)
+    --capture-threads N     encoder threads, 0 picks by core count
+    */
+#ifdef _WIN32
+    bool headless = false;
+#else
+    bool headless = true;
+#endif
+    uint32_t headlessFrameCount = 1000;
+    const char* headlessOutputFile = nullptr;
+    uint32_t framesInFlight = 2;
+    // sprite benchmark, number of sprites drawn every frame on top of the quad
+    uint32_t spriteCount = 0;
+    // shaders (and later other assets) are looked up here first
+    const char* assetPackageFile = nullptr;
+    // gpu timestamps of every frame and upload batch
+    const char* gpuTraceFile = nullptr;
+    const char* gpuCsvFile = nullptr;
+    // runs benchmark scenarios instead of program loop and writes results here
+    const char* benchFile = nullptr;
+    uint32_t benchWarmupIterations = 5;
+    uint32_t benchIterations = 50;
+    // workers recording secondary command buffers, 0 records everything on main thread, -1 picks by core count
+    int recordThreads = -1;
+    // fifo is vsync, see choosePresentMode for what happens if surface doesnt have requested one
+    VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+    // 0 picks by present mode
+    uint32_t requestedSwapchainImages = 0;
+    // uploads use transfer only queue family if there is one
+    bool useTransferQueue = true;
+    // seconds between cpu timing reports while running, 0 means only at exit
+    double cpuReportInterval = 0;
+    // nullptr means no cache, every start is cold
+    const char* pipelineCacheFile = "pipeline_cache.bin";
+    // KTX2 texture instead of checkerboard, looked up in asset package first
+    const char* textureFile = nullptr;
+    // decode block compressed textures on cpu even if gpu can sample them
+    bool decodeTextures = false;
+    // sprites are culled by compute shader and drawn with vkCmdDrawIndexedIndirect, cpu doesnt build them every frame
+    bool gpuCulling = false;
+    // transforms go to uniform ring instead of push constants, for comparison
+    bool usePushConstants = true;
+    // every frame goes to capturePrefix000001.png etc., frames are dropped if encoders cant keep up
+    const char* capturePrefix = nullptr;
+    CaptureFormat captureFormat = CAPTURE_FORMAT_PNG;
+    // host buffers frames wait in for copy and encoding, 0 encoder threads picks by core count
+    uint32_t captureSlots = 4;
+    uint32_t captureThreads = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            headlessFrameCount = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            headlessOutputFile = argv[++i];
+        else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+            framesInFlight = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--sprites") == 0 && i + 1 < argc)
+            spriteCount = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--pipeline-cache") == 0 && i + 1 < argc)
+            pipelineCacheFile = argv[++i];
+        else if (strcmp(argv[i], "--no-pipeline-cache") == 0)
+            pipelineCacheFile = nullptr;
+        else if (strcmp(argv[i], "--assets") == 0 && i + 1 < argc)
+            assetPackageFile = argv[++i];
+        else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+            benchFile = argv[++i];
+        else if (strcmp(argv[i], "--bench-warmup") == 0 && i + 1 < argc)
+            benchWarmupIterations = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bench-iterations") == 0 && i + 1 < argc)
+            benchIterations = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc)
+            recordThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc)
+        {
+            if (!parsePresentMode(argv[++i], &requestedPresentMode))
+                printf("unknown present mode %s, using fifo\n", argv[i]);
+        }
+        else if (strcmp(argv[i], "--swapchain-images") == 0 && i + 1 < argc)
+            requestedSwapchainImages = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-transfer-queue") == 0)
+            useTransferQueue = false;
+        else if (strcmp(argv[i], "--texture") == 0 && i + 1 < argc)
+            textureFile = argv[++i];
+        else if (strcmp(argv[i], "--decode-textures") == 0)
+            decodeTextures = true;
+        else if (strcmp(argv[i], "--gpu-culling") == 0)
+            gpuCulling = true;
+        else if (strcmp(argv[i], "--no-push-constants") == 0)
+            usePushConstants = false;
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+            capturePrefix = argv[++i];
+        else if (strcmp(argv[i], "--capture-format") == 0 && i + 1 < argc)
+        {
+            i++;
+            if (strcmp(argv[i], "raw") == 0)
+                captureFormat = CAPTURE_FORMAT_RAW;
+            else if (strcmp(argv[i], "png") == 0)
+                captureFormat = CAPTURE_FORMAT_PNG;
+            else
+                printf("unknown capture format %s, using png\n", argv[i]);
+        }
+        else if (strcmp(argv[i], "--capture-slots") == 0 && i + 1 < argc)
+            captureSlots = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--capture-threads") == 0 && i + 1 < argc)
+            captureThreads = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--report-interval") == 0 && i + 1 < argc)
+            cpuReportInterval = atof(argv[++i]);
+        else if (strcmp(argv[i], "--gpu-trace") == 0 && i + 1 < argc)
+            gpuTraceFile = argv[++i];
+        else if (strcmp(argv[i], "--gpu-csv") == 0 && i + 1 < argc)
+            gpuCsvFile = argv[++i];
+        else if (strcmp(argv[i], "--pack") == 0 && i + 2 < argc)
+        {
+            // --pack out.pak file1 file2 ..., makes package and exits
+            std::vector<const char*> files(argv + i + 2, argv + argc);
+            bool packed = writeAssetPackage(argv[i + 1], files);
+            printf("%s %s with %u file(s)\n", packed ? "created" : "failed to create", argv[i + 1], (uint32_t)files.size());
+            return packed ? 0 : 1;
+        }
+        else if (strcmp(argv[i], "--io-bench") == 0 && i + 1 < argc)
+        {
+            // --io-bench file [iterations], compares loaders and exits
+            uint32_t iterations = i + 2 < argc ? (uint32_t)atoi(argv[i + 2]) : 20;
+            runIoBenchmark(argv[i + 1], iterations);
+            return 0;
+        }
+    }
+
+    AssetPackage assetPackage;
+    AssetPackage* assets = nullptr;
+
+    if (assetPackageFile)
+    {
+        assert(openAssetPackage(assetPackageFile, &assetPackage));
+        assets = &assetPackage;
+    }
+
+    if (benchFile)
+    {
+        // no window so it runs on build machines with cpu implementation
+        headless = true;
+        // draw scenario uses the sprite path
+        if (spriteCount == 0)
+            spriteCount = 10000;
+        if (benchIterations < 1)
+            benchIterations = 1;
+    }
+
+    if (recordThreads < 0)
+    {
+        // single quad isnt worth a thread, benchmark wants enough workers to show scaling
+        // gpu culled sprites are one indirect draw so there is nothing to split either
+        uint32_t cores = std::thread::hardware_concurrency();
+        uint32_t maxThreads = benchFile ? 16 : 4;
+        bool singleDraw = spriteCount == 0 || (gpuCulling && !benchFile);
+        recordThreads = singleDraw ? 0 : (int)std::max(1u, std::min(cores, maxThreads));
+    }
+
+    uint32_t recordThreadCount = (uint32_t)recordThreads;
+
+    // benchmark numbers shouldnt include encoding
+    if (benchFile)
+        capturePrefix = nullptr;
+    if (captureSlots < 1)
+        captureSlots = 1;
+    // png encoding is the slow part, leave cores for render loop and recording
+    if (captureThreads == 0)
+        captureThreads = std::max(1u, std::thread::hardware_concurrency() / 2);
+
+    if (framesInFlight < 1)
+        framesInFlight = 1;
+    if (framesInFlight > 3)
+        framesInFlight = 3;
+
+    uint32_t width = 800;
+    uint32_t height = 600;
+
+    /**************************************************************************
+    Window
+    Purpose: to have a window
+    */
+#ifdef _WIN32
+    const char* wndClassName = "mywindow";
+    HINSTANCE hinstance = GetModuleHandle(0);
+    HWND hwnd = 0;
+    WindowState windowState = {};
+
+    if (!headless)
+    {
+        HBRUSH bg = CreateSolidBrush(RGB(255, 0, 0));
+
+        WNDCLASS wc = { };
+        ZeroMemory(&wc, sizeof(WNDCLASS));
+        wc.lpfnWndProc = WindowProc;
+        wc.hInstance = hinstance;
+        wc.lpszClassName = wndClassName;
+        wc.hbrBackground = bg;
+        RegisterClass(&wc);
+
+        // resizable, swapchain is recreated when client size changes
+        DWORD wndStyle = WS_OVERLAPPEDWINDOW;
+        RECT r = { 0, 0, (LONG)width, (LONG)height };
+        // this tells you what should be the window size if r is rect for client
+        // IMPORTANT. window client, swap chain and VkImages (render target) dimensions must match
+        AdjustWindowRect(&r, wndStyle, false);
+        hwnd = CreateWindowEx(0, wndClassName, "Vulkan", wndStyle, 100, 100,
+            r.right - r.left, r.bottom - r.top, 0, 0, hinstance, 0);
+        assert(hwnd != 0);
+        SetWindowLongPtr(hwnd, GWLP_USERDATA, (LONG_PTR)&windowState);
+        ShowWindow(hwnd, SW_SHOW);
+    }
+#endif
+
+    /**************************************************************************
+    VkInstance
+    Purpose: check if vulkan driver is present and to query for physical devices
+    it also creates win32 surface
+    */
+    VkApplicationInfo appInfo = {};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+
+    // all optional
+    appInfo.pApplicationName = "Vk1";
+    appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.pEngineName = "No Engine";
+    appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.apiVersion = VK_API_VERSION_1_0;
+
+    // headless doesnt need surface extensions
+    const char* ext[] = { "VK_KHR_surface", "VK_KHR_win32_surface" };
+    const char* layers[] = { "VK_LAYER_KHRONOS_validation" };
+
+    // validation layer is usually not installed on build machines
+    uint32_t layerCount = 0;
+    vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+    std::vector<VkLayerProperties> availableLayers(layerCount);
+    vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
+
+    bool validationLayerAvailable = false;
+    for (uint32_t i = 0; i < layerCount; i++)
+    {
+        if (strcmp(availableLayers[i].layerName, layers[0]) == 0)
+        {
+            validationLayerAvailable = true;
+            break;
+        }
+    }
+
+    VkInstanceCreateInfo vkInstanceArgs = {};
+    vkInstanceArgs.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    vkInstanceArgs.pApplicationInfo = &appInfo;
+    vkInstanceArgs.enabledExtensionCount = headless ? 0 : 2;
+    vkInstanceArgs.ppEnabledExtensionNames = ext;
+
+    // enable this to see some diagnostic
+    // requires vulkan 1.1.106 or higher, prints to stdout by default
+    vkInstanceArgs.enabledLayerCount = validationLayerAvailable ? 1 : 0;
+    vkInstanceArgs.ppEnabledLayerNames = layers;
+
+    VkInstance vkInstance;
+    assert(vkCreateInstance(&vkInstanceArgs, nullptr, &vkInstance) == VK_SUCCESS);
+
+    /**************************************************************************
+    Physical device and queue index
+    Purpose: needed to create logical device and queue
+    */
+    uint32_t queueIndex = -1;
+    uint32_t gpuCount = 0;
+    uint32_t queueFamilyCount = 0;
+    VkPhysicalDeviceProperties gpuProperties;
+    VkPhysicalDeviceFeatures gpuFeatures;
+    std::vector<VkPhysicalDevice> gpus;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    std::vector<VkQueueFamilyProperties> queueFamilies;
+    // best device type found so far, see physicalDeviceTypeRank
+    uint32_t physicalDeviceRank = UINT32_MAX;
+
+    vkEnumeratePhysicalDevices(vkInstance, &gpuCount, nullptr);
+    gpus.resize(gpuCount);
+    vkEnumeratePhysicalDevices(vkInstance, &gpuCount, gpus.data());
+
+    for (uint32_t i = 0; i < gpuCount; i++)
+    {
+        vkGetPhysicalDeviceProperties(gpus[i], &gpuProperties);
+        vkGetPhysicalDeviceFeatures(gpus[i], &gpuFeatures);
+        vkGetPhysicalDeviceQueueFamilyProperties(gpus[i], &queueFamilyCount, nullptr);
+        queueFamilies.resize(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(gpus[i], &queueFamilyCount, queueFamilies.data());
+
+        // check if VK_KHR_SWAPCHAIN_EXTENSION_NAME is supported
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(gpus[i], nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(gpus[i], nullptr, &extensionCount, availableExtensions.data());
+
+        bool swapChainSupported = false;
+        for (size_t k = 0; k < availableExtensions.size(); k++)
+        {
+            if (strcmp(availableExtensions[k].extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0)
+            {
+                swapChainSupported = true;
+                break;
+            }
+        }
+
+        // headless doesnt present so swapchain is not needed
+        if (!swapChainSupported && !headless)
+            continue;
+
+        // lets limit this to discrete GPU
+        // headless mode takes anything, build machines often have only CPU implementation (lavapipe, swiftshader)
+        if (gpuProperties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU && !headless)
+            continue;
+
+        // real gpu wins even if cpu implementation is enumerated first, otherwise benchmark could measure the cpu
+        uint32_t rank = physicalDeviceTypeRank(gpuProperties.deviceType);
+        if (rank >= physicalDeviceRank)
+            continue;
+
+        for (uint32_t j = 0; j < queueFamilyCount; j++)
+        {
+            // queue must have graphics VK_QUEUE_GRAPHICS_BIT and present bit and 
+            // VK_QUEUE_TRANSFER_BIT (its guaranteed that if graphics is supported then transfer is supported)
+            if (queueFamilies[j].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+            {
+                queueIndex = j;
+                // physical device doesnt have to be created
+                physicalDevice = gpus[i];
+                physicalDeviceRank = rank;
+                break;
+            }
+        }
+    }
+
+    assert(queueIndex != -1);
+    assert(physicalDevice != VK_NULL_HANDLE);
+
+    // loop went through all devices, properties and queue families have to be of the selected one again
+    vkGetPhysicalDeviceProperties(physicalDevice, &gpuProperties);
+    vkGetPhysicalDeviceFeatures(physicalDevice, &gpuFeatures);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    queueFamilies.resize(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+    printf("using %s\n", gpuProperties.deviceName);
+
+    // transfer only family (no graphics or compute) is usually separate copy engine that runs next to rendering
+    // it must be able to copy any part of an image, some can copy only whole levels
+    uint32_t transferQueueIndex = queueIndex;
+
+    for (uint32_t j = 0; j < queueFamilies.size() && useTransferQueue; j++)
+    {
+        VkQueueFlags flags = queueFamilies[j].queueFlags;
+        VkExtent3D granularity = queueFamilies[j].minImageTransferGranularity;
+
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+            granularity.width == 1 && granularity.height == 1 && granularity.depth == 1)
+        {
+            transferQueueIndex = j;
+            break;
+        }
+    }
+
+    printf("uploads on %s queue family %u\n", transferQueueIndex != queueIndex ? "dedicated transfer" : "graphics", transferQueueIndex);
+
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+    /**************************************************************************
+    Logical device and command queue
+    Purpose: device needed for nearly everything in vulkan, queue needed to execute commands
+    */
+    float queuePriority = 1.0f;
+
+    // its possible that more than one queue is needed so its would require multiple VkDeviceQueueCreateInfo
+    // second one only if uploads have their own family
+    VkDeviceQueueCreateInfo queueArgs[2] = {};
+    queueArgs[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueArgs[0].queueFamilyIndex = queueIndex;
+    queueArgs[0].queueCount = 1;
+    queueArgs[0].pQueuePriorities = &queuePriority;
+    queueArgs[1] = queueArgs[0];
+    queueArgs[1].queueFamilyIndex = transferQueueIndex;
+
+    // compressed texture formats can be used only if their feature is enabled, everything gpu has is turned on
+    // gpuFeatures is still of selected gpu
+    VkPhysicalDeviceFeatures deviceFeatures = {};
+    deviceFeatures.textureCompressionBC = gpuFeatures.textureCompressionBC;
+    deviceFeatures.textureCompressionETC2 = gpuFeatures.textureCompressionETC2;
+    deviceFeatures.textureCompressionASTC_LDR = gpuFeatures.textureCompressionASTC_LDR;
+
+    const char* extensions[] = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+    VkDeviceCreateInfo deviceArgs = {};
+    deviceArgs.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceArgs.pQueueCreateInfos = queueArgs;
+    deviceArgs.queueCreateInfoCount = transferQueueIndex != queueIndex ? 2 : 1;
+    deviceArgs.pEnabledFeatures = &deviceFeatures;
+    deviceArgs.enabledExtensionCount = headless ? 0 : 1;
+    deviceArgs.ppEnabledExtensionNames = extensions;
+
+    // create device creates logical device and all the queues
+    VkDevice device;
+    assert(vkCreateDevice(physicalDevice, &deviceArgs, nullptr, &device) == VK_SUCCESS);
+    // queues are created, query for one found before (queueIndex)
+    VkQueue queue;
+    vkGetDeviceQueue(device, queueIndex, 0, &queue);
+    // same as queue without dedicated transfer family
+    VkQueue transferQueue;
+    vkGetDeviceQueue(device, transferQueueIndex, 0, &transferQueue);
+
+    /**************************************************************************
+    Device memory allocator
+    Purpose: all buffers and images get memory from here instead of calling vkAllocateMemory for each of them
+    */
+    DeviceAllocator allocator;
+    createDeviceAllocator(device, memProperties, gpuProperties.limits.bufferImageGranularity, 64 * 1024 * 1024, &allocator);
+
+    /**************************************************************************
+    Surface
+    Purpose: to connect vulkan (more specifically swapchain) with window
+    */
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
+    VkSurfaceCapabilitiesKHR surfaceCapabilities = {};
+    VkSurfaceFormatKHR surfaceFormat = {};
+
+    if (!headless)
+    {
+#ifdef _WIN32
+        VkWin32SurfaceCreateInfoKHR surfaceArgs = {};
+        surfaceArgs.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
+        surfaceArgs.hinstance = hinstance;
+        surfaceArgs.hwnd = hwnd;
+
+        assert(vkCreateWin32SurfaceKHR(vkInstance, &surfaceArgs, nullptr, &surface) == VK_SUCCESS);
+#endif
+
+        // check if the queue support presentation, its possbile that there is a different queue for this
+        // for now, lets hope that selected queue supports it
+        VkBool32 physicalDeviceSupportSurface = VK_FALSE;
+        vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, queueIndex, surface, &physicalDeviceSupportSurface);
+
+        assert(physicalDeviceSupportSurface == VK_TRUE);
+
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
+
+        uint32_t formatCount;
+        std::vector<VkSurfaceFormatKHR> surfaceFormats;
+        vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, nullptr);
+        surfaceFormats.resize(formatCount);
+        vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount, surfaceFormats.data());
+
+        // see if format available
+        for (uint32_t i = 0; i < formatCount; i++)
+        {
+            // this is the most optimal combination
+            if (surfaceFormats[i].format == VK_FORMAT_B8G8R8A8_UNORM && surfaceFormats[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+            {
+                surfaceFormat = surfaceFormats[i];
+                break;
+            }
+        }
+    }
+    else
+    {
+        // offscreen image uses the same format as window would
+        surfaceFormat.format = VK_FORMAT_B8G8R8A8_UNORM;
+        surfaceFormat.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+    }
+
+    assert(surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM);
+
+    // VK_PRESENT_MODE_FIFO_KHR (vsync) always exists, others are used if surface has them
+    VkPresentModeKHR surfacePresentationMode = VK_PRESENT_MODE_FIFO_KHR;
+
+    if (!headless)
+    {
+        uint32_t presentModeCount;
+        std::vector<VkPresentModeKHR> surfacePresentationModes;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &presentModeCount, nullptr);
+        assert(presentModeCount != 0);
+        surfacePresentationModes.resize(presentModeCount);
+        vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface,
+            &presentModeCount, surfacePresentationModes.data());
+
+        surfacePresentationMode = choosePresentMode(requestedPresentMode, surfacePresentationModes.data(), presentModeCount);
+        printf("present mode %s (requested %s)\n", presentModeName(surfacePresentationMode), presentModeName(requestedPresentMode));
+    }
+
+    /**************************************************************************
+    Swap Chain
+    Purpose: actually surface doesnt connect to the vulkan, swap chain does and
+    surface connects to swap chain.
+    Creating swapchain with vulkan creates VkImage as well which is actual vulkan object
+    where vulkan renders pixels to
+    */
+    VkExtent2D swapChainExtent = { width,height };
+    VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+    uint32_t frameBufferCount = 0;
+    std::vector<VkImage> swapChainImages;
+    VkImageUsageFlags swapChainUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+    if (!headless)
+    {
+        // capture copies swapchain image to host buffer
+        if (capturePrefix && (surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT))
+            swapChainUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        else if (capturePrefix)
+        {
+            printf("surface images cant be copied, capture is off\n");
+            capturePrefix = nullptr;
+        }
+
+        // recommendation is minimum + 1, within surface limits
+        frameBufferCount = chooseSwapchainImageCount(surfaceCapabilities, surfacePresentationMode, requestedSwapchainImages);
+        swapChainExtent = chooseSwapchainExtent(surfaceCapabilities, width, height);
+
+        createSwapchain(device, surface, surfaceCapabilities, surfaceFormat, swapChainUsage, surfacePresentationMode, frameBufferCount,
+            swapChainExtent, VK_NULL_HANDLE, &swapChain, &swapChainImages);
+        frameBufferCount = (uint32_t)swapChainImages.size();
+    }
+
+    /**************************************************************************
+    Offscreen render target
+    Purpose: headless mode has no swapchain so render target images are created by hand
+    and after every frame copied to host visible buffer (readback)
+    */
+    std::vector<MemoryAllocation> offscreenImageMemory;
+    VkBuffer readbackBuffer = VK_NULL_HANDLE;
+    MemoryAllocation readbackBufferMemory = {};
+    void* mappedReadbackBufferMemory = nullptr;
+    VkDeviceSize readbackSize = (VkDeviceSize)width * height * 4;
+
+    if (headless)
+    {
+        // one image per frame in flight, like swapchain would have
+        frameBufferCount = framesInFlight;
+        swapChainImages.resize(frameBufferCount);
+        offscreenImageMemory.resize(frameBufferCount);
+
+        for (uint32_t i = 0; i < frameBufferCount; i++)
+        {
+            VkImageCreateInfo offscreenImageCreateInfo = {};
+            offscreenImageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            offscreenImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+            offscreenImageCreateInfo.extent.width = swapChainExtent.width;
+            offscreenImageCreateInfo.extent.height = swapChainExtent.height;
+            offscreenImageCreateInfo.extent.depth = 1;
+            offscreenImageCreateInfo.mipLevels = 1;
+            offscreenImageCreateInfo.arrayLayers = 1;
+            offscreenImageCreateInfo.format = surfaceFormat.format;
+            offscreenImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            offscreenImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            // transfer src so it can be copied to readback buffer, transfer dst for render graph benchmark
+            offscreenImageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+            offscreenImageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            offscreenImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+            createImage(&offscreenImageCreateInfo, &allocator, &swapChainImages[i],
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &offscreenImageMemory[i]);
+        }
+
+        // pixels end up here, one region per image, it stays mapped for the whole program
+        createBuffer(readbackSize * frameBufferCount, VK_BUFFER_USAGE_TRANSFER_DST_BIT, &allocator, &readbackBuffer,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &readbackBufferMemory);
+        mappedReadbackBufferMemory = readbackBufferMemory.mapped;
+    }
+
+    /************************************************************************************
     Descriptor Layout
     Purpose: idk, some helper object for descriptor
     */
     VkDescriptorSetLayoutBinding uboLayoutBinding = {};
     uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    // dynamic means that offset into buffer is given when set is bound (vkCmdBindDescriptorSets)
+    // so one set can point to any uniform block in the ring buffer
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
     uboLayoutBinding.descriptorCount = 1;
     uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-    VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-    samplerLayoutBinding.binding = 1;
-    samplerLayoutBinding.descriptorCount = 1;
-    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerLayoutBinding.pImmutableSamplers = nullptr;
-    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
+    samplerLayoutBinding.binding = 1;
+    samplerLayoutBinding.descriptorCount = 1;
+    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    samplerLayoutBinding.pImmutableSamplers = nullptr;
+    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    // texture atlas, all pages as one 2D array texture
+    VkDescriptorSetLayoutBinding atlasLayoutBinding = samplerLayoutBinding;
+    atlasLayoutBinding.binding = 2;
+
+    VkDescriptorSetLayoutBinding descriptorSetBindings[] = { uboLayoutBinding, samplerLayoutBinding, atlasLayoutBinding };
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.bindingCount = 3;
+    descriptorSetLayoutCreateInfo.pBindings = descriptorSetBindings;
+
+    VkDescriptorSetLayout descriptorSetLayout;
+    assert(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout) == VK_SUCCESS);
+
+    /**************************************************************************
+    Shaders
+    */
+    // transform is pushed when it fits, shaders that read it from push constants are separate files
+    bool pushTransforms = usePushConstants && drawParamsFitPushConstants(sizeof(Transform), gpuProperties.limits);
+    printf("draw params: %s\n", pushTransforms ? "push constants" : "uniform ring");
+
+    // mapped straight from package or file, no copy
+    Asset vsCode;
+    Asset psCode;
+
+    assert(loadAsset(assets, pushTransforms ? "vert_push.spv" : "vert.spv", &vsCode));
+    assert(loadAsset(assets, "frag.spv", &psCode));
+
+    VkShaderModuleCreateInfo shaderCreateInfo = {};
+    shaderCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderCreateInfo.codeSize = vsCode.size;
+    // WARNING pCode is pointer to int so bytes must be aligned to 4byte
+    // mapped files are page aligned and package aligns every file to 16
+    shaderCreateInfo.pCode = (const uint32_t*)vsCode.data;
+
+    VkShaderModule vsModule;
+    assert(vkCreateShaderModule(device, &shaderCreateInfo, nullptr, &vsModule) == VK_SUCCESS);
+
+    shaderCreateInfo.codeSize = psCode.size;
+    shaderCreateInfo.pCode = (const uint32_t*)psCode.data;
+
+    VkShaderModule psModule;
+    assert(vkCreateShaderModule(device, &shaderCreateInfo, nullptr, &psModule) == VK_SUCCESS);
+
+    // module has its own copy of the code
+    releaseAsset(&vsCode);
+    releaseAsset(&psCode);
+
+    VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vertShaderStageInfo.module = vsModule;
+    vertShaderStageInfo.pName = "main";
+    // you can set constants in shaders with this
+    //vertShaderStageInfo.pSpecializationInfo = nullptr;
+
+    VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
+    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragShaderStageInfo.module = psModule;
+    fragShaderStageInfo.pName = "main";
+
+    VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+
+    /**************************************************************************
+    Vertex Input
+    */
+    // shaders still get vec2 position, vec3 color (alpha is dropped) and vec2 uv, formats convert them to floats
+    VertexLayout vertexLayout;
+    buildVertexLayout(0, VK_VERTEX_INPUT_RATE_VERTEX, packedVertexAttributes,
+        sizeof(packedVertexAttributes) / sizeof(packedVertexAttributes[0]), &vertexLayout);
+    assert(vertexLayout.binding.stride == sizeof(PackedVertex));
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.pVertexBindingDescriptions = &vertexLayout.binding;
+    vertexInputInfo.vertexAttributeDescriptionCount = (uint32_t)vertexLayout.attributes.size();
+    vertexInputInfo.pVertexAttributeDescriptions = vertexLayout.attributes.data();
+
+    /**************************************************************************
+    Viewport
+    */
+    // viewport and scissor are set when commands are recorded (setViewportAndScissor)
+    // so resizing the window doesnt require new pipelines, only count is given here
+    VkPipelineViewportStateCreateInfo viewportState = {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+
+    /**************************************************************************
+    Rasterizer
+    */
+    VkPipelineRasterizationStateCreateInfo rasterizer = {};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    rasterizer.depthBiasEnable = VK_FALSE;
+    rasterizer.depthBiasConstantFactor = 0.0f; // Optional
+    rasterizer.depthBiasClamp = 0.0f; // Optional
+    rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
+
+    /**************************************************************************
+    Multisampling
+    */
+    VkPipelineMultisampleStateCreateInfo multisampling = {};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampling.minSampleShading = 1.0f; // Optional
+    multisampling.pSampleMask = nullptr; // Optional
+    multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
+    multisampling.alphaToOneEnable = VK_FALSE; // Optional
+    
+    /**************************************************************************
+    Blend
+    */
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+
+    VkPipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    /**************************************************************************
+    Render pass and subpass
+    */
+    VkAttachmentDescription colorAttachment = {};
+    colorAttachment.format = surfaceFormat.format;
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    // render pass doesnt change layout, frame graph moves image to color attachment before it
+    // and to present (or transfer src for readback) after it, together with other barriers of that point
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorAttachmentRef = {};
+    colorAttachmentRef.attachment = 0;
+    // Optimal as attachment for writing colors from the fragment shader
+    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentRef;
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &colorAttachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+
+    VkRenderPass renderPass;
+    assert(vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) == VK_SUCCESS);
+
+
+    /**************************************************************************
+    Pipeline
+    */
+    VkPipelineCache pipelineCache;
+    bool pipelineCacheWarm = createPipelineCache(device, gpuProperties, pipelineCacheFile, &pipelineCache);
+    // time spent in vkCreateGraphicsPipelines, this is what cache makes faster
+    double pipelineCreateMs = 0;
+    uint32_t pipelineCount = 0;
+
+    // quad and sprites share the layout, transform is their only per draw data
+    DrawLayout drawLayout;
+    createDrawLayout(device, &descriptorSetLayout, 1, sizeof(Transform), VK_SHADER_STAGE_VERTEX_BIT, pushTransforms, &drawLayout);
+
+    VkPipelineInputAssemblyStateCreateInfo pipelineInputAssembly = {};
+    pipelineInputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    // indexed, quad is 2 triangles that share 2 vertices
+    pipelineInputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    pipelineInputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &pipelineInputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.layout = drawLayout.pipelineLayout;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.subpass = 0;
+
+    VkPipeline graphicsPipeline;
+    auto pipelineCreateStart = std::chrono::steady_clock::now();
+    assert(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &graphicsPipeline) == VK_SUCCESS);
+    pipelineCreateMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineCreateStart).count();
+    pipelineCount++;
+
+    /**************************************************************************
+    Sprite pipeline
+    Purpose: same as graphicsPipeline but quad is instanced, per sprite data comes from second vertex binding
+    only created when sprites are drawn so sprite shaders dont have to exist otherwise
+    */
+    VkPipeline spritePipeline = VK_NULL_HANDLE;
+
+    if (spriteCount > 0)
+    {
+        Asset spriteVsCode;
+        Asset spritePsCode;
+
+        assert(loadAsset(assets, pushTransforms ? "sprite_vert_push.spv" : "sprite_vert.spv", &spriteVsCode));
+        assert(loadAsset(assets, "sprite_frag.spv", &spritePsCode));
+
+        shaderCreateInfo.codeSize = spriteVsCode.size;
+        shaderCreateInfo.pCode = (const uint32_t*)spriteVsCode.data;
+
+        VkShaderModule spriteVsModule;
+        assert(vkCreateShaderModule(device, &shaderCreateInfo, nullptr, &spriteVsModule) == VK_SUCCESS);
+
+        shaderCreateInfo.codeSize = spritePsCode.size;
+        shaderCreateInfo.pCode = (const uint32_t*)spritePsCode.data;
+
+        VkShaderModule spritePsModule;
+        assert(vkCreateShaderModule(device, &shaderCreateInfo, nullptr, &spritePsModule) == VK_SUCCESS);
+
+        releaseAsset(&spriteVsCode);
+        releaseAsset(&spritePsCode);
+
+        VkPipelineShaderStageCreateInfo spriteShaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+        spriteShaderStages[0].module = spriteVsModule;
+        spriteShaderStages[1].module = spritePsModule;
+
+        // binding 0 is the quad, binding 1 advances once per instance
+        // instances stay 32 bit floats, cull.comp copies them word by word
+        VertexLayout instanceLayout;
+        buildVertexLayout(1, VK_VERTEX_INPUT_RATE_INSTANCE, spriteInstanceAttributes,
+            sizeof(spriteInstanceAttributes) / sizeof(spriteInstanceAttributes[0]), &instanceLayout);
+        assert(instanceLayout.binding.stride == sizeof(SpriteInstance));
+
+        VkVertexInputBindingDescription spriteBindings[2] = { vertexLayout.binding, instanceLayout.binding };
+        std::vector<VkVertexInputAttributeDescription> spriteAttributes = vertexLayout.attributes;
+        spriteAttributes.insert(spriteAttributes.end(), instanceLayout.attributes.begin(), instanceLayout.attributes.end());
+
+        VkPipelineVertexInputStateCreateInfo spriteVertexInputInfo = vertexInputInfo;
+        spriteVertexInputInfo.vertexBindingDescriptionCount = 2;
+        spriteVertexInputInfo.pVertexBindingDescriptions = spriteBindings;
+        spriteVertexInputInfo.vertexAttributeDescriptionCount = (uint32_t)spriteAttributes.size();
+        spriteVertexInputInfo.pVertexAttributeDescriptions = spriteAttributes.data();
+
+        // sprites overlap so they are alpha blended
+        VkPipelineColorBlendAttachmentState spriteBlendAttachment = colorBlendAttachment;
+        spriteBlendAttachment.blendEnable = VK_TRUE;
+        spriteBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        spriteBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        spriteBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+        spriteBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        spriteBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+        spriteBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+        VkPipelineColorBlendStateCreateInfo spriteColorBlending = colorBlending;
+        spriteColorBlending.pAttachments = &spriteBlendAttachment;
+
+        VkGraphicsPipelineCreateInfo spritePipelineInfo = pipelineInfo;
+        spritePipelineInfo.pStages = spriteShaderStages;
+        spritePipelineInfo.pVertexInputState = &spriteVertexInputInfo;
+        spritePipelineInfo.pColorBlendState = &spriteColorBlending;
+
+        pipelineCreateStart = std::chrono::steady_clock::now();
+        assert(vkCreateGraphicsPipelines(device, pipelineCache, 1, &spritePipelineInfo, nullptr, &spritePipeline) == VK_SUCCESS);
+        pipelineCreateMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pipelineCreateStart).count();
+        pipelineCount++;
+
+        vkDestroyShaderModule(device, spritePsModule, nullptr);
+        vkDestroyShaderModule(device, spriteVsModule, nullptr);
+    }
+
+    // run twice to compare, first run (or --no-pipeline-cache) is cold
+    printf("pipelines: %u created in %.3f ms with %s pipeline cache\n", pipelineCount, pipelineCreateMs,
+        pipelineCacheWarm ? "warm" : "cold");
+
+    // modules were compiled to machine code and stored in the pipeline, they are destroyed at clean up
+    // because benchmark creates pipelineInfo again
+
+    /**************************************************************************
+    Frame buffer
+    Purpose: render pass draws into framebuffer, VkImageView is some helper object for VkImage (render target)
+    both are created again with the swapchain when window is resized
+    */
+    std::vector<VkImageView> swapChainImageViews;
+    std::vector<VkFramebuffer> swapChainFramebuffers;
+    createFramebuffers(device, renderPass, surfaceFormat.format, swapChainExtent, swapChainImages,
+        &swapChainImageViews, &swapChainFramebuffers);
+
+    // swapchains replaced on resize, destroyed when frames that used them are done
+    std::vector<RetiredSwapchain> retiredSwapchains;
+
+    /**************************************************************************
+    Command pool
+    */
+    VkCommandPoolCreateInfo commandPoolCreateInfo = {};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.queueFamilyIndex = queueIndex;
+    // this can be used to indicate that commands will be shortlived
+    //commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    // draw commands are rerecorded every frame
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    VkCommandPool commandPool;
+    assert(vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &commandPool) == VK_SUCCESS);
+
+    /**************************************************************************
+    Upload manager
+    Purpose: all startup data (texture, vertices) goes to gpu in one batch without vkQueueWaitIdle
+    */
+    // copy offsets have to be multiple of 4 and texel size, 16 covers all formats used here
+    VkDeviceSize uploadAlignment = gpuProperties.limits.optimalBufferCopyOffsetAlignment > 16 ?
+        gpuProperties.limits.optimalBufferCopyOffsetAlignment : 16;
+
+    /**************************************************************************
+    GPU profiler
+    Purpose: timestamps around parts of frame and upload command buffers
+    always on, cost is two queries per scope, trace files only if requested
+    */
+    GpuTraceWriter gpuTrace;
+    createGpuTraceWriter(gpuTraceFile, gpuCsvFile, &gpuTrace);
+
+    // queueFamilies still has families of selected gpu
+    uint32_t timestampValidBits = queueFamilies[queueIndex].timestampValidBits;
+
+    GpuProfiler frameProfiler;
+    createGpuProfiler(device, gpuProperties, timestampValidBits, framesInFlight, 16, &gpuTrace, 1, "frame", &frameProfiler);
+
+    // transfer only queue cant reset query pools (vkCmdResetQueryPool needs graphics or compute), profiler is off there
+    const uint32_t uploadBatchSlots = 4;
+    GpuProfiler uploadProfiler;
+    createGpuProfiler(device, gpuProperties, transferQueueIndex == queueIndex ? timestampValidBits : 0, uploadBatchSlots, 4,
+        &gpuTrace, 2, "upload", &uploadProfiler);
+
+    UploadManager uploads;
+    createUploadManager(transferQueue, transferQueueIndex, queue, queueIndex, 16 * 1024 * 1024, uploadBatchSlots, uploadAlignment,
+        &allocator, &uploadProfiler, &uploads);
+
+    /**************************************************************************
+    Image (for texture)
+    */
+    // KTX2 file if given, checkerboard otherwise (or when file cant be used)
+    Texture texture = {};
+    bool textureLoaded = false;
+
+    if (textureFile)
+    {
+        Asset textureAsset;
+        uint64_t textureToken = 0;
 
-    VkDescriptorSetLayoutBinding descriptorSetBindings[] = { uboLayoutBinding, samplerLayoutBinding };
-    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {};
-    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    descriptorSetLayoutCreateInfo.bindingCount = 2;
-    descriptorSetLayoutCreateInfo.pBindings = descriptorSetBindings;
+        if (loadAsset(assets, textureFile, &textureAsset))
+        {
+            textureLoaded = loadKtx2Texture(physicalDevice, deviceFeatures, decodeTextures, textureAsset.data, textureAsset.size,
+                &uploads, &texture, &textureToken);
+            // levels were copied to staging, file isnt needed anymore
+            releaseAsset(&textureAsset);
+        }
 
-    VkDescriptorSetLayout descriptorSetLayout;
-    assert(vkCreateDescriptorSetLayout(device, &descriptorSetLayoutCreateInfo, nullptr, &descriptorSetLayout) == VK_SUCCESS);
+        if (textureLoaded)
+        {
+            printf("texture %s: %s%s %ux%u, %u level(s), %.1f KB in gpu memory (%.1f KB as RGBA8)\n", textureFile,
+                findTextureFormat(texture.sourceFormat)->name, texture.cpuDecoded ? " decoded on cpu" : "", texture.width, texture.height,
+                texture.levelCount, texture.size / 1024.0, texture.rgba8Size / 1024.0);
+        }
+        else
+            printf("cant use texture %s, using checkerboard\n", textureFile);
+    }
+
+    if (!textureLoaded)
+    {
+        std::vector<unsigned char> textureBytes;
+        struct { float w, h, size; } textureSize = { 25,25, 25 * 25 * 4 };
+
+        for (int i = 0; i < textureSize.h; i++)
+        {
+            for (int j = 0; j < textureSize.w; j++)
+            {
+                unsigned char color = (i + j) % 2 ? 255 : 0;
+
+                textureBytes.push_back(color);
+                textureBytes.push_back(color);
+                textureBytes.push_back(color);
+                textureBytes.push_back(255);
+            }
+        }
+
+        // image
+        // it's possible to write texture data to VkBuffer but VkImage has more utility and it's faster
+        // VkImage is VkBuffer but for images
+        VkImageCreateInfo textureImageCreateInfo = {};
+        textureImageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        textureImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        textureImageCreateInfo.extent.width = (uint32_t)textureSize.w;
+        textureImageCreateInfo.extent.height = (uint32_t)textureSize.h;
+        textureImageCreateInfo.extent.depth = 1;
+        // full mip chain so minified texture reads small levels instead of scattered texels of the big one
+        textureImageCreateInfo.mipLevels = mipLevelCount((uint32_t)textureSize.w, (uint32_t)textureSize.h);
+        textureImageCreateInfo.arrayLayers = 1;
+        textureImageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        textureImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        textureImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        // transfer src because mips are blitted from previous level
+        textureImageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        textureImageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        textureImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+        // optimal tiling image, allocator puts it in a different block than buffers
+        createImage(&textureImageCreateInfo, &allocator, &texture.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &texture.memory);
+
+        // copy to image, upload manager does the layout transitions
+        // VkImageSubresourceRange describes the regions of the image that will be transitioned
+        VkImageSubresourceRange textureRange = {};
+        textureRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        textureRange.baseMipLevel = 0;
+        textureRange.levelCount = textureImageCreateInfo.mipLevels;
+        textureRange.baseArrayLayer = 0;
+        textureRange.layerCount = 1;
+
+        // this needs to be declared for every mip level
+        // and then in uploadImage you send array of these
+        // only level 0 is copied, gpu makes the rest
+        VkBufferImageCopy bufferToImage = {};
+        bufferToImage.bufferOffset = 0;
+        bufferToImage.bufferRowLength = 0;
+        bufferToImage.bufferImageHeight = 0;
+        bufferToImage.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        bufferToImage.imageSubresource.mipLevel = 0;
+        bufferToImage.imageSubresource.baseArrayLayer = 0;
+        bufferToImage.imageSubresource.layerCount = 1;
+        bufferToImage.imageOffset = { 0, 0, 0 };
+        bufferToImage.imageExtent = { (uint32_t)textureSize.w, (uint32_t)textureSize.h, 1 };
+
+        if (formatSupportsLinearBlit(physicalDevice, textureImageCreateInfo.format))
+        {
+            uploadImageGenerateMips(&uploads, texture.image, textureRange, { (uint32_t)textureSize.w, (uint32_t)textureSize.h },
+                VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, textureBytes.data(), (VkDeviceSize)textureSize.size, &bufferToImage, 1);
+        }
+        else
+        {
+            // cant blit this format, levels are made on cpu and copied with level 0
+            std::vector<byte> mipChain;
+            std::vector<VkBufferImageCopy> mipRegions;
+            buildMipChainRgba8(textureBytes.data(), (uint32_t)textureSize.w, (uint32_t)textureSize.h, textureImageCreateInfo.mipLevels,
+                mipChain, mipRegions);
+
+            uploadImage(&uploads, texture.image, textureRange, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                mipChain.data(), mipChain.size(), mipRegions.data(), (uint32_t)mipRegions.size());
+        }
+
+        texture.format = textureImageCreateInfo.format;
+        texture.sourceFormat = textureImageCreateInfo.format;
+        texture.width = textureImageCreateInfo.extent.width;
+        texture.height = textureImageCreateInfo.extent.height;
+        texture.levelCount = textureImageCreateInfo.mipLevels;
+    }
+
+    // image view for texture
+    VkImageViewCreateInfo textureImageViewCreateInfo = {};
+    textureImageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    textureImageViewCreateInfo.image = texture.image;
+    textureImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    textureImageViewCreateInfo.format = texture.format;
+    textureImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    textureImageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+    textureImageViewCreateInfo.subresourceRange.levelCount = texture.levelCount;
+    textureImageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+    textureImageViewCreateInfo.subresourceRange.layerCount = 1;
+
+    VkImageView textureImageView;
+    assert(vkCreateImageView(device, &textureImageViewCreateInfo, nullptr, &textureImageView) == VK_SUCCESS);
 
     /**************************************************************************
-    Shaders
+    Sampler
+    */
+    VkSamplerCreateInfo samplerCreateInfo = {};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    // magnified checkerboard stays sharp, minified one is trilinear (linear in level and between levels)
+    samplerCreateInfo.magFilter = VK_FILTER_NEAREST;
+    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    // this doesnt matter in VK_SAMPLER_ADDRESS_MODE_REPEAT mode but it has to be specified (i think)
+    samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    // im not using that
+    // you must check if pysical devices has this feature enabled
+    //samplerCreateInfo.anisotropyEnable = VK_TRUE;
+    //samplerCreateInfo.maxAnisotropy = 16;
+    // unnormalizedCoordinates uses coordinates in pixels for texture instead of [0,1]
+    samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
+    // this is some advance feature
+    samplerCreateInfo.compareEnable = VK_FALSE;
+    samplerCreateInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerCreateInfo.mipLodBias = 0.0f;
+    // all levels the image view has, atlas has only one so it stays at level 0
+    samplerCreateInfo.minLod = 0.0f;
+    samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    VkSampler textureSampler;
+    assert(vkCreateSampler(device, &samplerCreateInfo, nullptr, &textureSampler) == VK_SUCCESS);
+
+    /**************************************************************************
+    Texture atlas
+    Purpose: images for sprites, all of them are in one array texture so sprites with different images
+    are still drawn with one descriptor set and one draw call
     */
-    std::vector<byte> vsCode;
-    std::vector<byte> psCode;
+    TextureAtlas atlas;
+    createTextureAtlas(512, 4, &allocator, &atlas);
 
-    readFile("vert.spv", vsCode);
-    readFile("frag.spv", psCode);
+    // procedural images until there is asset loading, discs of different sizes and colors
+    std::vector<uint32_t> atlasImages;
+    std::vector<byte> discPixels;
 
-    VkShaderModuleCreateInfo shaderCreateInfo = {};
-    shaderCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shaderCreateInfo.codeSize = vsCode.size();
-    // WARNING pCode is pointer to int so bytes must be aligned to 4byte
-    shaderCreateInfo.pCode = (const uint32_t*)vsCode.data();
+    for (uint32_t i = 0; i < 64; i++)
+    {
+        uint32_t size = 8 + (i * 37) % 65;
+        discPixels.resize(size * size * 4);
 
-    VkShaderModule vsModule;
-    assert(vkCreateShaderModule(device, &shaderCreateInfo, nullptr, &vsModule) == VK_SUCCESS);
+        for (uint32_t y = 0; y < size; y++)
+        {
+            for (uint32_t x = 0; x < size; x++)
+            {
+                float dx = (x + 0.5f) / size - 0.5f;
+                float dy = (y + 0.5f) / size - 0.5f;
+                float alpha = 1.0f - sqrtf(dx * dx + dy * dy) * 2.0f;
+                byte* pixel = &discPixels[(y * size + x) * 4];
+
+                pixel[0] = (byte)(128 + 127 * sinf(i * 0.7f));
+                pixel[1] = (byte)(128 + 127 * sinf(i * 1.3f + 2.0f));
+                pixel[2] = (byte)(128 + 127 * sinf(i * 2.1f + 4.0f));
+                pixel[3] = (byte)(alpha > 0 ? 255 * (alpha < 0.2f ? alpha * 5.0f : 1.0f) : 0);
+            }
+        }
 
-    shaderCreateInfo.codeSize = psCode.size();
-    // WARNING pCode is pointer to int so bytes must be aligned to 4byte
-    shaderCreateInfo.pCode = (const uint32_t*)psCode.data();
+        uint32_t id = atlasAddImage(&atlas, discPixels.data(), size, size);
+        if (id != UINT32_MAX)
+            atlasImages.push_back(id);
+    }
 
-    VkShaderModule psModule;
-    assert(vkCreateShaderModule(device, &shaderCreateInfo, nullptr, &psModule) == VK_SUCCESS);
+    // goes out in the same batch as texture and vertices
+    atlasFlush(&atlas, &uploads);
+    printTextureAtlasStats(&atlas);
 
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vsModule;
-    vertShaderStageInfo.pName = "main";
-    // you can set constants in shaders with this
-    //vertShaderStageInfo.pSpecializationInfo = nullptr;
+    /**************************************************************************
+    Vertex buffer
+    Purpose: quad mesh (4 vertices, 6 indices) for the quad and every sprite instance
+    */
+    // position, color, texture coordinate (7 floats per vertex)
+    std::vector<float> vertices{
+            -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+            0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f,
+            -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,
+            0.5f, 0.5f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f,
+    };
+    // gpu gets 12 byte vertices (vertexLayout), counts are stored in the mesh
+    uint32_t vertexCount = (uint32_t)(vertices.size() / 7);
+    std::vector<PackedVertex> packedVertices(vertexCount);
+    packVertices(vertices.data(), vertexCount, packedVertices.data());
 
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = psModule;
-    fragShaderStageInfo.pName = "main";
+    Mesh quadMesh;
+    createMesh(packedVertices.data(), vertexCount, sizeof(PackedVertex),
+        quadIndices, sizeof(quadIndices) / sizeof(quadIndices[0]), &allocator, &uploads, &quadMesh);
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+    // texture and vertices go in one command buffer, nobody waits for it
+    // barriers at the end of the batch and submission order make the data visible to the first frame
+    // with transfer queue the first frame needs the acquire, graphics queue waits for the copy on gpu
+    uint64_t startupUploadToken = submitUploads(&uploads);
+    acquireUploads(&uploads, startupUploadToken);
 
     /**************************************************************************
-    Vertex Input
+    Uniform buffer (and descriptor pool and set to bind them)
+    Purpose: to set data for shaders every frame
+    Note: A uniform buffer is a buffer that is made accessible in a read-only fashion to shaders so that the shaders can read constant parameter data.
+    all per frame data goes to one ring buffer, every frame writes to different part of it
+    so cpu can write next frame while gpu still reads the previous one
     */
-    VkVertexInputBindingDescription vertexInputBindingDescription = {};
-    vertexInputBindingDescription.binding = 0;
-    vertexInputBindingDescription.stride = 7 * sizeof(float);
-    vertexInputBindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-    VkVertexInputAttributeDescription vertexInputAttributeDescription[3] = { {},{}, {} };
-    vertexInputAttributeDescription[0].binding = 0;
-    vertexInputAttributeDescription[0].location = 0;
-    vertexInputAttributeDescription[0].format = VK_FORMAT_R32G32_SFLOAT;
-    vertexInputAttributeDescription[0].offset = 0;
-    vertexInputAttributeDescription[1].binding = 0;
-    vertexInputAttributeDescription[1].location = 1;
-    vertexInputAttributeDescription[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    vertexInputAttributeDescription[1].offset = sizeof(float) * 2;
-    vertexInputAttributeDescription[2].binding = 0;
-    vertexInputAttributeDescription[2].location = 2;
-    vertexInputAttributeDescription[2].format = VK_FORMAT_R32G32_SFLOAT;
-    vertexInputAttributeDescription[2].offset = sizeof(float) * 5;
+    Transform transform;
+
+    // 1MB per frame in flight is enough for thousands of uniform blocks even with 256 byte alignment
+    const VkDeviceSize ringBufferSizePerFrame = 1024 * 1024;
+
+    RingBuffer uniformRing;
+    createRingBuffer(ringBufferSizePerFrame * framesInFlight, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        gpuProperties.limits.minUniformBufferOffsetAlignment, framesInFlight, &allocator, &uniformRing);
+
+    // descriptor sets, every set has one dynamic uniform buffer and two textures (texture and atlas)
+    VkDescriptorPoolSize descriptorSizesPerSet[2] = {};
+    descriptorSizesPerSet[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    descriptorSizesPerSet[0].descriptorCount = 1;
+    descriptorSizesPerSet[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorSizesPerSet[1].descriptorCount = 2;
+
+    // sets that dont change between frames, same bindings give back the same set
+    DescriptorSetCache descriptorCache;
+    createDescriptorSetCache(device, descriptorSizesPerSet, 2, &descriptorCache);
+
+    // offset is 0 here, actual offset is added in vkCmdBindDescriptorSets
+    DescriptorBinding quadBindings[] = {
+        bufferDescriptor(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, uniformRing.buffer, 0, sizeof(transform)),
+        imageDescriptor(1, textureImageView, textureSampler),
+        imageDescriptor(2, atlas.view, textureSampler)
+    };
 
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &vertexInputBindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount = 3;
-    vertexInputInfo.pVertexAttributeDescriptions = vertexInputAttributeDescription;
+    VkDescriptorSet descriptorSet = getCachedDescriptorSet(&descriptorCache, descriptorSetLayout, quadBindings, 3);
 
     /**************************************************************************
-    Viewport
+    Sprite batcher
     */
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)swapChainExtent.width;
-    viewport.height = (float)swapChainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+    SpriteBatcher spriteBatcher;
+    if (spriteCount > 0)
+        createSpriteBatcher(spriteCount, framesInFlight, &allocator, &spriteBatcher);
 
-    VkRect2D scissor = {};
-    scissor.offset = { 0, 0 };
-    scissor.extent = swapChainExtent;
+    // sprites dont move with the quad, they get their own uniform block with identity transform
+    Transform spriteCamera = { 1.0f, 0.0f, 0.0f };
 
-    VkPipelineViewportStateCreateInfo viewportState = {};
-    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
-    viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+    double spriteBuildTotalMs = 0;
+    uint32_t spriteBatchCount = 0;
 
     /**************************************************************************
-    Rasterizer
+    GPU culling
+    Purpose: sprites are written to gpu once, compute shader picks visible ones every frame
+    benchmark always has it so both paths can be compared
     */
-    VkPipelineRasterizationStateCreateInfo rasterizer = {};
-    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
-    rasterizer.depthBiasConstantFactor = 0.0f; // Optional
-    rasterizer.depthBiasClamp = 0.0f; // Optional
-    rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
+    GpuCuller culler;
+    bool cullerCreated = spriteCount > 0 && (gpuCulling || benchFile);
+    // frames draw culled sprites, --gpu-culling without sprites has nothing to cull and no culler
+    bool cullSprites = gpuCulling && spriteCount > 0;
+    // visible sprites read back from finished frames
+    double culledVisibleTotal = 0;
+    uint32_t culledFrameCount = 0;
+    std::vector<bool> culledCountPending(framesInFlight, false);
+
+    if (cullerCreated)
+    {
+        Asset cullCode;
+        assert(loadAsset(assets, "cull_comp.spv", &cullCode));
+
+        shaderCreateInfo.codeSize = cullCode.size;
+        shaderCreateInfo.pCode = (const uint32_t*)cullCode.data;
+
+        VkShaderModule cullModule;
+        assert(vkCreateShaderModule(device, &shaderCreateInfo, nullptr, &cullModule) == VK_SUCCESS);
+        releaseAsset(&cullCode);
+
+        createGpuCuller(device, cullModule, pipelineCache, uniformRing.buffer, gpuProperties.limits, spriteCount, framesInFlight,
+            &allocator, &culler);
+        vkDestroyShaderModule(device, cullModule, nullptr);
+
+        // static scene, same sprites as cpu path at time 0
+        std::vector<SpriteInstance> cullObjects(spriteCount);
+        for (uint32_t i = 0; i < spriteCount; i++)
+            cullObjects[i] = buildDemoSprite(&atlas, atlasImages, 0.0f, i);
+
+        // own small batch, first frame waits for it on gpu like for the startup batch
+        uploadCullObjects(&culler, &uploads, cullObjects.data());
+        acquireUploads(&uploads, submitUploads(&uploads));
+    }
 
     /**************************************************************************
-    Multisampling
+    Command buffers
+    Purpose: one per frame in flight, recorded every frame because image index
+    and frame slot (uniform buffer) dont match
     */
-    VkPipelineMultisampleStateCreateInfo multisampling = {};
-    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-    multisampling.minSampleShading = 1.0f; // Optional
-    multisampling.pSampleMask = nullptr; // Optional
-    multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-    multisampling.alphaToOneEnable = VK_FALSE; // Optional
-    
+    VkCommandBufferAllocateInfo drawCommandAllocInfo = {};
+    drawCommandAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    drawCommandAllocInfo.commandPool = commandPool;
+    drawCommandAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    drawCommandAllocInfo.commandBufferCount = framesInFlight;
+
+    std::vector<VkCommandBuffer> drawCommands;
+    drawCommands.resize(framesInFlight);
+    assert(vkAllocateCommandBuffers(device, &drawCommandAllocInfo, drawCommands.data()) == VK_SUCCESS);
+
     /**************************************************************************
-    Blend
+    Command recorder
+    Purpose: draws inside render pass are recorded on worker threads into secondary command buffers
     */
-    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
+    CommandRecorder recorder;
+    std::vector<VkCommandBuffer> secondaryCommands;
+    if (recordThreadCount > 0)
+        createCommandRecorder(device, queueIndex, recordThreadCount, framesInFlight, &recorder);
 
-    VkPipelineColorBlendStateCreateInfo colorBlending = {};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
+    /**************************************************************************
+    Frame graph
+    Purpose: layout transitions and barriers of the frame come from what passes read and write
+    swapchain (or offscreen) image is imported, it changes every frame but barriers dont
+    */
+    RenderGraph frameGraph;
+    createRenderGraph(&allocator, &frameGraph);
+
+    // acquire semaphore is waited for at color attachment output, so first transition waits there too
+    // old contents are not needed, render pass clears it
+    uint32_t backbuffer = importGraphImage(&frameGraph, "backbuffer", VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0);
+    // headless result is in readback buffer, pass that copies there is kept because it has side effects
+    if (!headless)
+        setGraphOutput(&frameGraph, backbuffer, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+    uint32_t scenePass = addGraphPass(&frameGraph, "scene", false);
+    graphPassWrite(&frameGraph, scenePass, backbuffer, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+
+    uint32_t readbackPass = 0;
+    if (headless)
+    {
+        readbackPass = addGraphPass(&frameGraph, "readback", true);
+        graphPassRead(&frameGraph, readbackPass, backbuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    }
+
+    // capture reads image in the same layout as readback, no barrier between them
+    uint32_t capturePass = 0;
+    if (capturePrefix)
+    {
+        capturePass = addGraphPass(&frameGraph, "capture", true);
+        graphPassRead(&frameGraph, capturePass, backbuffer, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    }
+
+    compileRenderGraph(&frameGraph);
+    printRenderGraphStats(&frameGraph);
 
     /**************************************************************************
-    Render pass and subpass
+    Frame capture
+    Purpose: frames go to disk on other threads, render loop only records a copy
     */
-    VkAttachmentDescription colorAttachment = {};
-    colorAttachment.format = surfaceFormat.format;
-    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    // Optimal for presentation
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    FrameCapture capture;
+    if (capturePrefix)
+    {
+        createFrameCapture(device, &allocator, capturePrefix, captureFormat, captureSlots, captureThreads, &capture);
+        printf("capturing frames to %s*.%s, %u slot(s), %u encoder thread(s)\n", capturePrefix,
+            captureFormat == CAPTURE_FORMAT_PNG ? "png" : "bgra", captureSlots, captureThreads);
+    }
 
-    VkAttachmentReference colorAttachmentRef = {};
-    colorAttachmentRef.attachment = 0;
-    // Optimal as attachment for writing colors from the fragment shader
-    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    /**************************************************************************
+    Semaphores and fences
+    Purpose: semaphores order acquire -> render -> present on gpu,
+    fence tells cpu that frame slot (its command buffer and uniform buffer) is no longer used by gpu
+    */
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-    VkSubpassDescription subpass = {};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef;
+    VkFenceCreateInfo fenceCreateInfo = {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    // signaled so the first wait on every slot returns immediately
+    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-    VkRenderPassCreateInfo renderPassInfo = {};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
-    renderPassInfo.subpassCount = 1;
-    renderPassInfo.pSubpasses = &subpass;
+    std::vector<VkSemaphore> imageAvailableSemaphores(framesInFlight);
+    std::vector<VkSemaphore> renderFinishedSemaphores(framesInFlight);
+    std::vector<VkFence> inFlightFences(framesInFlight);
+
+    for (uint32_t i = 0; i < framesInFlight; i++)
+    {
+        assert(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &imageAvailableSemaphores[i]) == VK_SUCCESS);
+        assert(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &renderFinishedSemaphores[i]) == VK_SUCCESS);
+        assert(vkCreateFence(device, &fenceCreateInfo, nullptr, &inFlightFences[i]) == VK_SUCCESS);
+    }
+
+    // memory used by everything created above
+    printDeviceAllocatorStats(&allocator);
+    // usually still running here, setup of everything after the upload overlapped with the copy
+    printf("startup upload: %llu bytes in %u batch(es), finished before first frame: %s\n",
+        (unsigned long long)uploads.bytesUploaded, uploads.batchesSubmitted,
+        isUploadComplete(&uploads, startupUploadToken) ? "yes" : "no");
+
+    /**************************************************************************
+    Benchmark
+    Purpose: --bench runs fixed scenarios on everything created above instead of the program loop
+    every iteration waits for gpu so iterations dont overlap and time includes gpu work
+    */
+    if (benchFile)
+    {
+        // startup upload is the only thing that could still be running
+        vkDeviceWaitIdle(device);
+
+        BenchReport bench;
+        createBenchReport(benchFile, gpuProperties, benchWarmupIterations, benchIterations, &bench);
+        BenchScenario scenario;
+        char scenarioName[64];
+
+        // first frame slot is used for everything
+        VkCommandBuffer benchCommand = drawCommands[0];
+        VkFence benchFence = inFlightFences[0];
+
+        VkCommandBufferBeginInfo benchBeginInfo = {};
+        benchBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        benchBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        VkSubmitInfo benchSubmitInfo = {};
+        benchSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        benchSubmitInfo.commandBufferCount = 1;
+        benchSubmitInfo.pCommandBuffers = &benchCommand;
+
+        VkRenderPassBeginInfo benchRenderPassInfo = {};
+        benchRenderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        benchRenderPassInfo.renderPass = renderPass;
+        benchRenderPassInfo.framebuffer = swapChainFramebuffers[0];
+        benchRenderPassInfo.renderArea.extent = swapChainExtent;
+        VkClearValue benchClearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+        benchRenderPassInfo.clearValueCount = 1;
+        benchRenderPassInfo.pClearValues = &benchClearColor;
+
+        // chain of offscreen layers, first is cleared, every one is copied to the next one and the last one to target
+        // layers that are not alive at the same time share memory, debug copy is never read so it's culled
+        // runs first because it leaves target in color attachment layout that render pass of other scenarios expects
+        const uint32_t benchLayerCount = 4;
+        RenderGraph benchGraph;
+        createRenderGraph(&allocator, &benchGraph);
+
+        VkImageCreateInfo benchLayerInfo = {};
+        benchLayerInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        benchLayerInfo.imageType = VK_IMAGE_TYPE_2D;
+        benchLayerInfo.extent = { swapChainExtent.width, swapChainExtent.height, 1 };
+        benchLayerInfo.mipLevels = 1;
+        benchLayerInfo.arrayLayers = 1;
+        benchLayerInfo.format = surfaceFormat.format;
+        benchLayerInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        benchLayerInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        benchLayerInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        benchLayerInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        benchLayerInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+        uint32_t benchTarget = importGraphImage(&benchGraph, "target", VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0);
+        setGraphImage(&benchGraph, benchTarget, swapChainImages[0]);
+        setGraphOutput(&benchGraph, benchTarget, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
+
+        uint32_t benchLayers[benchLayerCount];
+        for (uint32_t i = 0; i < benchLayerCount; i++)
+            benchLayers[i] = addGraphTransientImage(&benchGraph, "layer", benchLayerInfo);
+
+        VkImageSubresourceRange benchColorRange = {};
+        benchColorRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        benchColorRange.levelCount = 1;
+        benchColorRange.layerCount = 1;
+        VkClearColorValue benchLayerColor = { { 0.2f, 0.4f, 0.6f, 1.0f } };
+
+        uint32_t benchClearPass = addGraphPass(&benchGraph, "clear layer", false);
+        graphPassWrite(&benchGraph, benchClearPass, benchLayers[0], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT);
+        setGraphPassRecord(&benchGraph, benchClearPass, [&](VkCommandBuffer command)
+        {
+            vkCmdClearColorImage(command, benchGraph.images[benchLayers[0]].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                &benchLayerColor, 1, &benchColorRange);
+        });
+
+        VkImageCopy benchLayerCopy = {};
+        benchLayerCopy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        benchLayerCopy.srcSubresource.layerCount = 1;
+        benchLayerCopy.dstSubresource = benchLayerCopy.srcSubresource;
+        benchLayerCopy.extent = benchLayerInfo.extent;
+
+        // src and dst are graph images, handles of transient ones exist only after compile
+        auto addBenchCopyPass = [&](const char* name, uint32_t src, uint32_t dst)
+        {
+            uint32_t pass = addGraphPass(&benchGraph, name, false);
+            graphPassRead(&benchGraph, pass, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_READ_BIT);
+            graphPassWrite(&benchGraph, pass, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                VK_ACCESS_TRANSFER_WRITE_BIT);
+            setGraphPassRecord(&benchGraph, pass, [&benchGraph, &benchLayerCopy, src, dst](VkCommandBuffer command)
+            {
+                vkCmdCopyImage(command, benchGraph.images[src].image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    benchGraph.images[dst].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &benchLayerCopy);
+            });
+        };
+
+        for (uint32_t i = 1; i < benchLayerCount; i++)
+            addBenchCopyPass("copy layer", benchLayers[i - 1], benchLayers[i]);
+        addBenchCopyPass("copy to target", benchLayers[benchLayerCount - 1], benchTarget);
+        addBenchCopyPass("debug copy", benchLayers[1], addGraphTransientImage(&benchGraph, "debug", benchLayerInfo));
+
+        compileRenderGraph(&benchGraph);
+        printRenderGraphStats(&benchGraph);
+
+        snprintf(scenarioName, sizeof(scenarioName), "render graph %u layers", benchLayerCount);
+        beginBenchScenario(&bench, scenarioName, "frames/s", 1, &scenario);
+
+        while (benchScenarioNext(&scenario))
+        {
+            vkResetCommandBuffer(benchCommand, 0);
+            assert(vkBeginCommandBuffer(benchCommand, &benchBeginInfo) == VK_SUCCESS);
+            executeRenderGraph(&benchGraph, benchCommand);
+            assert(vkEndCommandBuffer(benchCommand) == VK_SUCCESS);
+
+            vkResetFences(device, 1, &benchFence);
+            assert(vkQueueSubmit(queue, 1, &benchSubmitInfo, benchFence) == VK_SUCCESS);
+            vkWaitForFences(device, 1, &benchFence, VK_TRUE, UINT64_MAX);
+        }
+
+        endBenchScenario(&bench, &scenario);
+        destroyRenderGraph(&benchGraph);
+
+        // N textured quads, cpu builds instances, gpu draws them with alpha blending
+        snprintf(scenarioName, sizeof(scenarioName), "draw %u quads", spriteCount);
+        beginBenchScenario(&bench, scenarioName, "quads/s", spriteCount, &scenario);
+
+        while (benchScenarioNext(&scenario))
+        {
+            ringBufferBeginFrame(&uniformRing, 0);
+            DrawParams cameraParams = writeDrawParams(drawLayout, &uniformRing, &spriteCamera);
+
+            spriteBatcherBeginFrame(&spriteBatcher, 0);
+
+            // same time every run so the amount of overdraw doesnt change
+            for (uint32_t i = 0; i < spriteCount; i++)
+                drawSprite(&spriteBatcher, spritePipeline, descriptorSet, buildDemoSprite(&atlas, atlasImages, 0.0f, i));
+
+            vkResetCommandBuffer(benchCommand, 0);
+            assert(vkBeginCommandBuffer(benchCommand, &benchBeginInfo) == VK_SUCCESS);
+            vkCmdBeginRenderPass(benchCommand, &benchRenderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            setViewportAndScissor(benchCommand, swapChainExtent);
+            recordSpriteBatches(&spriteBatcher, benchCommand, drawLayout, quadMesh, cameraParams);
+            vkCmdEndRenderPass(benchCommand);
+            assert(vkEndCommandBuffer(benchCommand) == VK_SUCCESS);
+
+            vkResetFences(device, 1, &benchFence);
+            assert(vkQueueSubmit(queue, 1, &benchSubmitInfo, benchFence) == VK_SUCCESS);
+            vkWaitForFences(device, 1, &benchFence, VK_TRUE, UINT64_MAX);
+        }
+
+        endBenchScenario(&bench, &scenario);
+
+        // same quads culled and drawn by gpu, once with everything in view and once zoomed in so about 1/4 is visible
+        float benchCullScales[] = { 1.0f, 2.0f };
+
+        for (uint32_t k = 0; k < 2; k++)
+        {
+            snprintf(scenarioName, sizeof(scenarioName), "gpu cull %u quads x%.0f", spriteCount, benchCullScales[k]);
+            beginBenchScenario(&bench, scenarioName, "quads/s", spriteCount, &scenario);
+
+            while (benchScenarioNext(&scenario))
+            {
+                ringBufferBeginFrame(&uniformRing, 0);
+                Transform benchCamera = { benchCullScales[k], 0.0f, 0.0f };
+                DrawParams cameraParams = writeDrawParams(drawLayout, &uniformRing, &benchCamera);
+
+                CullParams cullParams = { benchCamera.scale, benchCamera.x, benchCamera.y, spriteCount };
+                VkDeviceSize cullParamsOffset = 0;
+                void* cullParamsMemory = ringBufferAlloc(&uniformRing, sizeof(cullParams), &cullParamsOffset);
+                assert(cullParamsMemory != nullptr);
+                memcpy(cullParamsMemory, &cullParams, sizeof(cullParams));
+
+                vkResetCommandBuffer(benchCommand, 0);
+                assert(vkBeginCommandBuffer(benchCommand, &benchBeginInfo) == VK_SUCCESS);
+                recordGpuCulling(&culler, benchCommand, quadMesh, 0, (uint32_t)cullParamsOffset);
+                vkCmdBeginRenderPass(benchCommand, &benchRenderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+                setViewportAndScissor(benchCommand, swapChainExtent);
+                recordCulledSprites(&culler, benchCommand, spritePipeline, descriptorSet, drawLayout, quadMesh, cameraParams, 0);
+                vkCmdEndRenderPass(benchCommand);
+                assert(vkEndCommandBuffer(benchCommand) == VK_SUCCESS);
+
+                vkResetFences(device, 1, &benchFence);
+                assert(vkQueueSubmit(queue, 1, &benchSubmitInfo, benchFence) == VK_SUCCESS);
+                vkWaitForFences(device, 1, &benchFence, VK_TRUE, UINT64_MAX);
+            }
+
+            endBenchScenario(&bench, &scenario);
+        }
+
+        // cpu side only, build + record on 1, 2, 4 ... workers, nothing is submitted
+        std::vector<uint32_t> benchThreadCounts;
+        for (uint32_t threads = 1; threads < recordThreadCount; threads *= 2)
+            benchThreadCounts.push_back(threads);
+        if (recordThreadCount > 0)
+            benchThreadCounts.push_back(recordThreadCount);
+
+        for (size_t k = 0; k < benchThreadCounts.size(); k++)
+        {
+            uint32_t threads = benchThreadCounts[k];
+            uint32_t firstBenchSprite = 0;
+            DrawParams cameraParams = {};
+
+            RecordTask benchTask = [&](uint32_t task, uint32_t taskCount, VkCommandBuffer command)
+            {
+                uint32_t first = spriteCount * task / taskCount;
+                uint32_t end = spriteCount * (task + 1) / taskCount;
+
+                for (uint32_t i = first; i < end; i++)
+                    spriteBatcher.instances[firstBenchSprite + i] = buildDemoSprite(&atlas, atlasImages, 0.0f, i);
+
+                setViewportAndScissor(command, swapChainExtent);
+                recordSpriteInstances(&spriteBatcher, command, spritePipeline, descriptorSet, drawLayout, quadMesh,
+                    cameraParams, firstBenchSprite + first, end - first);
+            };
+
+            snprintf(scenarioName, sizeof(scenarioName), "record %u quads %u thread(s)", spriteCount, threads);
+            beginBenchScenario(&bench, scenarioName, "quads/s", spriteCount, &scenario);
+
+            while (benchScenarioNext(&scenario))
+            {
+                ringBufferBeginFrame(&uniformRing, 0);
+                cameraParams = writeDrawParams(drawLayout, &uniformRing, &spriteCamera);
+
+                spriteBatcherBeginFrame(&spriteBatcher, 0);
+                // not inside assert, without asserts nothing would be reserved
+                SpriteInstance* benchSprites = reserveSprites(&spriteBatcher, spritePipeline, descriptorSet, spriteCount, &firstBenchSprite);
+                assert(benchSprites != nullptr);
+
+                vkResetCommandBuffer(benchCommand, 0);
+                assert(vkBeginCommandBuffer(benchCommand, &benchBeginInfo) == VK_SUCCESS);
+                vkCmdBeginRenderPass(benchCommand, &benchRenderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+                recordSecondaryCommands(&recorder, 0, threads, renderPass, swapChainFramebuffers[0], benchTask, secondaryCommands);
+                vkCmdExecuteCommands(benchCommand, (uint32_t)secondaryCommands.size(), secondaryCommands.data());
+                vkCmdEndRenderPass(benchCommand);
+                assert(vkEndCommandBuffer(benchCommand) == VK_SUCCESS);
+            }
+
+            endBenchScenario(&bench, &scenario);
+        }
 
-    VkRenderPass renderPass;
-    assert(vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) == VK_SUCCESS);
+        // staging bandwidth, memcpy to ring + vkCmdCopyBuffer to device local buffer
+        const uint32_t benchUploadSize = 4 * 1024 * 1024;
+        std::vector<byte> benchData(benchUploadSize);
+        for (uint32_t i = 0; i < benchUploadSize; i++)
+            benchData[i] = (byte)(i * 31);
 
+        VkBuffer benchBuffer;
+        MemoryAllocation benchBufferMemory;
+        createBuffer(benchUploadSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, &allocator, &benchBuffer,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &benchBufferMemory);
 
-    /**************************************************************************
-    Pipeline
-    */
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
+        beginBenchScenario(&bench, "staging upload 4MB", "MB/s", benchUploadSize / (1024.0 * 1024.0), &scenario);
 
-    VkPipelineLayout pipelineLayout;
-    assert(vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) == VK_SUCCESS);
+        while (benchScenarioNext(&scenario))
+        {
+            uploadBuffer(&uploads, benchBuffer, 0, benchData.data(), benchUploadSize);
+            waitForUpload(&uploads, submitUploads(&uploads));
+        }
 
-    VkPipelineInputAssemblyStateCreateInfo pipelineInputAssembly = {};
-    pipelineInputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    pipelineInputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
-    pipelineInputAssembly.primitiveRestartEnable = VK_FALSE;
+        endBenchScenario(&bench, &scenario);
+        destroyBuffer(&allocator, benchBuffer, &benchBufferMemory);
+
+        // 1024x1024 rgba texture, copy and both layout transitions
+        VkImageCreateInfo benchImageCreateInfo = {};
+        benchImageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        benchImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        benchImageCreateInfo.extent = { 1024, 1024, 1 };
+        benchImageCreateInfo.mipLevels = 1;
+        benchImageCreateInfo.arrayLayers = 1;
+        benchImageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        benchImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        benchImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        benchImageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        benchImageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        benchImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkImage benchImage;
+        MemoryAllocation benchImageMemory;
+        createImage(&benchImageCreateInfo, &allocator, &benchImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &benchImageMemory);
+
+        VkImageSubresourceRange benchImageRange = {};
+        benchImageRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        benchImageRange.levelCount = 1;
+        benchImageRange.layerCount = 1;
+
+        VkBufferImageCopy benchImageRegion = {};
+        benchImageRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        benchImageRegion.imageSubresource.layerCount = 1;
+        benchImageRegion.imageExtent = { 1024, 1024, 1 };
+
+        beginBenchScenario(&bench, "texture upload 1024x1024", "MB/s", benchUploadSize / (1024.0 * 1024.0), &scenario);
+
+        while (benchScenarioNext(&scenario))
+        {
+            // undefined because contents are replaced anyway
+            uploadImage(&uploads, benchImage, benchImageRange, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                benchData.data(), benchUploadSize, &benchImageRegion, 1);
+            waitForUpload(&uploads, submitUploads(&uploads));
+        }
 
-    VkGraphicsPipelineCreateInfo pipelineInfo = {};
-    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &pipelineInputAssembly;
-    pipelineInfo.pViewportState = &viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.layout = pipelineLayout;
-    pipelineInfo.renderPass = renderPass;
-    pipelineInfo.subpass = 0;
+        endBenchScenario(&bench, &scenario);
+
+        // transitions alone, difference to texture upload is the copy
+        VkImageMemoryBarrier benchBarriers[2] = {};
+        benchBarriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        benchBarriers[0].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        benchBarriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        benchBarriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        benchBarriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        benchBarriers[0].image = benchImage;
+        benchBarriers[0].subresourceRange = benchImageRange;
+        benchBarriers[0].srcAccessMask = 0;
+        benchBarriers[0].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        benchBarriers[1] = benchBarriers[0];
+        benchBarriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        benchBarriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        benchBarriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        benchBarriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        beginBenchScenario(&bench, "image layout transitions", "transitions/s", 2, &scenario);
+
+        while (benchScenarioNext(&scenario))
+        {
+            vkResetCommandBuffer(benchCommand, 0);
+            assert(vkBeginCommandBuffer(benchCommand, &benchBeginInfo) == VK_SUCCESS);
+            vkCmdPipelineBarrier(benchCommand, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &benchBarriers[0]);
+            vkCmdPipelineBarrier(benchCommand, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                0, 0, nullptr, 0, nullptr, 1, &benchBarriers[1]);
+            assert(vkEndCommandBuffer(benchCommand) == VK_SUCCESS);
+
+            vkResetFences(device, 1, &benchFence);
+            assert(vkQueueSubmit(queue, 1, &benchSubmitInfo, benchFence) == VK_SUCCESS);
+            vkWaitForFences(device, 1, &benchFence, VK_TRUE, UINT64_MAX);
+        }
 
-    VkPipeline graphicsPipeline;
-    assert(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) == VK_SUCCESS);
+        endBenchScenario(&bench, &scenario);
+        destroyImage(&allocator, benchImage, &benchImageMemory);
 
-    // it can be destroyed now because modelues were compiled to machine code and stored in the pipeline
-    vkDestroyShaderModule(device, psModule, nullptr);
-    vkDestroyShaderModule(device, vsModule, nullptr);
+        // cpu fallback for devices without BC, bench data as blocks goes through all modes
+        std::vector<byte> benchDecoded(1024 * 1024 * 4);
+        beginBenchScenario(&bench, "BC7 cpu decode 1024x1024", "MP/s", 1024 * 1024 / 1e6, &scenario);
 
-    /**************************************************************************
-    Frame buffer
-    */
-    std::vector<VkFramebuffer> swapChainFramebuffers;
-    swapChainFramebuffers.resize(swapChainImageViews.size());
+        while (benchScenarioNext(&scenario))
+            decodeTextureLevel(*findTextureFormat(VK_FORMAT_BC7_UNORM_BLOCK), benchData.data(), 1024, 1024, benchDecoded.data());
 
-    for (size_t i = 0; i < swapChainImageViews.size(); i++)
-    {
-        VkFramebufferCreateInfo framebufferInfo = {};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = renderPass;
-        framebufferInfo.attachmentCount = 1;
-        framebufferInfo.pAttachments = swapChainImageViews.data() + i;
-        framebufferInfo.width = swapChainExtent.width;
-        framebufferInfo.height = swapChainExtent.height;
-        framebufferInfo.layers = 1;
+        endBenchScenario(&bench, &scenario);
 
-        assert(vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) == VK_SUCCESS);
-    }
+        // 28 byte float vertices to 12 byte PackedVertex, benchData bytes as floats 0..1
+        const uint32_t benchVertexCount = 256 * 1024;
+        std::vector<float> benchVertices(benchVertexCount * 7);
+        for (size_t i = 0; i < benchVertices.size(); i++)
+            benchVertices[i] = benchData[i % benchData.size()] / 255.0f;
+        std::vector<PackedVertex> benchPacked(benchVertexCount);
 
-    /**************************************************************************
-    Command pool
-    */
-    VkCommandPoolCreateInfo commandPoolCreateInfo = {};
-    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    commandPoolCreateInfo.queueFamilyIndex = queueIndex;
-    // this can be used to indicate that commands will be shortlived
-    //commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        beginBenchScenario(&bench, "pack 256K vertices", "Mverts/s", benchVertexCount / 1e6, &scenario);
 
-    VkCommandPool commandPool;
-    assert(vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &commandPool) == VK_SUCCESS);
-    
-    /**************************************************************************
-    Image (for texture)
-    */
-    std::vector<unsigned char> textureBytes;
-    struct { float w, h, size; } textureSize = { 25,25, 25 * 25 * 4 };
+        while (benchScenarioNext(&scenario))
+            packVertices(benchVertices.data(), benchVertexCount, benchPacked.data());
 
-    for (int i = 0; i < textureSize.h; i++)
-    {
-        for (int j = 0; j < textureSize.w; j++)
+        endBenchScenario(&bench, &scenario);
+
+        // cpu only, set is not used by any command buffer in flight so it can be written
+        const uint32_t benchDescriptorUpdates = 1000;
+        beginBenchScenario(&bench, "descriptor updates", "updates/s", benchDescriptorUpdates, &scenario);
+
+        while (benchScenarioNext(&scenario))
         {
-            unsigned char color = (i + j) % 2 ? 255 : 0;
+            for (uint32_t i = 0; i < benchDescriptorUpdates; i++)
+                writeDescriptorSet(device, descriptorSet, quadBindings, 3);
+        }
+
+        endBenchScenario(&bench, &scenario);
 
-            textureBytes.push_back(color);
-            textureBytes.push_back(color);
-            textureBytes.push_back(color);
-            textureBytes.push_back(255);
+        // same bindings again, set comes from the cache and is not written
+        beginBenchScenario(&bench, "descriptor cache lookups", "lookups/s", benchDescriptorUpdates, &scenario);
+
+        while (benchScenarioNext(&scenario))
+        {
+            for (uint32_t i = 0; i < benchDescriptorUpdates; i++)
+                getCachedDescriptorSet(&descriptorCache, descriptorSetLayout, quadBindings, 3);
         }
-    }
 
-    // staging buffer
-    VkBuffer textureStagingBuffer;
-    VkDeviceMemory textureStagingBufferMemory;
+        endBenchScenario(&bench, &scenario);
+
+        // new sets every iteration like per frame data, iteration is a frame so slot pools are reset instead of freeing sets
+        // nothing in flight uses them, slots can be reset without waiting for fences
+        // frames only use cached sets (per draw data has dynamic offsets), per frame allocator lives only here
+        DescriptorAllocator frameDescriptors;
+        createDescriptorAllocator(device, descriptorSizesPerSet, 2, 4, framesInFlight, &frameDescriptors);
+        const uint32_t benchFrameSets = 256;
+        uint32_t benchFrameSlot = 0;
+        beginBenchScenario(&bench, "per-frame descriptor sets", "sets/s", benchFrameSets, &scenario);
 
-    createBuffer(textureSize.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, device, &textureStagingBuffer,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memProperties, &textureStagingBufferMemory);
+        while (benchScenarioNext(&scenario))
+        {
+            descriptorAllocatorBeginFrame(&frameDescriptors, benchFrameSlot);
+            benchFrameSlot = (benchFrameSlot + 1) % framesInFlight;
+
+            for (uint32_t i = 0; i < benchFrameSets; i++)
+            {
+                VkDescriptorSet set = allocateDescriptorSet(&frameDescriptors, descriptorSetLayout);
+                writeDescriptorSet(device, set, quadBindings, 3);
+            }
+        }
 
-    void* mappedStagingTextureBufferMemory;
-    vkMapMemory(device, textureStagingBufferMemory, 0, textureSize.size, 0, &mappedStagingTextureBufferMemory);
-    memcpy(mappedStagingTextureBufferMemory, textureBytes.data(), (size_t)textureSize.size);
-    vkUnmapMemory(device, textureStagingBufferMemory);
+        endBenchScenario(&bench, &scenario);
+        // pool count stays small if reset pools are reused
+        printf("per-frame descriptor sets: %u allocated from %u pool(s)\n", frameDescriptors.setsAllocated, frameDescriptors.poolCount);
+        destroyDescriptorAllocator(&frameDescriptors);
 
-    // image
-    // it's possible to write texture data to VkBuffer but VkImage has more utility and it's faster
-    // VkImage is VkBuffer but for images
-    VkImage textureImage;
-    VkDeviceMemory textureImageMemory;
+        // pipelines are destroyed after scenario so destroy time isnt measured
+        std::vector<VkPipeline> benchPipelines;
+        benchPipelines.reserve(benchWarmupIterations + benchIterations);
 
-    VkImageCreateInfo textureImageCreateInfo = {};
-    textureImageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    textureImageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-    textureImageCreateInfo.extent.width = (uint32_t)textureSize.w;
-    textureImageCreateInfo.extent.height = (uint32_t)textureSize.h;
-    textureImageCreateInfo.extent.depth = 1;
-    textureImageCreateInfo.mipLevels = 1;
-    textureImageCreateInfo.arrayLayers = 1;
-    textureImageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-    textureImageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    textureImageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    textureImageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-    textureImageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    textureImageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        // cache already has this pipeline, so this is the lookup (warm start)
+        beginBenchScenario(&bench, "pipeline create cached", "pipelines/s", 1, &scenario);
 
-    assert(vkCreateImage(device, &textureImageCreateInfo, nullptr, &textureImage) == VK_SUCCESS);
+        while (benchScenarioNext(&scenario))
+        {
+            VkPipeline pipeline;
+            assert(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) == VK_SUCCESS);
+            benchPipelines.push_back(pipeline);
+        }
 
-    VkMemoryRequirements memRequirementsForTextureImageMemory;
-    vkGetImageMemoryRequirements(device, textureImage, &memRequirementsForTextureImageMemory);
+        endBenchScenario(&bench, &scenario);
 
-    VkMemoryPropertyFlags desiredTextureImageMemoryFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    uint32_t textureImageMemoryTypeIndex = -1;
+        // no application cache, driver can still have its own (mesa has a disk cache)
+        beginBenchScenario(&bench, "pipeline create uncached", "pipelines/s", 1, &scenario);
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-    {
-        if ((memRequirementsForTextureImageMemory.memoryTypeBits & (1 << i)) &&
-            (memProperties.memoryTypes[i].propertyFlags & desiredTextureImageMemoryFlags) == desiredTextureImageMemoryFlags)
+        while (benchScenarioNext(&scenario))
         {
-            textureImageMemoryTypeIndex = i;
-            break;
+            VkPipeline pipeline;
+            assert(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) == VK_SUCCESS);
+            benchPipelines.push_back(pipeline);
         }
-    }
 
-    assert(textureImageMemoryTypeIndex != -1);
+        endBenchScenario(&bench, &scenario);
 
-    VkMemoryAllocateInfo textureImageMemoryAllocInfo = {};
-    textureImageMemoryAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    textureImageMemoryAllocInfo.allocationSize = memRequirementsForTextureImageMemory.size;
-    textureImageMemoryAllocInfo.memoryTypeIndex = textureImageMemoryTypeIndex;
+        for (size_t i = 0; i < benchPipelines.size(); i++)
+            vkDestroyPipeline(device, benchPipelines[i], nullptr);
 
-    assert(vkAllocateMemory(device, &textureImageMemoryAllocInfo, nullptr, &textureImageMemory) == VK_SUCCESS);
-    vkBindImageMemory(device, textureImage, textureImageMemory, 0);
-    
-    // copy from staging to image
-
-    // staging buffer now contains image in linear format (first row, then second row etc.)
-    // however, image has specified tiling VK_IMAGE_TILING_OPTIMAL which is implementation specific (meaning undefiend for programmer) layout
-    // liner has to be transformed to this optimal
-    // image layout transition
-
-    VkCommandBufferAllocateInfo stagingToImageCopyCommandAllocInfo = {};
-    stagingToImageCopyCommandAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    stagingToImageCopyCommandAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    stagingToImageCopyCommandAllocInfo.commandPool = commandPool;
-    stagingToImageCopyCommandAllocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer stagingToImageCopyCommand;
-    assert(vkAllocateCommandBuffers(device, &stagingToImageCopyCommandAllocInfo, &stagingToImageCopyCommand) == VK_SUCCESS);
-
-    VkCommandBufferBeginInfo stagingToImageCopyCommandBeginInfo = {};
-    stagingToImageCopyCommandBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    stagingToImageCopyCommandBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-    assert(vkBeginCommandBuffer(stagingToImageCopyCommand, &stagingToImageCopyCommandBeginInfo) == VK_SUCCESS);
-
-    // Transition the texture image layout to transfer target, so we can safely copy our buffer data to it.
-    VkImageMemoryBarrier imageMemoryBarrier = {};
-    imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    imageMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    imageMemoryBarrier.image = textureImage;
-    imageMemoryBarrier.srcAccessMask = 0;
-    imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    // The sub resource range describes the regions of the image that will be transitioned using the memory barriers below
-    // Image only contains color data
-    imageMemoryBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    // Start at first mip level
-    imageMemoryBarrier.subresourceRange.baseMipLevel = 0;
-    // We will transition on all mip levels (there is 1 only)
-    imageMemoryBarrier.subresourceRange.levelCount = textureImageCreateInfo.mipLevels;
-    imageMemoryBarrier.subresourceRange.baseArrayLayer = 0;
-    // The 2D texture only has one layer
-    imageMemoryBarrier.subresourceRange.layerCount = 1;
-
-    // Insert a memory dependency at the proper pipeline stages that will execute the image layout transition 
-    // Source pipeline stage is host write/read exection (VK_PIPELINE_STAGE_HOST_BIT)
-    // Destination pipeline stage is copy command exection (VK_PIPELINE_STAGE_TRANSFER_BIT)
-    vkCmdPipelineBarrier(stagingToImageCopyCommand, VK_PIPELINE_STAGE_HOST_BIT, 
-        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-
-    // this needs to be declared for every mip level
-    // and then in vkCmdCopyBufferToImage you send array of these
-    // fortunetely i dont care and im doing only one
-    VkBufferImageCopy bufferToImage = {};
-    bufferToImage.bufferOffset = 0;
-    bufferToImage.bufferRowLength = 0;
-    bufferToImage.bufferImageHeight = 0;
-    bufferToImage.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    bufferToImage.imageSubresource.mipLevel = 0;
-    bufferToImage.imageSubresource.baseArrayLayer = 0;
-    bufferToImage.imageSubresource.layerCount = 1;
-    bufferToImage.imageOffset = { 0, 0, 0 };
-    bufferToImage.imageExtent = { (uint32_t)textureSize.w, (uint32_t)textureSize.h, 1 };
-
-    vkCmdCopyBufferToImage(stagingToImageCopyCommand, textureStagingBuffer, textureImage, 
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &bufferToImage);
-
-    // Once the data has been uploaded we transfer to the texture image to the shader read layout, so it can be sampled from
-    imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-    // Insert a memory dependency at the proper pipeline stages that will execute the image layout transition 
-    // Source pipeline stage stage is copy command exection (VK_PIPELINE_STAGE_TRANSFER_BIT)
-    // Destination pipeline stage fragment shader access (VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT)
-    vkCmdPipelineBarrier(stagingToImageCopyCommand, VK_PIPELINE_STAGE_TRANSFER_BIT, 
-        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-
-    assert(vkEndCommandBuffer(stagingToImageCopyCommand) == VK_SUCCESS);
-
-    VkSubmitInfo stagingToImageCopyCommandSubmitInfo = {};
-    stagingToImageCopyCommandSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    stagingToImageCopyCommandSubmitInfo.commandBufferCount = 1;
-    stagingToImageCopyCommandSubmitInfo.pCommandBuffers = &stagingToImageCopyCommand;
-
-    vkQueueSubmit(queue, 1, &stagingToImageCopyCommandSubmitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(queue);
-
-    // this stuff is no longer needed
-    vkFreeCommandBuffers(device, commandPool, 1, &stagingToImageCopyCommand);
-    vkDestroyBuffer(device, textureStagingBuffer, nullptr);
-    vkFreeMemory(device, textureStagingBufferMemory, nullptr);
+        closeBenchReport(&bench);
+        printf("benchmark results written to %s\n", benchFile);
 
-    // image view for texture
-    VkImageViewCreateInfo textureImageViewCreateInfo = {};
-    textureImageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    textureImageViewCreateInfo.image = textureImage;
-    textureImageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    textureImageViewCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
-    textureImageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    textureImageViewCreateInfo.subresourceRange.baseMipLevel = 0;
-    textureImageViewCreateInfo.subresourceRange.levelCount = 1;
-    textureImageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
-    textureImageViewCreateInfo.subresourceRange.layerCount = 1;
+        // skip program loop, clean up is the same
+        headlessFrameCount = 0;
+    }
 
-    VkImageView textureImageView;
-    assert(vkCreateImageView(device, &textureImageViewCreateInfo, nullptr, &textureImageView) == VK_SUCCESS);
+    //
+    // program loop ***********************************************************
+    //
+    int frame = 0;
+    // set by resize, acquire and present, swapchain is recreated before next acquire
+    bool swapChainOutOfDate = false;
+    uint32_t swapChainRecreateCount = 0;
+    double fenceWaitTotalMs = 0;
+    double fenceWaitMaxMs = 0;
+    auto loopStart = std::chrono::steady_clock::now();
+
+    // static, histograms are too big for stack
+    static CpuProfiler cpuProfiler;
+    createCpuProfiler(2.0f, &cpuProfiler);
+    auto lastCpuReport = loopStart;
 
-    /**************************************************************************
-    Sampler
-    */
-    VkSamplerCreateInfo samplerCreateInfo = {};
-    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerCreateInfo.magFilter = VK_FILTER_NEAREST; // VK_FILTER_LINEAR;
-    samplerCreateInfo.minFilter = VK_FILTER_NEAREST; // VK_FILTER_LINEAR;
-    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    // this doesnt matter in VK_SAMPLER_ADDRESS_MODE_REPEAT mode but it has to be specified (i think)
-    samplerCreateInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-    // im not using that
-    // you must check if pysical devices has this feature enabled
-    //samplerCreateInfo.anisotropyEnable = VK_TRUE;
-    //samplerCreateInfo.maxAnisotropy = 16;
-    // unnormalizedCoordinates uses coordinates in pixels for texture instead of [0,1]
-    samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
-    // this is some advance feature
-    samplerCreateInfo.compareEnable = VK_FALSE;
-    samplerCreateInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-    // dont care about mips
-    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
-    samplerCreateInfo.mipLodBias = 0.0f;
-    samplerCreateInfo.minLod = 0.0f;
-    samplerCreateInfo.maxLod = 0.0f;
+    while (true)
+    {
+        if (headless)
+        {
+            if (frame == (int)headlessFrameCount)
+                break;
+        }
+        else
+        {
+#ifdef _WIN32
+            MSG msg = {};
+            bool quit = false;
+            bool slept = false;
 
-    VkSampler textureSampler;
-    assert(vkCreateSampler(device, &samplerCreateInfo, nullptr, &textureSampler) == VK_SUCCESS);
+            while (!quit)
+            {
+                if (!PeekMessage(&msg, 0, 0, 0, PM_REMOVE))
+                {
+                    // minimized window has nothing to draw into, sleep until a message comes (restore, close)
+                    // instead of spinning through failed acquires
+                    if (!windowState.minimized)
+                        break;
+
+                    WaitMessage();
+                    slept = true;
+                    continue;
+                }
+
+                TranslateMessage(&msg);
+                DispatchMessage(&msg);
+
+                if (msg.message == WM_QUIT)
+                    quit = true;
+            }
 
-    /**************************************************************************
-    Vertex buffer
-    */
-    std::vector<float> vertices{
-            -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f,
-            0.5f, -0.5f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f,
-            -0.5f, 0.5f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f,
-            0.5f, 0.5f, 0.0f, 1.0f, 1.0f, 0.0f, 1.0f,
-    };
-    
-    // staging buffer
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+            if (quit)
+                break;
 
-    createBuffer(sizeof(float) * vertices.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, device, &stagingBuffer,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memProperties, &stagingBufferMemory);
+            if (windowState.resized)
+            {
+                swapChainOutOfDate = true;
+                windowState.resized = false;
+            }
 
-    void* mappedStagingBufferMemory = nullptr;
-    vkMapMemory(device, stagingBufferMemory, 0, sizeof(float) * vertices.size(), 0, &mappedStagingBufferMemory);
-    memcpy(mappedStagingBufferMemory, vertices.data(), sizeof(float) * vertices.size());
-    vkUnmapMemory(device, stagingBufferMemory);
+            // time spent minimized is not a slow frame
+            if (slept)
+                resumeCpuProfiler(&cpuProfiler);
+#endif
+        }
 
-    // vertex buffer
-    VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+        endCpuPhase(&cpuProfiler, CPU_PHASE_MESSAGES);
+        // everything after this (waits included) is latency between input and its result on screen
+        markCpuInput(&cpuProfiler);
 
-    createBuffer(sizeof(float) * vertices.size(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-        device, &vertexBuffer, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, memProperties, &vertexBufferMemory);
+        //
+        // draw ***************************************************************
+        //
+        uint32_t frameSlot = frame % framesInFlight;
+
+        // wait until gpu is done with frame that used this slot framesInFlight frames ago
+        // this is the only place where cpu waits for gpu, time spent here is reported at the end
+        auto fenceWaitStart = std::chrono::steady_clock::now();
+        vkWaitForFences(device, 1, &inFlightFences[frameSlot], VK_TRUE, UINT64_MAX);
+        double fenceWaitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - fenceWaitStart).count();
+        fenceWaitTotalMs += fenceWaitMs;
+        if (fenceWaitMs > fenceWaitMaxMs)
+            fenceWaitMaxMs = fenceWaitMs;
+        endCpuPhase(&cpuProfiler, CPU_PHASE_FENCE_WAIT);
+
+        // every frame up to the one that used this slot before is done, swapchains retired before that can go
+        destroyRetiredSwapchains(device, &retiredSwapchains, frame - (int)framesInFlight);
+
+        if (cullerCreated && culledCountPending[frameSlot])
+        {
+            culledVisibleTotal += culledSpriteCount(&culler, frameSlot);
+            culledFrameCount++;
+            culledCountPending[frameSlot] = false;
+        }
 
-    // copy from staging to vertex buffer
-    VkCommandBufferAllocateInfo stagingToVertexCopyCommandAllocInfo = {};
-    stagingToVertexCopyCommandAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    stagingToVertexCopyCommandAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    stagingToVertexCopyCommandAllocInfo.commandPool = commandPool;
-    stagingToVertexCopyCommandAllocInfo.commandBufferCount = 1;
+        if (!headless && swapChainOutOfDate)
+        {
+            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
+#ifdef _WIN32
+            RECT clientRect = {};
+            GetClientRect(hwnd, &clientRect);
+            width = (uint32_t)(clientRect.right - clientRect.left);
+            height = (uint32_t)(clientRect.bottom - clientRect.top);
+#endif
+            VkExtent2D extent = chooseSwapchainExtent(surfaceCapabilities, width, height);
+
+            if (extent.width == 0 || extent.height == 0)
+            {
+                // fence of this slot is still signaled so next iteration doesnt wait, message loop sleeps instead
+#ifdef _WIN32
+                windowState.minimized = true;
+#endif
+                continue;
+            }
 
-    VkCommandBuffer stagingToVertexCopyCommand;
-    assert(vkAllocateCommandBuffers(device, &stagingToVertexCopyCommandAllocInfo, &stagingToVertexCopyCommand) == VK_SUCCESS);
+            // no vkDeviceWaitIdle, frames in flight keep rendering to old swapchain and present its images
+            // old one is destroyed once their fences are waited for (destroyRetiredSwapchains above)
+            RetiredSwapchain retired;
+            retired.swapchain = swapChain;
+            retired.imageViews.swap(swapChainImageViews);
+            retired.framebuffers.swap(swapChainFramebuffers);
+            retired.lastFrame = frame - 1;
+            retiredSwapchains.push_back(retired);
+
+            // render pass and pipelines dont depend on size (format stays the same) so only these are created
+            // command buffers are recorded every frame, next one uses new framebuffer and extent
+            swapChainExtent = extent;
+            frameBufferCount = chooseSwapchainImageCount(surfaceCapabilities, surfacePresentationMode, requestedSwapchainImages);
+            createSwapchain(device, surface, surfaceCapabilities, surfaceFormat, swapChainUsage, surfacePresentationMode, frameBufferCount,
+                swapChainExtent, retired.swapchain, &swapChain, &swapChainImages);
+            frameBufferCount = (uint32_t)swapChainImages.size();
+            createFramebuffers(device, renderPass, surfaceFormat.format, swapChainExtent, swapChainImages,
+                &swapChainImageViews, &swapChainFramebuffers);
+            swapChainOutOfDate = false;
+            swapChainRecreateCount++;
+        }
 
-    VkCommandBufferBeginInfo stagingToVertexCopyCommandBeginInfo = {};
-    stagingToVertexCopyCommandBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    stagingToVertexCopyCommandBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        // headless has one offscreen image per frame slot
+        uint32_t imageIndex = frameSlot;
 
-    assert(vkBeginCommandBuffer(stagingToVertexCopyCommand, &stagingToVertexCopyCommandBeginInfo) == VK_SUCCESS);
+        if (!headless)
+        {
+            // vkAcquireNextImageKHR returns non success if surface changes (more accurately, if surface is not available for presenting)
+            // for example when window is resized or minimalized
+            VkResult acquireResult = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, imageAvailableSemaphores[frameSlot], VK_NULL_HANDLE, &imageIndex);
 
-    VkBufferCopy stagingToVertexCopyRegion = {};
-    stagingToVertexCopyRegion.srcOffset = 0;
-    stagingToVertexCopyRegion.dstOffset = 0;
-    stagingToVertexCopyRegion.size = sizeof(float) * vertices.size();
-    vkCmdCopyBuffer(stagingToVertexCopyCommand, stagingBuffer, vertexBuffer, 1, &stagingToVertexCopyRegion);
+            if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR)
+            {
+                // nothing was acquired and semaphore wont be signaled, it can be used again
+                // swapchain is recreated at the start of next iteration
+                swapChainOutOfDate = true;
+                continue;
+            }
 
-    assert(vkEndCommandBuffer(stagingToVertexCopyCommand) == VK_SUCCESS);
+            // suboptimal image is acquired (semaphore will be signaled) so it is drawn and presented,
+            // swapchain is recreated in next frame
+            assert(acquireResult == VK_SUCCESS || acquireResult == VK_SUBOPTIMAL_KHR);
+            if (acquireResult == VK_SUBOPTIMAL_KHR)
+                swapChainOutOfDate = true;
+        }
 
-    VkSubmitInfo stagingToVertexCopyCommandSubmitInfo = {};
-    stagingToVertexCopyCommandSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    stagingToVertexCopyCommandSubmitInfo.commandBufferCount = 1;
-    stagingToVertexCopyCommandSubmitInfo.pCommandBuffers = &stagingToVertexCopyCommand;
+        endCpuPhase(&cpuProfiler, CPU_PHASE_ACQUIRE);
 
-    vkQueueSubmit(queue, 1, &stagingToVertexCopyCommandSubmitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(queue);
+        // reset only when it's certain that something will be submitted with this fence
+        vkResetFences(device, 1, &inFlightFences[frameSlot]);
 
-    // this stuff is no longer needed
-    vkFreeCommandBuffers(device, commandPool, 1, &stagingToVertexCopyCommand);
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+        // gpu is done with this slot so its part of the ring can be reused
+        ringBufferBeginFrame(&uniformRing, frameSlot);
 
-    /**************************************************************************
-    Uniform buffer (and descriptor pool and set to bind them)
-    Purpose: to set data for shaders every frame
-    Note: A uniform buffer is a buffer that is made accessible in a read-only fashion to shaders so that the shaders can read constant parameter data.
-    */
-    struct { float scale, x, y; } transform;
+        // bindings didnt change so this is a cache hit and no vkUpdateDescriptorSets
+        descriptorSet = getCachedDescriptorSet(&descriptorCache, descriptorSetLayout, quadBindings, 3);
 
-    VkBuffer uniformBuffer;
-    VkDeviceMemory uniformBufferMemory;
+        // streamed data whose copy finished goes to graphics queue before this frame is submitted
+        updateUploads(&uploads);
 
-    createBuffer(sizeof(transform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, device, &uniformBuffer, 
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, memProperties, &uniformBufferMemory);
+        transform.scale = (sinf(frame / 30.0f) + 1) / 2.0f;
+        transform.x = 0;
+        transform.y = sinf(frame / 100.0f);
 
-    // descriptor pool and sets
-    VkDescriptorPoolSize descriptorPoolSizeForUniformBuffer = {};
-    descriptorPoolSizeForUniformBuffer.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorPoolSizeForUniformBuffer.descriptorCount = 1;
+        // pushed while recording or copied to ring (no map/unmap, ring is mapped all the time)
+        DrawParams transformParams = writeDrawParams(drawLayout, &uniformRing, &transform);
 
-    VkDescriptorPoolSize descriptorPoolSizeForSampler = {};
-    descriptorPoolSizeForSampler.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    descriptorPoolSizeForSampler.descriptorCount = 1;
+        DrawParams spriteCameraParams = {};
+        VkDeviceSize cullParamsOffset = 0;
+        uint32_t firstSprite = 0;
 
-    VkDescriptorPoolSize descriptorPoolSizes[] = { descriptorPoolSizeForUniformBuffer, descriptorPoolSizeForSampler };
+        if (cullSprites)
+        {
+            // zoomed in and panning over the scene so some of the sprites are off screen and get culled
+            spriteCamera.scale = 2.0f;
+            spriteCamera.x = 1.5f * sinf(frame / 200.0f);
+            spriteCamera.y = 1.5f * cosf(frame / 270.0f);
+            spriteCameraParams = writeDrawParams(drawLayout, &uniformRing, &spriteCamera);
+
+            // cpu cost doesnt depend on number of sprites, only this goes to gpu
+            CullParams cullParams = { spriteCamera.scale, spriteCamera.x, spriteCamera.y, spriteCount };
+            void* cullParamsMemory = ringBufferAlloc(&uniformRing, sizeof(cullParams), &cullParamsOffset);
+            assert(cullParamsMemory != nullptr);
+            memcpy(cullParamsMemory, &cullParams, sizeof(cullParams));
+
+            spriteBatchCount = 1;
+        }
+        else if (spriteCount > 0)
+        {
+            spriteCameraParams = writeDrawParams(drawLayout, &uniformRing, &spriteCamera);
 
-    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {};
-    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    descriptorPoolCreateInfo.poolSizeCount = 2;
-    descriptorPoolCreateInfo.pPoolSizes = descriptorPoolSizes;
-    // i think this is how many do you need on gpu
-    // i need only 1 because i render one frame at a time
-    descriptorPoolCreateInfo.maxSets = 1;
+            // this is what game code would do every frame, time includes writing instances to gpu memory
+            auto spriteBuildStart = std::chrono::steady_clock::now();
+            spriteBatcherBeginFrame(&spriteBatcher, frameSlot);
 
-    VkDescriptorPool descriptorPool;
-    assert(vkCreateDescriptorPool(device, &descriptorPoolCreateInfo, nullptr, &descriptorPool) == VK_SUCCESS);
+            if (recordThreadCount > 0)
+            {
+                // workers fill their part of instances while recording, see below
+                firstSprite = 0;
+                // not inside assert, without asserts workers would write and draw instances that were never reserved
+                SpriteInstance* reserved = reserveSprites(&spriteBatcher, spritePipeline, descriptorSet, spriteCount, &firstSprite);
+                assert(reserved != nullptr);
+            }
+            else
+            {
+                for (uint32_t i = 0; i < spriteCount; i++)
+                    drawSprite(&spriteBatcher, spritePipeline, descriptorSet, buildDemoSprite(&atlas, atlasImages, frame / 60.0f, i));
 
-    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {};
-    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    descriptorSetAllocateInfo.descriptorPool = descriptorPool;
-    descriptorSetAllocateInfo.descriptorSetCount = 1;
-    descriptorSetAllocateInfo.pSetLayouts = &descriptorSetLayout;
+                spriteBuildTotalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - spriteBuildStart).count();
+            }
 
-    // tutorial used 3 sets (1 per frame) but since I only render one frame at a time
-    // create only 1 set
-    VkDescriptorSet descriptorSet;
-    // You don't need to explicitly clean up descriptor sets, because they will be automatically freed when the descriptor pool is destroyed
-    assert(vkAllocateDescriptorSets(device, &descriptorSetAllocateInfo, &descriptorSet) == VK_SUCCESS);
-
-    VkDescriptorBufferInfo descriptorUniformBufferInfo = {};
-    descriptorUniformBufferInfo.buffer = uniformBuffer;
-    descriptorUniformBufferInfo.offset = 0;
-    descriptorUniformBufferInfo.range = sizeof(transform);
-
-    VkDescriptorImageInfo descriptorImageInfo = {};
-    descriptorImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    descriptorImageInfo.imageView = textureImageView;
-    descriptorImageInfo.sampler = textureSampler;
-
-    VkWriteDescriptorSet descriptorWriteForUniformBuffer = {};
-    descriptorWriteForUniformBuffer.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWriteForUniformBuffer.dstSet = descriptorSet;
-    descriptorWriteForUniformBuffer.dstBinding = 0;
-    descriptorWriteForUniformBuffer.dstArrayElement = 0;
-    descriptorWriteForUniformBuffer.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWriteForUniformBuffer.descriptorCount = 1;
-    descriptorWriteForUniformBuffer.pBufferInfo = &descriptorUniformBufferInfo;
-
-    VkWriteDescriptorSet descriptorWriteForImage = {};
-    descriptorWriteForImage.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWriteForImage.dstSet = descriptorSet;
-    descriptorWriteForImage.dstBinding = 1;
-    descriptorWriteForImage.dstArrayElement = 0;
-    descriptorWriteForImage.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    descriptorWriteForImage.descriptorCount = 1;
-    descriptorWriteForImage.pImageInfo = &descriptorImageInfo;
-
-    VkWriteDescriptorSet descriptorWrites[] = { descriptorWriteForUniformBuffer, descriptorWriteForImage };
-    vkUpdateDescriptorSets(device, 2, descriptorWrites, 0, nullptr);
+            spriteBatchCount = (uint32_t)spriteBatcher.batches.size();
+        }
 
-    /**************************************************************************
-    Command buffers
-    */
-    VkCommandBufferAllocateInfo drawCommandAllocInfo = {};
-    drawCommandAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    drawCommandAllocInfo.commandPool = commandPool;
-    drawCommandAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    drawCommandAllocInfo.commandBufferCount = (uint32_t)swapChainFramebuffers.size();
+        endCpuPhase(&cpuProfiler, CPU_PHASE_UPDATE);
 
-    std::vector<VkCommandBuffer> drawCommands;
-    drawCommands.resize(swapChainFramebuffers.size());
-    assert(vkAllocateCommandBuffers(device, &drawCommandAllocInfo, drawCommands.data()) == VK_SUCCESS);
+        VkCommandBuffer drawCommand = drawCommands[frameSlot];
+        vkResetCommandBuffer(drawCommand, 0);
 
-    for (size_t i = 0; i < drawCommands.size(); i++)
-    {
         VkCommandBufferBeginInfo drawCommandBeginInfo = {};
         drawCommandBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        drawCommandBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        drawCommandBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-        assert(vkBeginCommandBuffer(drawCommands[i], &drawCommandBeginInfo) == VK_SUCCESS);
+        assert(vkBeginCommandBuffer(drawCommand, &drawCommandBeginInfo) == VK_SUCCESS);
+
+        // fence of this slot was waited for above, results of its previous frame are ready
+        beginGpuProfilerFrame(&frameProfiler, frameSlot, drawCommand, frame);
+        beginGpuScope(&frameProfiler, drawCommand, "frame");
+
+        if (cullSprites)
+        {
+            // compute can't run inside render pass
+            beginGpuScope(&frameProfiler, drawCommand, "cull");
+            recordGpuCulling(&culler, drawCommand, quadMesh, frameSlot, (uint32_t)cullParamsOffset);
+            endGpuScope(&frameProfiler, drawCommand);
+        }
 
         VkRenderPassBeginInfo renderPassBeginInfo = {};
         renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
         renderPassBeginInfo.renderPass = renderPass;
-        renderPassBeginInfo.framebuffer = swapChainFramebuffers[i];
+        renderPassBeginInfo.framebuffer = swapChainFramebuffers[imageIndex];
         renderPassBeginInfo.renderArea.offset = { 0, 0 };
         renderPassBeginInfo.renderArea.extent = swapChainExtent;
 
@@ -1048,107 +8641,213 @@ int main()
         renderPassBeginInfo.clearValueCount = 1;
         renderPassBeginInfo.pClearValues = &clearColor;
 
-        vkCmdBeginRenderPass(drawCommands[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindPipeline(drawCommands[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+        // image index is known only now, barriers around the passes come from the graph
+        setGraphImage(&frameGraph, backbuffer, swapChainImages[imageIndex]);
 
-        VkDeviceSize vbOffsets[] = { 0 };
-        vkCmdBindVertexBuffers(drawCommands[i], 0, 1, &vertexBuffer, vbOffsets);
-        vkCmdBindDescriptorSets(drawCommands[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
-        vkCmdDraw(drawCommands[i], (uint32_t)vertices.size(), 1, 0, 0);
-        vkCmdEndRenderPass(drawCommands[i]);
-
-        assert(vkEndCommandBuffer(drawCommands[i]) == VK_SUCCESS);
-    }
+        setGraphPassRecord(&frameGraph, scenePass, [&](VkCommandBuffer command)
+        {
+            beginGpuScope(&frameProfiler, command, "render pass");
 
-    /**************************************************************************
-    Semaphores
-    */
-    VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+            if (recordThreadCount > 0)
+            {
+                // primary can only execute secondaries in this render pass, no timestamps for sprites alone
+                vkCmdBeginRenderPass(command, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+                // quad goes first so sprites are drawn on top of it, secondaries execute in task order
+                RecordTask frameTask = [&](uint32_t task, uint32_t taskCount, VkCommandBuffer command)
+                {
+                    setViewportAndScissor(command, swapChainExtent);
+
+                    if (task == 0)
+                    {
+                        vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+                        bindMesh(command, quadMesh);
+                        bindDrawParams(command, drawLayout, descriptorSet, transformParams);
+                        drawMesh(command, quadMesh, 1, 0);
+
+                        if (cullSprites)
+                            recordCulledSprites(&culler, command, spritePipeline, descriptorSet, drawLayout, quadMesh,
+                                spriteCameraParams, frameSlot);
+                    }
+
+                    if (cullSprites)
+                        return;
+
+                    // every task builds and draws its own slice of the reserved instances
+                    uint32_t first = spriteCount * task / taskCount;
+                    uint32_t end = spriteCount * (task + 1) / taskCount;
+
+                    for (uint32_t i = first; i < end; i++)
+                        spriteBatcher.instances[firstSprite + i] = buildDemoSprite(&atlas, atlasImages, frame / 60.0f, i);
+
+                    recordSpriteInstances(&spriteBatcher, command, spritePipeline, descriptorSet, drawLayout, quadMesh,
+                        spriteCameraParams, firstSprite + first, end - first);
+                };
+
+                // sprite build happens here, on workers together with recording
+                auto recordStart = std::chrono::steady_clock::now();
+                recordSecondaryCommands(&recorder, frameSlot, recordThreadCount, renderPass, swapChainFramebuffers[imageIndex],
+                    frameTask, secondaryCommands);
+                spriteBuildTotalMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - recordStart).count();
+
+                vkCmdExecuteCommands(command, (uint32_t)secondaryCommands.size(), secondaryCommands.data());
+            }
+            else
+            {
+                vkCmdBeginRenderPass(command, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+                setViewportAndScissor(command, swapChainExtent);
+                vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+                bindMesh(command, quadMesh);
+                bindDrawParams(command, drawLayout, descriptorSet, transformParams);
+                drawMesh(command, quadMesh, 1, 0);
+
+                if (cullSprites)
+                {
+                    beginGpuScope(&frameProfiler, command, "sprites");
+                    recordCulledSprites(&culler, command, spritePipeline, descriptorSet, drawLayout, quadMesh,
+                        spriteCameraParams, frameSlot);
+                    endGpuScope(&frameProfiler, command);
+                }
+                else if (spriteCount > 0)
+                {
+                    beginGpuScope(&frameProfiler, command, "sprites");
+                    recordSpriteBatches(&spriteBatcher, command, drawLayout, quadMesh, spriteCameraParams);
+                    endGpuScope(&frameProfiler, command);
+                }
+            }
 
-    VkSemaphore imageAvailableSemaphore;
-    VkSemaphore renderFinishedSemaphore;
-    assert(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &imageAvailableSemaphore) == VK_SUCCESS);
-    assert(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &renderFinishedSemaphore) == VK_SUCCESS);
+            vkCmdEndRenderPass(command);
+            endGpuScope(&frameProfiler, command);
+        });
 
-    //
-    // program loop ***********************************************************
-    //
-    MSG msg;
-    int frame = 0;
+        if (headless)
+        {
+            setGraphPassRecord(&frameGraph, readbackPass, [&](VkCommandBuffer command)
+            {
+                // graph moved image to VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                // every offscreen image has its own region in readback buffer
+                VkBufferImageCopy imageToReadback = {};
+                imageToReadback.bufferOffset = imageIndex * readbackSize;
+                imageToReadback.bufferRowLength = 0;
+                imageToReadback.bufferImageHeight = 0;
+                imageToReadback.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                imageToReadback.imageSubresource.mipLevel = 0;
+                imageToReadback.imageSubresource.baseArrayLayer = 0;
+                imageToReadback.imageSubresource.layerCount = 1;
+                imageToReadback.imageOffset = { 0, 0, 0 };
+                imageToReadback.imageExtent = { swapChainExtent.width, swapChainExtent.height, 1 };
+
+                beginGpuScope(&frameProfiler, command, "readback copy");
+                vkCmdCopyImageToBuffer(command, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                    readbackBuffer, 1, &imageToReadback);
+                endGpuScope(&frameProfiler, command);
+
+                // make copy visible to host
+                VkBufferMemoryBarrier readbackBarrier = {};
+                readbackBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+                readbackBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                readbackBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                readbackBarrier.buffer = readbackBuffer;
+                readbackBarrier.offset = imageIndex * readbackSize;
+                readbackBarrier.size = readbackSize;
+
+                vkCmdPipelineBarrier(command, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &readbackBarrier, 0, nullptr);
+            });
+        }
 
-    while (true)
-    {
-        while (PeekMessage(&msg, 0, 0, 0, PM_REMOVE))
+        // -1 if ring is full, frame is dropped and pass records nothing
+        int32_t captureSlot = -1;
+        if (capturePrefix)
         {
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
+            captureSlot = beginFrameCapture(&capture, frame, swapChainExtent.width, swapChainExtent.height);
+
+            setGraphPassRecord(&frameGraph, capturePass, [&](VkCommandBuffer command)
+            {
+                if (captureSlot < 0)
+                    return;
+
+                beginGpuScope(&frameProfiler, command, "capture copy");
+                recordFrameCapture(&capture, captureSlot, command, swapChainImages[imageIndex]);
+                endGpuScope(&frameProfiler, command);
+            });
         }
 
-        if (msg.message == WM_QUIT)
-            break;
+        executeRenderGraph(&frameGraph, drawCommand);
 
-        //
-        // draw ***************************************************************
-        //
-        uint32_t imageIndex;
-        // vkAcquireNextImageKHR returns non success if surface changes (more accurately, if surface is not available for presenting) for example when window is resized or minimalized
-        // im only handling minimalization by stoping this draw call
-        if (vkAcquireNextImageKHR(device, swapChain, LLONG_MAX, imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex) != VK_SUCCESS)
+        if (cullSprites)
         {
-            continue;
+            recordCulledCountReadback(&culler, drawCommand, frameSlot);
+            culledCountPending[frameSlot] = true;
         }
 
-        transform.scale = (sinf(frame / 30.0f) + 1) / 2.0f;
-        transform.x = 0;
-        transform.y = sinf(frame / 100.0f);
-
-        void* mappedUniformBufferMemory = nullptr;
-        vkMapMemory(device, uniformBufferMemory, 0, sizeof(transform), 0, &mappedUniformBufferMemory);
-        memcpy(mappedUniformBufferMemory, &transform, sizeof(transform));
-        vkUnmapMemory(device, uniformBufferMemory);
+        endGpuScope(&frameProfiler, drawCommand);
+        assert(vkEndCommandBuffer(drawCommand) == VK_SUCCESS);
+        endCpuPhase(&cpuProfiler, CPU_PHASE_RECORD);
 
         VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
 
         VkSubmitInfo drawCommandSubmitInfo = {};
         drawCommandSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        drawCommandSubmitInfo.waitSemaphoreCount = 1;
-        drawCommandSubmitInfo.pWaitSemaphores = &imageAvailableSemaphore;
+        // nothing to wait for or signal when there is no presentation
+        drawCommandSubmitInfo.waitSemaphoreCount = headless ? 0 : 1;
+        drawCommandSubmitInfo.pWaitSemaphores = &imageAvailableSemaphores[frameSlot];
         drawCommandSubmitInfo.pWaitDstStageMask = waitStages;
         drawCommandSubmitInfo.commandBufferCount = 1;
-        drawCommandSubmitInfo.pCommandBuffers = &drawCommands[imageIndex];
-        drawCommandSubmitInfo.signalSemaphoreCount = 1;
-        drawCommandSubmitInfo.pSignalSemaphores = &renderFinishedSemaphore;
-
-        assert(vkQueueSubmit(queue, 1, &drawCommandSubmitInfo, VK_NULL_HANDLE) == VK_SUCCESS);
-
-        // tutorial has a section about this but code appears unfinished and it works without it anyway
-        //VkSubpassDependency dependency = {};
-        //dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        //dependency.dstSubpass = 0;
-        //dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        //dependency.srcAccessMask = 0;
-        //dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        //dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        //VkRenderPassCreateInfo renderPassInfo = {};
-        //renderPassInfo.dependencyCount = 1;
-        //renderPassInfo.pDependencies = &dependency;
-
-        VkPresentInfoKHR presentInfo = {};
-        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-        presentInfo.waitSemaphoreCount = 1;
-        presentInfo.pWaitSemaphores = &renderFinishedSemaphore;
-        presentInfo.swapchainCount = 1;
-        presentInfo.pSwapchains = &swapChain;
-        presentInfo.pImageIndices = &imageIndex;
-
-        vkQueuePresentKHR(queue, &presentInfo);
-
-        // this is NOT OPTIMAL way to wait until queue is done before continuing
-        // without this it's possible that draw() function will be called faster than gpu can actually render and this will make program grow in memory usage
-        vkQueueWaitIdle(queue);
+        drawCommandSubmitInfo.pCommandBuffers = &drawCommand;
+        drawCommandSubmitInfo.signalSemaphoreCount = headless ? 0 : 1;
+        drawCommandSubmitInfo.pSignalSemaphores = &renderFinishedSemaphores[frameSlot];
+
+        assert(vkQueueSubmit(queue, 1, &drawCommandSubmitInfo, inFlightFences[frameSlot]) == VK_SUCCESS);
+        if (captureSlot >= 0)
+            submitFrameCapture(&capture, captureSlot, queue);
+        endCpuPhase(&cpuProfiler, CPU_PHASE_SUBMIT);
+        if (headless)
+            markCpuPresent(&cpuProfiler);
+
+        if (!headless)
+        {
+            VkPresentInfoKHR presentInfo = {};
+            presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+            presentInfo.waitSemaphoreCount = 1;
+            presentInfo.pWaitSemaphores = &renderFinishedSemaphores[frameSlot];
+            presentInfo.swapchainCount = 1;
+            presentInfo.pSwapchains = &swapChain;
+            presentInfo.pImageIndices = &imageIndex;
+
+            // out of date image wasnt shown, suboptimal was but doesnt match surface anymore
+            VkResult presentResult = vkQueuePresentKHR(queue, &presentInfo);
+            if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR)
+                swapChainOutOfDate = true;
+            else
+                assert(presentResult == VK_SUCCESS);
+
+            endCpuPhase(&cpuProfiler, CPU_PHASE_PRESENT);
+            markCpuPresent(&cpuProfiler);
+        }
 
+        // there is no vkQueueWaitIdle here, cpu continues with next frame while gpu renders this one
+        // fence wait at the top of the loop keeps cpu at most framesInFlight frames ahead
+        // frame that failed to acquire is not ended, its time goes to next one
+        endCpuFrame(&cpuProfiler, frame);
         frame++;
+
+        if (cpuReportInterval > 0)
+        {
+            auto now = std::chrono::steady_clock::now();
+
+            if (std::chrono::duration<double>(now - lastCpuReport).count() >= cpuReportInterval)
+            {
+                printf("--- frame %d\n", frame);
+                printCpuProfilerReport(&cpuProfiler);
+                lastCpuReport = now;
+                // printing is not part of next frame
+                resumeCpuProfiler(&cpuProfiler);
+            }
+        }
     }
 
     //
@@ -1157,37 +8856,137 @@ int main()
     // this is so all queues are finished and dont destroy anything before that
     vkDeviceWaitIdle(device);
 
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loopStart).count();
+    if (frame > 0)
+    {
+        printf("%d frames %ux%u in %.3f s, %.3f ms/frame, %.1f fps, %u frames in flight\n", frame,
+            swapChainExtent.width, swapChainExtent.height, seconds, seconds * 1000.0 / frame, frame / seconds, framesInFlight);
+        printf("cpu stalled on fences: %.3f ms total, %.3f ms/frame, %.3f ms max\n",
+            fenceWaitTotalMs, fenceWaitTotalMs / frame, fenceWaitMaxMs);
+        if (swapChainRecreateCount > 0)
+            printf("swapchain recreated %u time(s)\n", swapChainRecreateCount);
+        printCpuProfilerReport(&cpuProfiler);
+        printf("descriptor sets: %u allocated from %u pool(s), cache %llu hit(s) %llu miss(es)\n",
+            descriptorCache.pools.setsAllocated, descriptorCache.pools.poolCount,
+            (unsigned long long)descriptorCache.hits, (unsigned long long)descriptorCache.misses);
+
+        if (cullSprites)
+        {
+            printf("sprites: %u culled on gpu, %.1f visible per frame on average, 1 indirect draw call\n",
+                spriteCount, culledFrameCount > 0 ? culledVisibleTotal / culledFrameCount : 0.0);
+        }
+        else if (spriteCount > 0)
+        {
+            // overall throughput is limited by whichever of cpu or gpu is slower
+            double spritesDrawn = (double)spriteCount * frame;
+            printf("sprites: %u per frame in %u draw call(s), cpu build %.3f ms/frame (%.1f sprites/ms), overall %.1f sprites/ms\n",
+                spriteCount, spriteBatchCount, spriteBuildTotalMs / frame, spritesDrawn / spriteBuildTotalMs,
+                spritesDrawn / (seconds * 1000.0));
+        }
+    }
+
+    // device is idle, last frames in flight can be read
+    flushGpuProfiler(&frameProfiler);
+    flushGpuProfiler(&uploadProfiler);
+    printGpuProfilerStats(&frameProfiler);
+    printGpuProfilerStats(&uploadProfiler);
+
+    // encoders can still be busy with last frames
+    if (capturePrefix)
+    {
+        flushFrameCapture(&capture);
+        printFrameCaptureStats(&capture);
+    }
+    closeGpuTraceWriter(&gpuTrace);
+
+    // readback buffer contains last frame in the region of its offscreen image
+    if (headless && headlessOutputFile && frame > 0)
+    {
+        uint32_t lastImageIndex = (frame - 1) % framesInFlight;
+        writePpm(headlessOutputFile, (const byte*)mappedReadbackBufferMemory + lastImageIndex * readbackSize,
+            swapChainExtent.width, swapChainExtent.height);
+    }
+
     vkDestroySampler(device, textureSampler, nullptr);
     vkDestroyImageView(device, textureImageView, nullptr);
-    vkDestroyImage(device, textureImage, nullptr);
-    vkFreeMemory(device, textureImageMemory, nullptr);
-    vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexBufferMemory, nullptr);
-    vkDestroySemaphore(device, renderFinishedSemaphore, nullptr);
-    vkDestroySemaphore(device, imageAvailableSemaphore, nullptr);
+    destroyTexture(&allocator, &texture);
+    destroyMesh(&allocator, &quadMesh);
+
+    for (uint32_t i = 0; i < framesInFlight; i++)
+    {
+        vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
+        vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
+        vkDestroyFence(device, inFlightFences[i], nullptr);
+    }
+
+    destroyRingBuffer(&allocator, &uniformRing);
+    destroyUploadManager(&uploads);
+    destroyGpuProfiler(&uploadProfiler);
+    destroyGpuProfiler(&frameProfiler);
+    destroyTextureAtlas(&allocator, &atlas);
+    if (spriteCount > 0)
+        destroySpriteBatcher(&allocator, &spriteBatcher);
+    if (cullerCreated)
+        destroyGpuCuller(&allocator, &culler);
+
+    destroyRenderGraph(&frameGraph);
+    if (capturePrefix)
+        destroyFrameCapture(&capture);
+
     vkDestroyCommandPool(device, commandPool, nullptr);
+    if (recordThreadCount > 0)
+        destroyCommandRecorder(&recorder);
 
-    for (size_t i = 0; i < swapChainFramebuffers.size(); i++)
-        vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
+    // device is idle so every retired swapchain can go
+    destroyRetiredSwapchains(device, &retiredSwapchains, INT_MAX);
+    destroyFramebuffers(device, &swapChainImageViews, &swapChainFramebuffers);
 
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    if (spritePipeline != VK_NULL_HANDLE)
+        vkDestroyPipeline(device, spritePipeline, nullptr);
+    vkDestroyPipelineLayout(device, drawLayout.pipelineLayout, nullptr);
+    vkDestroyShaderModule(device, psModule, nullptr);
+    vkDestroyShaderModule(device, vsModule, nullptr);
+
+    // cache has everything compiled in this run, also pipelines that were loaded from file
+    if (pipelineCacheFile)
+        savePipelineCache(device, pipelineCache, pipelineCacheFile);
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
     vkDestroyRenderPass(device, renderPass, nullptr);
-    vkDestroyBuffer(device, uniformBuffer, nullptr);
-    vkFreeMemory(device, uniformBufferMemory, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    destroyDescriptorSetCache(&descriptorCache);
+
+    if (headless)
+    {
+        // swapchain didnt create these so they must be destroyed by hand
+        for (size_t i = 0; i < swapChainImages.size(); i++)
+            destroyImage(&allocator, swapChainImages[i], &offscreenImageMemory[i]);
+
+        destroyBuffer(&allocator, readbackBuffer, &readbackBufferMemory);
+    }
+    else
+    {
+        vkDestroySwapchainKHR(device, swapChain, nullptr);
+        vkDestroySurfaceKHR(vkInstance, surface, nullptr);
+    }
 
-    for (size_t i = 0; i < swapChainImageViews.size(); i++)
-        vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+    // everything was freed, stats show what is left in blocks (should be nothing in use)
+    printDeviceAllocatorStats(&allocator);
+    destroyDeviceAllocator(&allocator);
 
-    vkDestroySwapchainKHR(device, swapChain, nullptr);
-    vkDestroySurfaceKHR(vkInstance, surface, nullptr);
     vkDestroyDevice(device, nullptr);
     vkDestroyInstance(vkInstance, nullptr);
 
-    DestroyWindow(hwnd);
-    UnregisterClass(wndClassName, hinstance);
+    if (assets)
+        closeAssetPackage(assets);
+
+#ifdef _WIN32
+    if (hwnd)
+    {
+        DestroyWindow(hwnd);
+        UnregisterClass(wndClassName, hinstance);
+    }
+#endif
 
     return 0;
 }
@@ -0,0 +1,16 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+// glslangValidator -V sprite.frag -o sprite_frag.spv
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in float fragLayer;
+
+layout(location = 0) out vec4 outColor;
+
+// texture atlas, every page is one layer
+layout(binding = 2) uniform sampler2DArray atlasSampler;
+
+void main() {
+    outColor = texture(atlasSampler, vec3(fragTexCoord, fragLayer)) * fragColor;
+}
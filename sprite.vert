@@ -0,0 +1,47 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+// instanced version of glsl.vert, one instance is one sprite
+// glslangValidator -V sprite.vert -o sprite_vert.spv
+// glslangValidator -V -DPUSH_CONSTANTS sprite.vert -o sprite_vert_push.spv
+
+// Transform in main.cpp, pushed with every draw or read from uniform ring
+#ifdef PUSH_CONSTANTS
+layout(push_constant) uniform PushConstants {
+    float scale;
+    float x;
+	float y;
+} ubo;
+#else
+layout(binding = 0) uniform UniformBufferObject {
+    float scale;
+    float x;
+	float y;
+} ubo;
+#endif
+
+// per vertex (binding 0), same quad as glsl.vert
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+
+// per instance (binding 1)
+layout(location = 3) in vec2 inSpritePosition;
+layout(location = 4) in vec2 inSpriteScale;
+// u0, v0, u1, v1
+layout(location = 5) in vec4 inSpriteUv;
+layout(location = 6) in vec4 inSpriteColor;
+// atlas page
+layout(location = 7) in float inSpriteLayer;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out float fragLayer;
+
+void main() {
+    vec2 position = inSpritePosition + inPosition * inSpriteScale;
+    gl_Position = vec4(position.x * ubo.scale + ubo.x, position.y * ubo.scale + ubo.y, 0.0, 1.0);
+    fragColor = inSpriteColor;
+    // quad corners are -0.5..0.5
+	fragTexCoord = mix(inSpriteUv.xy, inSpriteUv.zw, inPosition + 0.5);
+    fragLayer = inSpriteLayer;
+}